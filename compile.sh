@@ -3,6 +3,8 @@
 mkdir -p ./build
 
 # clang -g -O0 src/main.c -o ./build/babl -I/usr/include/freetype2 -lfreetype -lSDL2
+# text buffer backend for src/main.c: -DTEXT_BUFFER_BACKEND_UTF8, -DTEXT_BUFFER_BACKEND_GAP, -DTEXT_BUFFER_BACKEND_ASCII (default is the piece table)
+# clang -O2 src/bench_main.c -o ./build/bench
 
-clang -g -O0 src/sdl2_main.c src/babl.c -o ./build/babl -I/usr/include/freetype2 -lfreetype -lSDL2
+clang -g -O0 src/sdl2_main.c src/babl.c src/blend.c -o ./build/babl -I/usr/include/freetype2 -lfreetype -lSDL2
 
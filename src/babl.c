@@ -32,6 +32,10 @@ bool babl_rect_invalid(BablRect r) {
   return r.left > r.right || r.top > r.bottom;
 }
 
+bool babl_rect_empty(BablRect r) {
+  return r.left >= r.right || r.top >= r.bottom;
+}
+
 s32 babl_rect_width(BablRect r) {
   return r.right - r.left;
 }
@@ -40,6 +44,54 @@ s32 babl_rect_height(BablRect r) {
   return r.bottom - r.top;
 }
 
+static s64 babl_rect_area(BablRect r) {
+  return (s64)babl_rect_width(r) * (s64)babl_rect_height(r);
+}
+
+static bool babl_rect_touch(BablRect a, BablRect b) {
+  return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+}
+
+void babl_damage_add(BablDamage *damage, BablRect r) {
+  if(babl_rect_empty(r)) {
+    return;
+  }
+  // NOTE: a merged rect can reach others, keep merging until it touches none
+  bool merged = true;
+  while(merged) {
+    merged = false;
+    for(u32 i = 0; i < damage->count; ++i) {
+      if(babl_rect_touch(damage->rects[i], r)) {
+        r = babl_rect_union(r, damage->rects[i]);
+        damage->rects[i] = damage->rects[--damage->count];
+        merged = true;
+        break;
+      }
+    }
+  }
+  if(damage->count < array_len(damage->rects)) {
+    damage->rects[damage->count++] = r;
+    return;
+  }
+  u32 best = 0;
+  s64 best_growth = 0;
+  for(u32 i = 0; i < damage->count; ++i) {
+    BablRect u = babl_rect_union(damage->rects[i], r);
+    s64 growth = babl_rect_area(u) - babl_rect_area(damage->rects[i]);
+    if(i == 0 || growth < best_growth) {
+      best = i;
+      best_growth = growth;
+    }
+  }
+  r = babl_rect_union(damage->rects[best], r);
+  damage->rects[best] = damage->rects[--damage->count];
+  babl_damage_add(damage, r);
+}
+
+void babl_damage_clear(BablDamage *damage) {
+  damage->count = 0;
+}
+
 bool babl_push_event(BablCtx *ctx, BablEvent event) {
   if(ctx->event_queue_size >= array_len(ctx->event_queue)) {
     return false;
@@ -55,5 +107,6 @@ void babl_init(BablCtx *ctx, BablRenderer render) {
 }
 
 void babl_update_and_render(BablCtx *ctx) {
+  ctx->render.clear(0xaaaaaaaa);
   ctx->render.draw_rect(10, 10, 100, 100, 0xff0000);
 }
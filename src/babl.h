@@ -32,14 +32,35 @@ BablRect babl_rect_intersection(BablRect a, BablRect b);
 BablRect babl_rect_union(BablRect a, BablRect b);
 BablRect babl_rect_translate(BablRect r, s32 x, s32 y);
 bool babl_rect_invalid(BablRect r);
+bool babl_rect_empty(BablRect r);
 s32 babl_rect_width(BablRect r);
 s32 babl_rect_height(BablRect r);
 
+#define BABL_DAMAGE_MAX 16
+
+// NOTE: a small set of rects that need to be redrawn or uploaded. Rects that
+// touch are merged and when the set is full the new rect is merged into the
+// one that grows the least, so the rects never overlap
+typedef struct BablDamage BablDamage;
+struct BablDamage {
+  BablRect rects[BABL_DAMAGE_MAX];
+  u32 count;
+};
+
+void babl_damage_add(BablDamage *damage, BablRect r);
+void babl_damage_clear(BablDamage *damage);
+
 typedef struct BablTextureU32 BablTextureU32;
 typedef struct BablTextureU8 BablTextureU8;
 
 typedef struct BablRenderer BablRenderer;
 struct BablRenderer {
+  // NOTE: only the invalidated parts of the screen are cleared, drawn and
+  // presented, the rest keeps what was drawn in earlier frames. A rect
+  // invalidated in a frame is drawn by the calls that follow in that frame,
+  // unless the backend draws straight into a locked texture, then it waits
+  // for the next frame. NULL invalidates the whole screen
+  void (*invalidate)(BablRect *rect);
   void (*clear)(u32 color);
   void (*set_clip)(BablRect *clip);
   
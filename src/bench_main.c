@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/scan.c"
+#include "core/line_tree.c"
+#include "core/line_btree.c"
+#include "blend.c"
+
+// NOTE: line_tree_draw pulls in the renderer, the benchmarks never call it
+void render_line(s32 x0, s32 y0, s32 x1, s32 y1, u32 color) {}
+void render_rect(s32 x, s32 y, s32 width, s32 height, u32 color) {}
+void render_text(RenderFont rf, char *text, s32 x, s32 y, u32 fg, u32 bg) {}
+
+#define BENCH_LINES 2000000
+#define BENCH_LOOKUPS 2000000
+#define BENCH_EDITS 1000000
+#define BENCH_SCAN_SIZE (256 << 20)
+#define BENCH_SCAN_REPEAT 4
+#define BENCH_BLEND_WIDTH 1920
+#define BENCH_BLEND_HEIGHT 1080
+#define BENCH_BLEND_REPEAT 64
+
+static u64 bench_rng_state = 0x9e3779b97f4a7c15ull;
+
+static u64 bench_rand(void) {
+	bench_rng_state ^= bench_rng_state << 13;
+	bench_rng_state ^= bench_rng_state >> 7;
+	bench_rng_state ^= bench_rng_state << 17;
+	return bench_rng_state;
+}
+
+static f64 bench_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+static void bench_report(char *name, char *index, f64 seconds, u64 ops) {
+	printf("%-24s %-10s %8.2f ms %8.1f ns/op\n", name, index, seconds * 1e3, seconds * 1e9 / (f64)ops);
+}
+
+static void bench_report_bandwidth(char *name, char *level, f64 seconds, u64 bytes) {
+	printf("%-24s %-10s %8.2f ms %8.2f GB/s\n", name, level, seconds * 1e3, (f64)bytes / seconds * 1e-9);
+}
+
+// NOTE: a document with BENCH_LINES lines of 0 to 80 bytes
+static u8 *bench_document(u64 *size) {
+	u64 capacity = (u64)BENCH_LINES * 81;
+	u8 *data = (u8 *)malloc(capacity);
+	assert(data);
+	u64 s = 0;
+	for(u32 line = 0; line < BENCH_LINES; line++) {
+		u32 len = (u32)(bench_rand() % 81);
+		memset(data + s, 'a', len);
+		s += len;
+		data[s++] = '\n';
+	}
+	*size = s;
+	return data;
+}
+
+static void bench_line_index(void) {
+	printf("line index: %u lines\n", BENCH_LINES);
+
+	u64 size;
+	u8 *document = bench_document(&size);
+	u32 *lines = (u32 *)malloc(BENCH_LOOKUPS * sizeof(*lines));
+	for(u32 i = 0; i < BENCH_LOOKUPS; i++) {
+		lines[i] = (u32)(bench_rand() % BENCH_LINES);
+	}
+
+	LineTree tree;
+	LineBTree btree;
+	line_tree_init(&tree);
+	line_btree_init(&btree);
+
+	f64 start = bench_time();
+	line_tree_insert_range(&tree, 0, document, size);
+	bench_report("load", "rb-tree", bench_time() - start, BENCH_LINES);
+	start = bench_time();
+	line_btree_insert_range(&btree, 0, document, size);
+	bench_report("load", "b+tree", bench_time() - start, BENCH_LINES);
+
+	u64 checksum = 0;
+	u64 offset, len;
+
+	start = bench_time();
+	for(u32 i = 0; i < BENCH_LOOKUPS; i++) {
+		line_tree_find_line(&tree, lines[i], &offset, &len);
+		checksum += offset;
+	}
+	bench_report("random line lookup", "rb-tree", bench_time() - start, BENCH_LOOKUPS);
+	start = bench_time();
+	for(u32 i = 0; i < BENCH_LOOKUPS; i++) {
+		line_btree_find_line(&btree, lines[i], &offset, &len);
+		checksum -= offset;
+	}
+	bench_report("random line lookup", "b+tree", bench_time() - start, BENCH_LOOKUPS);
+
+	start = bench_time();
+	for(u32 i = 0; i < BENCH_LINES; i++) {
+		line_tree_find_line(&tree, i, &offset, &len);
+		checksum += len;
+	}
+	bench_report("sequential lines", "rb-tree", bench_time() - start, BENCH_LINES);
+	start = bench_time();
+	for(u32 i = 0; i < BENCH_LINES; i++) {
+		line_btree_find_line(&btree, i, &offset, &len);
+		checksum -= len;
+	}
+	bench_report("sequential lines", "b+tree", bench_time() - start, BENCH_LINES);
+
+	// NOTE: the same random mix of typing, new lines and deletes on both
+	u64 rng_state = bench_rng_state;
+	u64 document_size = size;
+	for(u32 pass = 0; pass < 2; pass++) {
+		bench_rng_state = rng_state;
+		size = document_size;
+		start = bench_time();
+		for(u32 i = 0; i < BENCH_EDITS; i++) {
+			u64 r = bench_rand();
+			u64 at = (r >> 8) % size;
+			switch(r & 7) {
+				case 0: {
+					if(pass == 0) line_tree_insert_range(&tree, at, (u8 *)"\n", 1);
+					else line_btree_insert_range(&btree, at, (u8 *)"\n", 1);
+					size++;
+				} break;
+				case 1: case 2: {
+					if(pass == 0) line_tree_delete_range(&tree, at, 1);
+					else line_btree_delete_range(&btree, at, 1);
+					size--;
+				} break;
+				default: {
+					if(pass == 0) line_tree_insert_range(&tree, at, (u8 *)"x", 1);
+					else line_btree_insert_range(&btree, at, (u8 *)"x", 1);
+					size++;
+				} break;
+			}
+		}
+		bench_report("edit storm", pass == 0 ? "rb-tree" : "b+tree", bench_time() - start, BENCH_EDITS);
+	}
+
+	assert(tree.size == btree.size);
+	for(u32 i = 0; i < 1000; i++) {
+		u32 line = (u32)(bench_rand() % BENCH_LINES);
+		u64 a_offset, a_len, b_offset, b_len;
+		bool a = line_tree_find_line(&tree, line, &a_offset, &a_len);
+		bool b = line_btree_find_line(&btree, line, &b_offset, &b_len);
+		assert(a == b && (!a || (a_offset == b_offset && a_len == b_len)));
+	}
+	printf("checksum %llu\n\n", (unsigned long long)checksum);
+
+	line_tree_destroy(&tree);
+	line_btree_destroy(&btree);
+	free(lines);
+	free(document);
+}
+
+// NOTE: every kernel runs over the whole buffer, the bytes it searches for are
+// not in it and the nth new line is the last one
+static void bench_scan(void) {
+	printf("scan: %u MB\n", BENCH_SCAN_SIZE >> 20);
+
+	u8 *data = (u8 *)malloc(BENCH_SCAN_SIZE);
+	assert(data);
+	for(u64 i = 0; i < BENCH_SCAN_SIZE; i++) {
+		data[i] = bench_rand() % 40 == 0 ? '\n' : 'a' + (u8)(bench_rand() % 26);
+	}
+	u64 newlines = scan_count_byte(data, BENCH_SCAN_SIZE, '\n');
+	u64 *offsets = (u64 *)malloc(newlines * sizeof(*offsets));
+	assert(offsets);
+
+	u64 checksum = 0;
+	u64 bytes = (u64)BENCH_SCAN_SIZE * BENCH_SCAN_REPEAT;
+	f64 start;
+
+	start = bench_time();
+	for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+		// NOTE: a different byte every time so the call is not hoisted out
+		checksum += (u64)(memchr(data, '|' + r, BENCH_SCAN_SIZE) != 0);
+	}
+	bench_report_bandwidth("memchr", "libc", bench_time() - start, bytes);
+
+	for(u32 level = 0; level < CPU_LEVEL_COUNT; level++) {
+		if(!scan_set_level((CpuLevel)level)) {
+			continue;
+		}
+		char *name = cpu_level_name((CpuLevel)level);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += scan_count_byte(data, BENCH_SCAN_SIZE, '\n');
+		}
+		bench_report_bandwidth("count new lines", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += (u64)(scan_find_nth_byte(data, BENCH_SCAN_SIZE, '\n', newlines - 1) - data);
+		}
+		bench_report_bandwidth("find nth new line", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += scan_collect_byte(data, BENCH_SCAN_SIZE, '\n', 0, offsets);
+		}
+		bench_report_bandwidth("collect new lines", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += (u64)(scan_memchr2(data, BENCH_SCAN_SIZE, '|', '~') != 0);
+		}
+		bench_report_bandwidth("memchr2", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += (u64)(scan_memchr3(data, BENCH_SCAN_SIZE, '|', '~', '{') != 0);
+		}
+		bench_report_bandwidth("memchr3", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += (u64)(scan_find_pair(data, BENCH_SCAN_SIZE, '|', '~', 5) != 0);
+		}
+		bench_report_bandwidth("find pair", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += scan_ascii_prefix(data, BENCH_SCAN_SIZE);
+		}
+		bench_report_bandwidth("ascii prefix", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += scan_utf8_length(data, BENCH_SCAN_SIZE);
+		}
+		bench_report_bandwidth("utf-8 length", name, bench_time() - start, bytes);
+
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_SCAN_REPEAT; r++) {
+			checksum += (u64)scan_utf8_valid(data, BENCH_SCAN_SIZE);
+		}
+		bench_report_bandwidth("utf-8 validate", name, bench_time() - start, bytes);
+	}
+	printf("checksum %llu\n\n", (unsigned long long)checksum);
+
+	scan_init();
+	free(offsets);
+	free(data);
+}
+
+// NOTE: blends a full hd frame row by row like the software renderer does
+// with glyphs and images, every level has to give the scalar pixels
+static void bench_blend(void) {
+	printf("blend: %ux%u\n", BENCH_BLEND_WIDTH, BENCH_BLEND_HEIGHT);
+
+	u64 pixels = (u64)BENCH_BLEND_WIDTH * BENCH_BLEND_HEIGHT;
+	u32 *frame = (u32 *)malloc(pixels * sizeof(u32));
+	u32 *expected_u8 = (u32 *)malloc(pixels * sizeof(u32));
+	u32 *expected_u32 = (u32 *)malloc(pixels * sizeof(u32));
+	u32 *image = (u32 *)malloc(pixels * sizeof(u32));
+	u8 *coverage = (u8 *)malloc(pixels);
+	assert(frame && expected_u8 && expected_u32 && image && coverage);
+	for(u64 i = 0; i < pixels; i++) {
+		image[i] = (u32)bench_rand();
+		coverage[i] = (u8)bench_rand();
+	}
+
+	u64 bytes = pixels * sizeof(u32) * BENCH_BLEND_REPEAT;
+	u64 checksum = 0;
+	f64 start;
+
+	for(u32 level = 0; level < CPU_LEVEL_COUNT; level++) {
+		if(!blend_set_level((CpuLevel)level)) {
+			continue;
+		}
+		char *name = cpu_level_name((CpuLevel)level);
+
+		memset(frame, 0x40, pixels * sizeof(u32));
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_BLEND_REPEAT; r++) {
+			for(u32 y = 0; y < BENCH_BLEND_HEIGHT; y++) {
+				u64 row = (u64)y * BENCH_BLEND_WIDTH;
+				blend_row_u8(frame + row, coverage + row, BENCH_BLEND_WIDTH, 0xffe0c080 + r);
+			}
+		}
+		bench_report_bandwidth("blend u8", name, bench_time() - start, bytes);
+		if(level == CPU_LEVEL_SCALAR) {
+			memcpy(expected_u8, frame, pixels * sizeof(u32));
+		}
+		assert(memcmp(expected_u8, frame, pixels * sizeof(u32)) == 0);
+
+		memset(frame, 0x40, pixels * sizeof(u32));
+		start = bench_time();
+		for(u32 r = 0; r < BENCH_BLEND_REPEAT; r++) {
+			for(u32 y = 0; y < BENCH_BLEND_HEIGHT; y++) {
+				u64 row = (u64)y * BENCH_BLEND_WIDTH;
+				blend_row_u32(frame + row, image + row, BENCH_BLEND_WIDTH);
+			}
+		}
+		bench_report_bandwidth("blend u32", name, bench_time() - start, bytes);
+		if(level == CPU_LEVEL_SCALAR) {
+			memcpy(expected_u32, frame, pixels * sizeof(u32));
+		}
+		assert(memcmp(expected_u32, frame, pixels * sizeof(u32)) == 0);
+		checksum += frame[pixels / 2];
+	}
+	printf("checksum %llu\n\n", (unsigned long long)checksum);
+
+	blend_init();
+	free(coverage);
+	free(image);
+	free(expected_u32);
+	free(expected_u8);
+	free(frame);
+}
+
+int main(void) {
+	scan_init();
+	blend_init();
+	bench_scan();
+	bench_blend();
+	bench_line_index();
+	return 0;
+}
@@ -0,0 +1,235 @@
+#include "blend.h"
+
+#include <string.h>
+
+typedef struct BlendKernels BlendKernels;
+struct BlendKernels {
+  void (*row_u8)(u32 *dst, const u8 *alpha, u32 count, u32 color);
+  void (*row_u32)(u32 *dst, const u32 *src, u32 count);
+};
+
+// NOTE: portable blend, the simd rows finish their last pixels with it
+
+static void blend_row_u8_scalar(u32 *dst, const u8 *alpha, u32 count, u32 color) {
+  u32 src_r = (color >> 16) & 0xff;
+  u32 src_g = (color >> 8) & 0xff;
+  u32 src_b = (color >> 0) & 0xff;
+  for(u32 i = 0; i < count; ++i) {
+    u32 a = alpha[i];
+    u32 d = dst[i];
+    u32 dst_r = (d >> 16) & 0xff;
+    u32 dst_g = (d >> 8) & 0xff;
+    u32 dst_b = (d >> 0) & 0xff;
+    u32 inv = 255 - a;
+    u32 r = (dst_r * inv + src_r * a) >> 8;
+    u32 g = (dst_g * inv + src_g * a) >> 8;
+    u32 b = (dst_b * inv + src_b * a) >> 8;
+    dst[i] = (0xffu << 24) | (r << 16) | (g << 8) | b;
+  }
+}
+
+static void blend_row_u32_scalar(u32 *dst, const u32 *src, u32 count) {
+  for(u32 i = 0; i < count; ++i) {
+    u32 s = src[i];
+    u32 d = dst[i];
+    u32 a = (s >> 24) & 0xff;
+    u32 src_r = (s >> 16) & 0xff;
+    u32 src_g = (s >> 8) & 0xff;
+    u32 src_b = (s >> 0) & 0xff;
+    u32 dst_r = (d >> 16) & 0xff;
+    u32 dst_g = (d >> 8) & 0xff;
+    u32 dst_b = (d >> 0) & 0xff;
+    u32 inv = 255 - a;
+    u32 r = (dst_r * inv + src_r * a) >> 8;
+    u32 g = (dst_g * inv + src_g * a) >> 8;
+    u32 b = (dst_b * inv + src_b * a) >> 8;
+    dst[i] = (0xffu << 24) | (r << 16) | (g << 8) | b;
+  }
+}
+
+static const BlendKernels blend_kernels_scalar = {
+  blend_row_u8_scalar,
+  blend_row_u32_scalar,
+};
+
+#if defined(CPU_X86)
+
+// NOTE: sse2 kernels, 8 pixels per step. The channels are widened to 16 bits,
+// the largest sum is 255 * 255 so nothing overflows and the shift is logical
+
+CPU_SSE2 static __m128i blend_channels_sse2(__m128i d, __m128i s, __m128i a) {
+  __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(d, inv), _mm_mullo_epi16(s, a));
+  return _mm_srli_epi16(sum, 8);
+}
+
+// NOTE: four pixels against four alpha bytes
+CPU_SSE2 static __m128i blend_pixels_u8_sse2(__m128i d, u32 alpha, __m128i color) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = _mm_cvtsi32_si128((int)alpha);
+  a = _mm_unpacklo_epi8(a, a);
+  a = _mm_unpacklo_epi16(a, a);
+  __m128i lo = blend_channels_sse2(_mm_unpacklo_epi8(d, zero), color, _mm_unpacklo_epi8(a, zero));
+  __m128i hi = blend_channels_sse2(_mm_unpackhi_epi8(d, zero), color, _mm_unpackhi_epi8(a, zero));
+  return _mm_or_si128(_mm_packus_epi16(lo, hi), _mm_set1_epi32((int)0xff000000));
+}
+
+CPU_SSE2 static __m128i blend_pixels_u32_sse2(__m128i d, __m128i s) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+  __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+  __m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xff), 0xff);
+  __m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xff), 0xff);
+  __m128i lo = blend_channels_sse2(_mm_unpacklo_epi8(d, zero), s_lo, a_lo);
+  __m128i hi = blend_channels_sse2(_mm_unpackhi_epi8(d, zero), s_hi, a_hi);
+  return _mm_or_si128(_mm_packus_epi16(lo, hi), _mm_set1_epi32((int)0xff000000));
+}
+
+CPU_SSE2 static void blend_row_u8_sse2(u32 *dst, const u8 *alpha, u32 count, u32 color) {
+  __m128i c = _mm_setr_epi16((short)(color & 0xff), (short)((color >> 8) & 0xff), (short)((color >> 16) & 0xff), 0,
+                             (short)(color & 0xff), (short)((color >> 8) & 0xff), (short)((color >> 16) & 0xff), 0);
+  u32 i = 0;
+  for(; i + 8 <= count; i += 8) {
+    u32 a0;
+    u32 a1;
+    memcpy(&a0, alpha + i, sizeof(a0));
+    memcpy(&a1, alpha + i + 4, sizeof(a1));
+    __m128i d0 = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i d1 = _mm_loadu_si128((const __m128i *)(dst + i + 4));
+    _mm_storeu_si128((__m128i *)(dst + i), blend_pixels_u8_sse2(d0, a0, c));
+    _mm_storeu_si128((__m128i *)(dst + i + 4), blend_pixels_u8_sse2(d1, a1, c));
+  }
+  blend_row_u8_scalar(dst + i, alpha + i, count - i, color);
+}
+
+CPU_SSE2 static void blend_row_u32_sse2(u32 *dst, const u32 *src, u32 count) {
+  u32 i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m128i s0 = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(src + i + 4));
+    __m128i d0 = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i d1 = _mm_loadu_si128((const __m128i *)(dst + i + 4));
+    _mm_storeu_si128((__m128i *)(dst + i), blend_pixels_u32_sse2(d0, s0));
+    _mm_storeu_si128((__m128i *)(dst + i + 4), blend_pixels_u32_sse2(d1, s1));
+  }
+  blend_row_u32_scalar(dst + i, src + i, count - i);
+}
+
+static const BlendKernels blend_kernels_sse2 = {
+  blend_row_u8_sse2,
+  blend_row_u32_sse2,
+};
+
+// NOTE: avx2 kernels, 16 pixels per step. Unpacking and packing stay inside
+// each 128 bit lane so the pixels come back in order
+
+CPU_AVX2 static __m256i blend_channels_avx2(__m256i d, __m256i s, __m256i a) {
+  __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+  __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(d, inv), _mm256_mullo_epi16(s, a));
+  return _mm256_srli_epi16(sum, 8);
+}
+
+// NOTE: eight pixels against the eight alpha bytes at the bottom of alpha,
+// every byte is repeated for the four channels of its pixel
+CPU_AVX2 static __m256i blend_pixels_u8_avx2(__m256i d, __m128i alpha, __m256i color) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                    4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+  __m256i a = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(alpha), spread);
+  __m256i lo = blend_channels_avx2(_mm256_unpacklo_epi8(d, zero), color, _mm256_unpacklo_epi8(a, zero));
+  __m256i hi = blend_channels_avx2(_mm256_unpackhi_epi8(d, zero), color, _mm256_unpackhi_epi8(a, zero));
+  return _mm256_or_si256(_mm256_packus_epi16(lo, hi), _mm256_set1_epi32((int)0xff000000));
+}
+
+CPU_AVX2 static __m256i blend_pixels_u32_avx2(__m256i d, __m256i s) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+  __m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+  __m256i a_lo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, 0xff), 0xff);
+  __m256i a_hi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, 0xff), 0xff);
+  __m256i lo = blend_channels_avx2(_mm256_unpacklo_epi8(d, zero), s_lo, a_lo);
+  __m256i hi = blend_channels_avx2(_mm256_unpackhi_epi8(d, zero), s_hi, a_hi);
+  return _mm256_or_si256(_mm256_packus_epi16(lo, hi), _mm256_set1_epi32((int)0xff000000));
+}
+
+CPU_AVX2 static void blend_row_u8_avx2(u32 *dst, const u8 *alpha, u32 count, u32 color) {
+  __m256i c = _mm256_setr_epi16((short)(color & 0xff), (short)((color >> 8) & 0xff), (short)((color >> 16) & 0xff), 0,
+                                (short)(color & 0xff), (short)((color >> 8) & 0xff), (short)((color >> 16) & 0xff), 0,
+                                (short)(color & 0xff), (short)((color >> 8) & 0xff), (short)((color >> 16) & 0xff), 0,
+                                (short)(color & 0xff), (short)((color >> 8) & 0xff), (short)((color >> 16) & 0xff), 0);
+  u32 i = 0;
+  for(; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(alpha + i));
+    __m256i d0 = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i d1 = _mm256_loadu_si256((const __m256i *)(dst + i + 8));
+    _mm256_storeu_si256((__m256i *)(dst + i), blend_pixels_u8_avx2(d0, a, c));
+    _mm256_storeu_si256((__m256i *)(dst + i + 8), blend_pixels_u8_avx2(d1, _mm_srli_si128(a, 8), c));
+  }
+  blend_row_u8_scalar(dst + i, alpha + i, count - i, color);
+}
+
+CPU_AVX2 static void blend_row_u32_avx2(u32 *dst, const u32 *src, u32 count) {
+  u32 i = 0;
+  for(; i + 16 <= count; i += 16) {
+    __m256i s0 = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i s1 = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+    __m256i d0 = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i d1 = _mm256_loadu_si256((const __m256i *)(dst + i + 8));
+    _mm256_storeu_si256((__m256i *)(dst + i), blend_pixels_u32_avx2(d0, s0));
+    _mm256_storeu_si256((__m256i *)(dst + i + 8), blend_pixels_u32_avx2(d1, s1));
+  }
+  blend_row_u32_scalar(dst + i, src + i, count - i);
+}
+
+static const BlendKernels blend_kernels_avx2 = {
+  blend_row_u8_avx2,
+  blend_row_u32_avx2,
+};
+
+#endif // CPU_X86
+
+static BlendKernels g_blend = {
+  blend_row_u8_scalar,
+  blend_row_u32_scalar,
+};
+static CpuLevel g_blend_level = CPU_LEVEL_SCALAR;
+
+bool blend_set_level(CpuLevel level) {
+  if(!cpu_level_supported(level)) {
+    return false;
+  }
+
+  switch(level) {
+#if defined(CPU_X86)
+    case CPU_LEVEL_SSE2: {
+      g_blend = blend_kernels_sse2;
+    } break;
+    case CPU_LEVEL_AVX2: {
+      g_blend = blend_kernels_avx2;
+    } break;
+#endif
+    default: {
+      g_blend = blend_kernels_scalar;
+    } break;
+  }
+  g_blend_level = level;
+  return true;
+}
+
+CpuLevel blend_init(void) {
+  CpuLevel level = cpu_best_level();
+  blend_set_level(level);
+  return level;
+}
+
+CpuLevel blend_get_level(void) {
+  return g_blend_level;
+}
+
+void blend_row_u8(u32 *dst, const u8 *alpha, u32 count, u32 color) {
+  g_blend.row_u8(dst, alpha, count, color);
+}
+
+void blend_row_u32(u32 *dst, const u32 *src, u32 count) {
+  g_blend.row_u32(dst, src, count);
+}
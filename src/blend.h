@@ -0,0 +1,23 @@
+#ifndef _BLEND_H_
+#define _BLEND_H_
+
+#include "babl.h"
+#include "core/cpu.h"
+
+// NOTE: alpha blending kernels of the software renderer. Every pixel channel
+// becomes (dst * (255 - a) + src * a) >> 8 and the alpha of the result is
+// 0xff. The scalar kernels are used until blend_init picks the best level the
+// cpu supports, the simd ones give exactly the same pixels.
+
+CpuLevel blend_init(void);
+// NOTE: forces a level, used by the benchmarks. Returns false if the cpu does
+// not support it
+bool blend_set_level(CpuLevel level);
+CpuLevel blend_get_level(void);
+
+// NOTE: blends color with the coverage in alpha into count pixels of dst
+void blend_row_u8(u32 *dst, const u8 *alpha, u32 count, u32 color);
+// NOTE: blends count pixels of src over dst with the alpha of src
+void blend_row_u32(u32 *dst, const u32 *src, u32 count);
+
+#endif // _BLEND_H_
@@ -0,0 +1,73 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include "types.h"
+
+// NOTE: simd levels of the cpu, shared by the modules that pick their kernels
+// at runtime. Every level includes the ones before it, a module keeps a table
+// of kernels per level and switches between them with its set level function.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_X86 1
+#include <immintrin.h>
+// NOTE: the simd kernels are compiled for their target with function
+// attributes so the files build without -mavx2 and are picked at runtime
+#define CPU_SSE2 __attribute__((target("sse2")))
+#define CPU_AVX2 __attribute__((target("avx2,popcnt,bmi")))
+#endif
+
+typedef enum CpuLevel CpuLevel;
+enum CpuLevel {
+  CPU_LEVEL_SCALAR,
+  CPU_LEVEL_SSE2,
+  CPU_LEVEL_AVX2,
+
+  CPU_LEVEL_COUNT,
+};
+
+static inline bool cpu_level_supported(CpuLevel level) {
+  switch(level) {
+    case CPU_LEVEL_SCALAR: {
+      return true;
+    } break;
+#if defined(CPU_X86)
+    case CPU_LEVEL_SSE2: {
+      return true;
+    } break;
+    case CPU_LEVEL_AVX2: {
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") &&
+             __builtin_cpu_supports("bmi");
+    } break;
+#endif
+    default: {} break;
+  }
+  return false;
+}
+
+static inline CpuLevel cpu_best_level(void) {
+  for(s32 level = CPU_LEVEL_COUNT - 1; level > CPU_LEVEL_SCALAR; level--) {
+    if(cpu_level_supported((CpuLevel)level)) {
+      return (CpuLevel)level;
+    }
+  }
+  return CPU_LEVEL_SCALAR;
+}
+
+static inline char *cpu_level_name(CpuLevel level) {
+  switch(level) {
+    case CPU_LEVEL_SCALAR: {
+      return "scalar";
+    } break;
+    case CPU_LEVEL_SSE2: {
+      return "sse2";
+    } break;
+    case CPU_LEVEL_AVX2: {
+      return "avx2";
+    } break;
+    default: {} break;
+  }
+  return "unknown";
+}
+
+#endif // _CPU_H_
@@ -0,0 +1,530 @@
+#include "line_btree.h"
+#include "scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: nodes are filled to this size by line_btree_build so the first edits
+// do not split them right away
+#define LINE_BTREE_LEAF_FILL (LINE_BTREE_LEAF_CAPACITY * 3 / 4)
+#define LINE_BTREE_INNER_FILL (LINE_BTREE_INNER_CAPACITY * 3 / 4)
+
+static LineBTreeLeaf *line_btree_leaf_create(void) {
+  LineBTreeLeaf *leaf = (LineBTreeLeaf *)malloc(sizeof(*leaf));
+  assert(leaf);
+  leaf->count = 0;
+  return leaf;
+}
+
+static LineBTreeInner *line_btree_inner_create(void) {
+  LineBTreeInner *inner = (LineBTreeInner *)malloc(sizeof(*inner));
+  assert(inner);
+  inner->count = 0;
+  return inner;
+}
+
+static void line_btree_node_free(void *node, u32 level) {
+  if(level > 0) {
+    LineBTreeInner *inner = (LineBTreeInner *)node;
+    for(u32 i = 0; i < inner->count; i++) {
+      line_btree_node_free(inner->children[i], level - 1);
+    }
+  }
+  free(node);
+}
+
+static u32 line_btree_node_count(void *node, u32 level) {
+  if(level == 0) {
+    return ((LineBTreeLeaf *)node)->count;
+  }
+  return ((LineBTreeInner *)node)->count;
+}
+
+static void line_btree_node_totals(void *node, u32 level, u64 *bytes, u32 *lines) {
+  u64 b = 0;
+  u32 l = 0;
+  if(level == 0) {
+    LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+    for(u32 i = 0; i < leaf->count; i++) {
+      b += leaf->segments[i];
+    }
+    l = leaf->count;
+  } else {
+    LineBTreeInner *inner = (LineBTreeInner *)node;
+    for(u32 i = 0; i < inner->count; i++) {
+      b += inner->bytes[i];
+      l += inner->lines[i];
+    }
+  }
+  *bytes = b;
+  *lines = l;
+}
+
+static void line_btree_inner_insert_child(LineBTreeInner *inner, u32 index, void *child, u32 child_level) {
+  assert(inner->count < LINE_BTREE_INNER_CAPACITY);
+  u32 move = inner->count - index;
+  memmove(inner->lines + index + 1, inner->lines + index, move * sizeof(*inner->lines));
+  memmove(inner->bytes + index + 1, inner->bytes + index, move * sizeof(*inner->bytes));
+  memmove(inner->children + index + 1, inner->children + index, move * sizeof(*inner->children));
+  inner->children[index] = child;
+  line_btree_node_totals(child, child_level, &inner->bytes[index], &inner->lines[index]);
+  inner->count++;
+}
+
+static void line_btree_inner_remove_child(LineBTreeInner *inner, u32 index) {
+  u32 move = inner->count - (index + 1);
+  memmove(inner->lines + index, inner->lines + index + 1, move * sizeof(*inner->lines));
+  memmove(inner->bytes + index, inner->bytes + index + 1, move * sizeof(*inner->bytes));
+  memmove(inner->children + index, inner->children + index + 1, move * sizeof(*inner->children));
+  inner->count--;
+}
+
+// NOTE: moves the upper half of a full node into a new right sibling
+static void *line_btree_split(void *node, u32 level) {
+  if(level == 0) {
+    LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+    LineBTreeLeaf *right = line_btree_leaf_create();
+    u32 half = leaf->count / 2;
+    right->count = leaf->count - half;
+    memcpy(right->segments, leaf->segments + half, right->count * sizeof(*right->segments));
+    leaf->count = half;
+    return right;
+  }
+
+  LineBTreeInner *inner = (LineBTreeInner *)node;
+  LineBTreeInner *right = line_btree_inner_create();
+  u32 half = inner->count / 2;
+  right->count = inner->count - half;
+  memcpy(right->lines, inner->lines + half, right->count * sizeof(*right->lines));
+  memcpy(right->bytes, inner->bytes + half, right->count * sizeof(*right->bytes));
+  memcpy(right->children, inner->children + half, right->count * sizeof(*right->children));
+  inner->count = half;
+  return right;
+}
+
+static void line_btree_leaf_insert(LineBTreeLeaf *leaf, u64 byte_offset) {
+  assert(leaf->count < LINE_BTREE_LEAF_CAPACITY);
+  u64 base = 0;
+  u32 i = 0;
+  for(; i < leaf->count; i++) {
+    if(base + leaf->segments[i] >= byte_offset) {
+      break;
+    }
+    base += leaf->segments[i];
+  }
+
+  // NOTE: the new line splits the segment of the next new line in two
+  if(i < leaf->count) {
+    leaf->segments[i] = base + leaf->segments[i] + 1 - byte_offset;
+  }
+  memmove(leaf->segments + i + 1, leaf->segments + i, (leaf->count - i) * sizeof(*leaf->segments));
+  leaf->segments[i] = byte_offset - base;
+  leaf->count++;
+}
+
+// NOTE: returns the new right sibling when the node had to be split
+static void *line_btree_insert_node(void *node, u32 level, u64 byte_offset) {
+  if(level == 0) {
+    LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+    void *split = 0;
+    if(leaf->count == LINE_BTREE_LEAF_CAPACITY) {
+      split = line_btree_split(leaf, 0);
+      u64 left_bytes;
+      u32 left_lines;
+      line_btree_node_totals(leaf, 0, &left_bytes, &left_lines);
+      if(byte_offset > left_bytes) {
+        byte_offset -= left_bytes;
+        leaf = (LineBTreeLeaf *)split;
+      }
+    }
+    line_btree_leaf_insert(leaf, byte_offset);
+    return split;
+  }
+
+  LineBTreeInner *inner = (LineBTreeInner *)node;
+  u64 base = 0;
+  u32 i = 0;
+  for(; i + 1 < inner->count; i++) {
+    if(base + inner->bytes[i] >= byte_offset) {
+      break;
+    }
+    base += inner->bytes[i];
+  }
+
+  void *child_split = line_btree_insert_node(inner->children[i], level - 1, byte_offset - base);
+  line_btree_node_totals(inner->children[i], level - 1, &inner->bytes[i], &inner->lines[i]);
+  if(!child_split) {
+    return 0;
+  }
+
+  void *split = 0;
+  LineBTreeInner *target = inner;
+  if(inner->count == LINE_BTREE_INNER_CAPACITY) {
+    split = line_btree_split(inner, level);
+    if(i >= inner->count) {
+      i -= inner->count;
+      target = (LineBTreeInner *)split;
+    }
+  }
+  line_btree_inner_insert_child(target, i + 1, child_split, level - 1);
+  return split;
+}
+
+// NOTE: removes the new line at byte_offset and returns the length of its segment
+static bool line_btree_delete_node(void *node, u32 level, u64 byte_offset, u64 *segment) {
+  if(level == 0) {
+    LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+    u64 base = 0;
+    for(u32 i = 0; i < leaf->count; i++) {
+      u64 offset = base + leaf->segments[i];
+      if(offset == byte_offset) {
+        *segment = leaf->segments[i];
+        memmove(leaf->segments + i, leaf->segments + i + 1, (leaf->count - (i + 1)) * sizeof(*leaf->segments));
+        leaf->count--;
+        return true;
+      }
+      if(offset > byte_offset) {
+        break;
+      }
+      base = offset;
+    }
+    return false;
+  }
+
+  LineBTreeInner *inner = (LineBTreeInner *)node;
+  u64 base = 0;
+  for(u32 i = 0; i < inner->count; i++) {
+    if(base + inner->bytes[i] >= byte_offset) {
+      if(!line_btree_delete_node(inner->children[i], level - 1, byte_offset - base, segment)) {
+        return false;
+      }
+      // NOTE: nodes are not merged, empty ones are just removed
+      if(line_btree_node_count(inner->children[i], level - 1) == 0) {
+        line_btree_node_free(inner->children[i], level - 1);
+        line_btree_inner_remove_child(inner, i);
+      } else {
+        line_btree_node_totals(inner->children[i], level - 1, &inner->bytes[i], &inner->lines[i]);
+      }
+      return true;
+    }
+    base += inner->bytes[i];
+  }
+  return false;
+}
+
+// NOTE: adds delta to the segment of the first new line at or after byte_offset
+static void line_btree_adjust(LineBTree *tree, u64 byte_offset, s64 delta) {
+  void *node = tree->root;
+  u32 level = tree->height;
+  while(level > 0) {
+    LineBTreeInner *inner = (LineBTreeInner *)node;
+    u64 base = 0;
+    u32 i = 0;
+    for(; i < inner->count; i++) {
+      if(base + inner->bytes[i] >= byte_offset) {
+        break;
+      }
+      base += inner->bytes[i];
+    }
+    if(i == inner->count) {
+      return;
+    }
+    inner->bytes[i] += delta;
+    byte_offset -= base;
+    node = inner->children[i];
+    level--;
+  }
+
+  LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+  u64 base = 0;
+  for(u32 i = 0; i < leaf->count; i++) {
+    if(base + leaf->segments[i] >= byte_offset) {
+      leaf->segments[i] += delta;
+      return;
+    }
+    base += leaf->segments[i];
+  }
+}
+
+void line_btree_init(LineBTree *tree) {
+  tree->root = line_btree_leaf_create();
+  tree->height = 0;
+  tree->size = 0;
+}
+
+void line_btree_destroy(LineBTree *tree) {
+  if(tree->root) {
+    line_btree_node_free(tree->root, tree->height);
+  }
+  tree->root = 0;
+  tree->height = 0;
+  tree->size = 0;
+}
+
+// NOTE: builds the tree level by level from a sorted array of new line offsets,
+// bytes after the last new line are not known here, the tree size ends right
+// after it
+void line_btree_build(LineBTree *tree, const u64 *newline_offsets, u64 count) {
+  line_btree_destroy(tree);
+  line_btree_init(tree);
+  if(count == 0) {
+    return;
+  }
+
+  u64 node_count = (count + LINE_BTREE_LEAF_FILL - 1) / LINE_BTREE_LEAF_FILL;
+  void **nodes = (void **)malloc(node_count * sizeof(*nodes));
+  assert(nodes);
+
+  u64 prev = 0;
+  u64 k = 0;
+  for(u64 i = 0; i < node_count; i++) {
+    LineBTreeLeaf *leaf = i == 0 ? (LineBTreeLeaf *)tree->root : line_btree_leaf_create();
+    while(leaf->count < LINE_BTREE_LEAF_FILL && k < count) {
+      leaf->segments[leaf->count++] = newline_offsets[k] - prev;
+      prev = newline_offsets[k++];
+    }
+    nodes[i] = leaf;
+  }
+
+  u32 level = 0;
+  while(node_count > 1) {
+    u64 parent_count = (node_count + LINE_BTREE_INNER_FILL - 1) / LINE_BTREE_INNER_FILL;
+    for(u64 i = 0; i < parent_count; i++) {
+      LineBTreeInner *inner = line_btree_inner_create();
+      u64 first = i * LINE_BTREE_INNER_FILL;
+      u64 last = min(first + LINE_BTREE_INNER_FILL, node_count);
+      for(u64 j = first; j < last; j++) {
+        line_btree_inner_insert_child(inner, inner->count, nodes[j], level);
+      }
+      nodes[i] = inner;
+    }
+    node_count = parent_count;
+    level++;
+  }
+
+  tree->root = nodes[0];
+  tree->height = level;
+  tree->size = newline_offsets[count - 1] + 1;
+  free(nodes);
+}
+
+void line_btree_insert(LineBTree *tree, u64 byte_offset) {
+  tree->size += 1;
+  void *split = line_btree_insert_node(tree->root, tree->height, byte_offset);
+  if(split) {
+    LineBTreeInner *root = line_btree_inner_create();
+    line_btree_inner_insert_child(root, 0, tree->root, tree->height);
+    line_btree_inner_insert_child(root, 1, split, tree->height);
+    tree->root = root;
+    tree->height++;
+  }
+}
+
+// NOTE: this function can only be call using a byteoffset that actualy contains a new line
+bool line_btree_delete(LineBTree *tree, u64 byte_offset) {
+  u64 segment;
+  if(!line_btree_delete_node(tree->root, tree->height, byte_offset, &segment)) {
+    return false;
+  }
+  tree->size -= 1;
+
+  while(tree->height > 0) {
+    LineBTreeInner *root = (LineBTreeInner *)tree->root;
+    if(root->count > 1) {
+      break;
+    }
+    if(root->count == 1) {
+      tree->root = root->children[0];
+    } else {
+      tree->root = line_btree_leaf_create();
+      tree->height = 1;
+    }
+    free(root);
+    tree->height--;
+  }
+
+  // NOTE: the next line now also covers the segment of the deleted one, minus
+  // the new line byte itself
+  line_btree_adjust(tree, byte_offset + 1 - segment, (s64)segment - 1);
+  return true;
+}
+
+void line_btree_propagate_increment_at_byte(LineBTree *tree, u64 byte_offset, u64 value) {
+  tree->size += value;
+  line_btree_adjust(tree, byte_offset, (s64)value);
+}
+
+void line_btree_propagate_decrement_at_byte(LineBTree *tree, u64 byte_offset, u64 value) {
+  assert(tree->size >= value);
+  tree->size -= value;
+  line_btree_adjust(tree, byte_offset, -(s64)value);
+}
+
+// NOTE: finds the first new line at or after byte_offset
+static bool line_btree_next_newline(LineBTree *tree, u64 byte_offset, u64 *newline_offset) {
+  void *node = tree->root;
+  u32 level = tree->height;
+  u64 base = 0;
+  while(level > 0) {
+    LineBTreeInner *inner = (LineBTreeInner *)node;
+    u32 i = 0;
+    for(; i < inner->count; i++) {
+      if(base + inner->bytes[i] >= byte_offset) {
+        break;
+      }
+      base += inner->bytes[i];
+    }
+    if(i == inner->count) {
+      return false;
+    }
+    node = inner->children[i];
+    level--;
+  }
+
+  LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+  for(u32 i = 0; i < leaf->count; i++) {
+    base += leaf->segments[i];
+    if(base >= byte_offset) {
+      *newline_offset = base;
+      return true;
+    }
+  }
+  return false;
+}
+
+void line_btree_insert_range(LineBTree *tree, u64 byte_offset, const u8 *bytes, u64 size) {
+  u64 newlines = scan_count_byte(bytes, size, '\n');
+
+  // NOTE: an empty tree, like when a file is loaded, is built in one go
+  if(tree->height == 0 && ((LineBTreeLeaf *)tree->root)->count == 0 && newlines > 0) {
+    u64 size_after_insert = tree->size + size;
+    u64 *newline_offsets = (u64 *)malloc(newlines * sizeof(*newline_offsets));
+    assert(newline_offsets);
+    u64 count = scan_collect_byte(bytes, size, '\n', byte_offset, newline_offsets);
+    line_btree_build(tree, newline_offsets, count);
+    tree->size = size_after_insert;
+    free(newline_offsets);
+    return;
+  }
+
+  if(size > newlines) {
+    line_btree_propagate_increment_at_byte(tree, byte_offset, size - newlines);
+  }
+
+  const u8 *scan = bytes;
+  const u8 *end = bytes + size;
+  while((scan = (const u8 *)memchr(scan, '\n', end - scan)) != 0) {
+    line_btree_insert(tree, byte_offset + (scan - bytes));
+    scan++;
+  }
+}
+
+void line_btree_delete_range(LineBTree *tree, u64 byte_offset, u64 count) {
+  u64 newline_offset;
+  while(count > 0 && line_btree_next_newline(tree, byte_offset, &newline_offset) &&
+        newline_offset < byte_offset + count) {
+    line_btree_delete(tree, newline_offset);
+    count--;
+  }
+
+  if(count > 0) {
+    line_btree_propagate_decrement_at_byte(tree, byte_offset, count);
+  }
+}
+
+// NOTE: finds the byte offset of the new line that ends the given line
+static bool line_btree_select(LineBTree *tree, u32 line, u64 *newline_offset) {
+  void *node = tree->root;
+  u32 level = tree->height;
+  u64 base = 0;
+  while(level > 0) {
+    LineBTreeInner *inner = (LineBTreeInner *)node;
+    u32 i = 0;
+    for(; i < inner->count; i++) {
+      if(line < inner->lines[i]) {
+        break;
+      }
+      line -= inner->lines[i];
+      base += inner->bytes[i];
+    }
+    if(i == inner->count) {
+      return false;
+    }
+    node = inner->children[i];
+    level--;
+  }
+
+  LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+  if(line >= leaf->count) {
+    return false;
+  }
+  for(u32 i = 0; i <= line; i++) {
+    base += leaf->segments[i];
+  }
+  *newline_offset = base;
+  return true;
+}
+
+bool line_btree_find_line(LineBTree *tree, u32 line, u64 *byte_offset, u64 *line_len) {
+  u64 start = 0;
+  if(line > 0) {
+    if(!line_btree_select(tree, line - 1, &start)) {
+      return false;
+    }
+    start++;
+  }
+
+  u64 end;
+  if(!line_btree_select(tree, line, &end)) {
+    end = tree->size;
+  }
+
+  *byte_offset = start;
+  *line_len = end - start;
+  return true;
+}
+
+bool line_btree_find_byte(LineBTree *tree, u64 byte_offset, u32 *line, u64 *col) {
+  if(byte_offset > tree->size) {
+    return false;
+  }
+
+  u32 lines = 0;
+  u64 start = 0;
+  u64 base = 0;
+  void *node = tree->root;
+  u32 level = tree->height;
+  while(level > 0) {
+    LineBTreeInner *inner = (LineBTreeInner *)node;
+    u32 i = 0;
+    for(; i < inner->count; i++) {
+      if(base + inner->bytes[i] >= byte_offset) {
+        break;
+      }
+      base += inner->bytes[i];
+      lines += inner->lines[i];
+      start = base + 1;
+    }
+    if(i == inner->count) {
+      break;
+    }
+    node = inner->children[i];
+    level--;
+  }
+
+  if(level == 0) {
+    LineBTreeLeaf *leaf = (LineBTreeLeaf *)node;
+    for(u32 i = 0; i < leaf->count; i++) {
+      if(base + leaf->segments[i] >= byte_offset) {
+        break;
+      }
+      base += leaf->segments[i];
+      lines++;
+      start = base + 1;
+    }
+  }
+
+  *line = lines;
+  *col = byte_offset - start;
+  return true;
+}
@@ -0,0 +1,55 @@
+#ifndef _LINE_BTREE_H_
+#define _LINE_BTREE_H_
+
+#include "types.h"
+
+// NOTE: B+tree alternative to the red-black LineTree with the same api. Leaves
+// store the length of each line segment (the bytes between a new line and the
+// previous one) and inner nodes store the bytes and new lines of every child,
+// so a lookup touches one wide node per level instead of one node per bit.
+
+#define LINE_BTREE_LEAF_CAPACITY 64
+#define LINE_BTREE_INNER_CAPACITY 32
+
+typedef struct LineBTreeLeaf LineBTreeLeaf;
+struct LineBTreeLeaf {
+  u32 count;
+  u64 segments[LINE_BTREE_LEAF_CAPACITY];
+};
+
+typedef struct LineBTreeInner LineBTreeInner;
+struct LineBTreeInner {
+  u32 count;
+  u32 lines[LINE_BTREE_INNER_CAPACITY];
+  u64 bytes[LINE_BTREE_INNER_CAPACITY];
+  void *children[LINE_BTREE_INNER_CAPACITY];
+};
+
+typedef struct LineBTree LineBTree;
+struct LineBTree {
+  // NOTE: the root is a leaf when height is 0
+  void *root;
+  u32 height;
+
+  // NOTE: total bytes tracked by the tree, including the last line
+  u64 size;
+};
+
+void line_btree_init(LineBTree *tree);
+void line_btree_destroy(LineBTree *tree);
+
+void line_btree_build(LineBTree *tree, const u64 *newline_offsets, u64 count);
+
+void line_btree_insert(LineBTree *tree, u64 byte_offset);
+bool line_btree_delete(LineBTree *tree, u64 byte_offset);
+
+void line_btree_propagate_increment_at_byte(LineBTree *tree, u64 byte_offset, u64 value);
+void line_btree_propagate_decrement_at_byte(LineBTree *tree, u64 byte_offset, u64 value);
+
+void line_btree_insert_range(LineBTree *tree, u64 byte_offset, const u8 *bytes, u64 size);
+void line_btree_delete_range(LineBTree *tree, u64 byte_offset, u64 count);
+
+bool line_btree_find_line(LineBTree *tree, u32 line, u64 *byte_offset, u64 *line_len);
+bool line_btree_find_byte(LineBTree *tree, u64 byte_offset, u32 *line, u64 *col);
+
+#endif // _LINE_BTREE_H_
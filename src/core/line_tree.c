@@ -1,194 +1,456 @@
 #include "line_tree.h"
+#include "scan.h"
 #include "../render.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void line_tree_propagate_increment(LineTree *tree, LineNode *node, u64 bytes, u32 lines) {
-  while(node->p != tree->nil) {
-    if(node == node->p->l) {
-      node->p->byte_offset += bytes;
-      node->p->total_lines += lines;
-    }
-    node = node->p;
-  } 
+#define NODE(index) line_tree_node(tree, (index))
+
+#if defined(LINE_TREE_METRICS)
+#define METRICS(index) line_tree_metrics(tree, (index))
+#define ROWS(index) line_tree_rows(tree, (index))
+
+static void line_tree_metrics_pull(LineTree *tree, u32 node) {
+  LineNode *n = NODE(node);
+  if(tree->metrics) {
+    LineMetrics *m = METRICS(node);
+    LineMetrics *l = METRICS(n->l);
+    LineMetrics *r = METRICS(n->r);
+    m->codepoint_size = l->codepoint_size + m->codepoints + 1 + r->codepoint_size;
+    m->max_width = max(m->width, max(l->max_width, r->max_width));
+  }
+  if(tree->rows) {
+    ROWS(node)->extra_count = ROWS(n->l)->extra_count + ROWS(node)->extra + ROWS(n->r)->extra_count;
+  }
 }
 
-static void line_tree_propagate_decrement(LineTree *tree, LineNode *node, u64 bytes, u32 lines) {
-  while(node->p != tree->nil) {
-    if(node == node->p->l) {
-      node->p->byte_offset -= bytes;
-      node->p->total_lines -= lines;
+// NOTE: a line of width w takes ceil(w / wrap_columns) rows and never less
+// than one, the glyph at column c goes in row c / wrap_columns
+static u32 line_tree_wrap_rows(LineTree *tree, u32 width) {
+  if(tree->wrap_columns == 0 || width == 0) {
+    return 1;
+  }
+  return (width - 1) / tree->wrap_columns + 1;
+}
+
+// NOTE: recomputes the subtree metrics from node up to the root
+static void line_tree_metrics_update(LineTree *tree, u32 node) {
+  if(!tree->metrics && !tree->rows) {
+    return;
+  }
+  while(node != LINE_TREE_NIL) {
+    line_tree_metrics_pull(tree, node);
+    node = NODE(node)->p;
+  }
+}
+
+// NOTE: the new line splits a line, the owner of the text measures both
+static void line_tree_metrics_init(LineTree *tree, u32 node) {
+  if(tree->metrics) {
+    LineMetrics *m = METRICS(node);
+    m->codepoints = 0;
+    m->width = 0;
+  }
+  if(tree->rows) {
+    LineRows *r = ROWS(node);
+    r->extra = 0;
+    r->wrap_epoch = 0;
+  }
+  line_tree_metrics_pull(tree, node);
+}
+
+// NOTE: all of them do nothing until the metrics are enabled
+#define METRICS_INIT(node) line_tree_metrics_init(tree, (node))
+#define METRICS_PULL(node) line_tree_metrics_pull(tree, (node))
+#define METRICS_UPDATE(node) line_tree_metrics_update(tree, (node))
+#else
+#define METRICS_INIT(node)
+#define METRICS_PULL(node)
+#define METRICS_UPDATE(node)
+#endif
+
+static void line_tree_propagate_increment(LineTree *tree, u32 node, u64 bytes, u32 lines) {
+  while(NODE(node)->p != LINE_TREE_NIL) {
+    LineNode *parent = NODE(NODE(node)->p);
+    if(node == parent->l) {
+      parent->byte_offset += bytes;
+      parent->total_lines += lines;
     }
-    node = node->p;
+    node = NODE(node)->p;
   } 
 }
 
-static LineNode *line_tree_minimun(LineTree *tree, LineNode *x) {
-  while(x->l != tree->nil) {
-    x = x->l;
+static void line_tree_propagate_decrement(LineTree *tree, u32 node, u64 bytes, u32 lines) {
+  while(NODE(node)->p != LINE_TREE_NIL) {
+    LineNode *parent = NODE(NODE(node)->p);
+    if(node == parent->l) {
+      parent->byte_offset -= bytes;
+      parent->total_lines -= lines;
+    }
+    node = NODE(node)->p;
   } 
-  return x;
 }
 
-static LineNode *line_tree_maximum(LineTree *tree, LineNode *x) {
-  while(x->r != tree->nil) {
-    x = x->r;
+static u32 line_tree_minimun(LineTree *tree, u32 x) {
+  while(NODE(x)->l != LINE_TREE_NIL) {
+    x = NODE(x)->l;
   } 
   return x;
 }
 
-static LineNode *line_tree_successor(LineTree *tree, LineNode *x) {
-  if(x->r != tree->nil) {
-    return line_tree_minimun(tree, x->r);
+#if defined(LINE_TREE_METRICS)
+static u32 line_tree_successor(LineTree *tree, u32 x) {
+  if(NODE(x)->r != LINE_TREE_NIL) {
+    return line_tree_minimun(tree, NODE(x)->r);
   } 
-  LineNode *y = x->p;
-  while(y != tree->nil && x == y->r) {
+  u32 y = NODE(x)->p;
+  while(y != LINE_TREE_NIL && x == NODE(y)->r) {
     x = y;
-    y = y->p;
+    y = NODE(y)->p;
   }
   return y;
 }
+#endif
 
-static void line_tree_transplant(LineTree *tree, LineNode *u, LineNode *v) {
-  if(u->p == tree->nil) {
+static void line_tree_transplant(LineTree *tree, u32 u, u32 v) {
+  u32 up = NODE(u)->p;
+  if(up == LINE_TREE_NIL) {
     tree->root = v;
-  } else if(u == u->p->l) {
-    u->p->l = v;
+  } else if(u == NODE(up)->l) {
+    NODE(up)->l = v;
   } else {
-    u->p->r = v;
+    NODE(up)->r = v;
   }
-  v->p = u->p;
+  NODE(v)->p = up;
 }
 
-static void line_tree_left_rotate(LineTree *tree, LineNode *x) {
-  LineNode *y = x->r;
+static void line_tree_left_rotate(LineTree *tree, u32 x) {
+  LineNode *xn = NODE(x);
+  u32 y = xn->r;
+  LineNode *yn = NODE(y);
   
-  x->r = y->l;
-  if(y->l != tree->nil) {
-    y->l->p = x;
+  xn->r = yn->l;
+  if(yn->l != LINE_TREE_NIL) {
+    NODE(yn->l)->p = x;
   }
   
-  y->p = x->p;
+  yn->p = xn->p;
   
-  if(x->p == tree->nil) {
+  if(xn->p == LINE_TREE_NIL) {
     tree->root = y;
-  } else if(x == x->p->l) {
-    x->p->l = y;
+  } else if(x == NODE(xn->p)->l) {
+    NODE(xn->p)->l = y;
   } else {
-    x->p->r = y;
+    NODE(xn->p)->r = y;
   }
 
-  y->l = x;
-  x->p = y;
+  yn->l = x;
+  xn->p = y;
 
-  y->byte_offset += x->byte_offset;
-  y->total_lines += x->total_lines;
+  yn->byte_offset += xn->byte_offset;
+  yn->total_lines += xn->total_lines;
+
+  METRICS_PULL(x);
+  METRICS_PULL(y);
 }
 
-static void line_tree_right_rotate(LineTree *tree, LineNode *x) {
-  LineNode *y = x->l;
+static void line_tree_right_rotate(LineTree *tree, u32 x) {
+  LineNode *xn = NODE(x);
+  u32 y = xn->l;
+  LineNode *yn = NODE(y);
 
-  x->l = y->r;
-  if(y->r != tree->nil) {
-    y->r->p = x;
+  xn->l = yn->r;
+  if(yn->r != LINE_TREE_NIL) {
+    NODE(yn->r)->p = x;
   }
   
-  y->p = x->p;
+  yn->p = xn->p;
 
-  if(x->p == tree->nil) {
+  if(xn->p == LINE_TREE_NIL) {
     tree->root = y;
-  } else if(x == x->p->r) {
-    x->p->r = y;
+  } else if(x == NODE(xn->p)->r) {
+    NODE(xn->p)->r = y;
   } else {
-    x->p->l = y;
+    NODE(xn->p)->l = y;
   }
 
-  y->r = x;
-  x->p = y;
+  yn->r = x;
+  xn->p = y;
+
+  assert(xn->byte_offset > yn->byte_offset);
+  assert(xn->total_lines > yn->total_lines);
+  xn->byte_offset -= yn->byte_offset;
+  xn->total_lines -= yn->total_lines;
 
-  assert(x->byte_offset > y->byte_offset);
-  assert(x->total_lines > y->total_lines);
-  x->byte_offset -= y->byte_offset;
-  x->total_lines -= y->total_lines;
+  METRICS_PULL(x);
+  METRICS_PULL(y);
+}
+
+static void line_tree_pool_reset(LineTree *tree) {
+  // NOTE: slot 0 of the first chunk is the nil sentinel
+  LineNode *nil = NODE(LINE_TREE_NIL);
+  memset(nil, 0, sizeof(*nil));
+  nil->color = LINE_NODE_BLACK;
+
+  tree->node_count = 1;
+  tree->free_list = LINE_TREE_NIL;
+  tree->root = LINE_TREE_NIL;
+  tree->size = 0;
+#if defined(LINE_TREE_METRICS)
+  if(tree->metrics) {
+    memset(METRICS(LINE_TREE_NIL), 0, sizeof(LineMetrics));
+  }
+  if(tree->rows) {
+    memset(ROWS(LINE_TREE_NIL), 0, sizeof(LineRows));
+  }
+  tree->last_codepoints = 0;
+  tree->last_width = 0;
+  tree->last_rows = 1;
+  tree->last_wrap_epoch = 0;
+#endif
+}
+
+static void line_tree_pool_reserve(LineTree *tree, u64 count) {
+  while((u64)tree->chunk_count * LINE_TREE_CHUNK_SIZE < count) {
+    if(tree->chunk_count == tree->chunk_capacity) {
+      tree->chunk_capacity = tree->chunk_capacity ? tree->chunk_capacity * 2 : 16;
+      tree->chunks = (LineNode **)realloc(tree->chunks, tree->chunk_capacity * sizeof(*tree->chunks));
+      assert(tree->chunks);
+#if defined(LINE_TREE_METRICS)
+      if(tree->metrics) {
+        tree->metrics = (LineMetrics **)realloc(tree->metrics, tree->chunk_capacity * sizeof(*tree->metrics));
+        assert(tree->metrics);
+      }
+      if(tree->rows) {
+        tree->rows = (LineRows **)realloc(tree->rows, tree->chunk_capacity * sizeof(*tree->rows));
+        assert(tree->rows);
+      }
+#endif
+    }
+    LineNode *chunk = (LineNode *)malloc(LINE_TREE_CHUNK_SIZE * sizeof(*chunk));
+    assert(chunk);
+#if defined(LINE_TREE_METRICS)
+    if(tree->metrics) {
+      tree->metrics[tree->chunk_count] = (LineMetrics *)malloc(LINE_TREE_CHUNK_SIZE * sizeof(LineMetrics));
+      assert(tree->metrics[tree->chunk_count]);
+    }
+    if(tree->rows) {
+      tree->rows[tree->chunk_count] = (LineRows *)calloc(LINE_TREE_CHUNK_SIZE, sizeof(LineRows));
+      assert(tree->rows[tree->chunk_count]);
+    }
+#endif
+    tree->chunks[tree->chunk_count++] = chunk;
+  }
+}
+
+// NOTE: a freed node keeps its children and is linked through its parent
+// index, the children are freed when the node is reused. Dropping a whole
+// subtree is then a single push
+static void line_tree_subtree_free(LineTree *tree, u32 node) {
+  if(node != LINE_TREE_NIL) {
+    NODE(node)->p = tree->free_list;
+    tree->free_list = node;
+  }
+}
+
+static u32 line_tree_node_alloc(LineTree *tree) {
+  if(tree->free_list != LINE_TREE_NIL) {
+    u32 node = tree->free_list;
+    LineNode *n = NODE(node);
+    tree->free_list = n->p;
+    line_tree_subtree_free(tree, n->l);
+    line_tree_subtree_free(tree, n->r);
+    return node;
+  }
+  assert(tree->node_count < (1u << 31));
+  line_tree_pool_reserve(tree, (u64)tree->node_count + 1);
+  return tree->node_count++;
+}
+
+static void line_tree_node_free(LineTree *tree, u32 node) {
+  NODE(node)->l = LINE_TREE_NIL;
+  NODE(node)->r = LINE_TREE_NIL;
+  line_tree_subtree_free(tree, node);
 }
 
 void line_tree_init(LineTree *tree) {
-  memset(&tree->nil_node, 0, sizeof(tree->nil_node));
-  tree->nil_node.color = LINE_NODE_BLACK;
-  
-  tree->nil = &tree->nil_node;
-  tree->nil->l = tree->nil;
-  tree->nil->r = tree->nil;
-  tree->nil->p = tree->nil;
+  tree->chunks = 0;
+  tree->chunk_count = 0;
+  tree->chunk_capacity = 0;
+#if defined(LINE_TREE_METRICS)
+  tree->metrics = 0;
+  tree->rows = 0;
+  tree->wrap_columns = 0;
+  tree->wrap_epoch = 0;
+#endif
+  line_tree_pool_reserve(tree, 1);
+  line_tree_pool_reset(tree);
+}
+
+void line_tree_destroy(LineTree *tree) {
+  for(u32 i = 0; i < tree->chunk_count; i++) {
+    free(tree->chunks[i]);
+  }
+  free(tree->chunks);
+#if defined(LINE_TREE_METRICS)
+  if(tree->metrics) {
+    for(u32 i = 0; i < tree->chunk_count; i++) {
+      free(tree->metrics[i]);
+    }
+    free(tree->metrics);
+    tree->metrics = 0;
+  }
+  if(tree->rows) {
+    for(u32 i = 0; i < tree->chunk_count; i++) {
+      free(tree->rows[i]);
+    }
+    free(tree->rows);
+    tree->rows = 0;
+  }
+#endif
+  tree->chunks = 0;
+  tree->chunk_count = 0;
+  tree->chunk_capacity = 0;
+}
+
+static u32 line_tree_build_node(LineTree *tree, const u64 *newline_offsets,
+                                s64 lo, s64 hi, u64 base, u32 depth, u32 red_depth) {
+  if(lo > hi) {
+    return LINE_TREE_NIL;
+  }
+
+  // NOTE: the left subtree is allocated first so nodes take the slots in order
+  s64 mid = lo + (hi - lo) / 2;
+  u32 l = line_tree_build_node(tree, newline_offsets, lo, mid - 1, base, depth + 1, red_depth);
+  u32 node = line_tree_node_alloc(tree);
+  u32 r = line_tree_build_node(tree, newline_offsets, mid + 1, hi, newline_offsets[mid], depth + 1, red_depth);
+
+  LineNode *n = NODE(node);
+  n->byte_offset = newline_offsets[mid] - base;
+  n->total_lines = (u32)(mid - lo + 1);
+  n->color = (depth == red_depth) ? LINE_NODE_RED : LINE_NODE_BLACK;
+  n->l = l;
+  n->r = r;
+  if(l != LINE_TREE_NIL) {
+    NODE(l)->p = node;
+  }
+  if(r != LINE_TREE_NIL) {
+    NODE(r)->p = node;
+  }
+  METRICS_INIT(node);
+
+  return node;
+}
+
+// NOTE: builds a perfectly balanced subtree from a sorted array of new line
+// offsets. Every level but the last one is full, so coloring the last level
+// red (when it is not the root) and the rest black gives a valid red-black
+// tree. The subtree is not linked anywhere, its offsets are relative to 0
+static u32 line_tree_build_subtree(LineTree *tree, const u64 *newline_offsets, u64 count) {
+  if(count == 0) {
+    return LINE_TREE_NIL;
+  }
+  assert(count < (1u << 31));
+
+  u32 last_depth = 0;
+  while(((u64)2 << last_depth) <= count) {
+    last_depth++;
+  }
+  u32 red_depth = last_depth > 0 ? last_depth : (u32)-1;
+
+  u32 root = line_tree_build_node(tree, newline_offsets, 0, (s64)count - 1, 0, 0, red_depth);
+  NODE(root)->p = LINE_TREE_NIL;
+  return root;
+}
+
+// NOTE: replaces the content of the tree with a subtree built from a sorted
+// array of new line offsets, nodes take the pool slots in order. Bytes after
+// the last new line are not known here, the tree size ends right after it.
+void line_tree_build(LineTree *tree, const u64 *newline_offsets, u64 count) {
+  line_tree_pool_reset(tree);
+  if(count == 0) {
+    return;
+  }
 
-  tree->root = tree->nil;
+  line_tree_pool_reserve(tree, count + 1);
+  tree->root = line_tree_build_subtree(tree, newline_offsets, count);
+  tree->size = newline_offsets[count - 1] + 1;
 }
 
-void line_tree_insert_fixup(LineTree *tree, LineNode *z) {
+void line_tree_insert_fixup(LineTree *tree, u32 z) {
   
-  while(z->p->color == LINE_NODE_RED) {
-    if (z->p == z->p->p->l) {
-      LineNode *y = z->p->p->r;
-      if(y->color == LINE_NODE_RED) {
-        z->p->color = LINE_NODE_BLACK;
-        y->color = LINE_NODE_BLACK;
-        z->p->p->color = LINE_NODE_RED;
-        z = z->p->p;
+  while(NODE(NODE(z)->p)->color == LINE_NODE_RED) {
+    u32 zp = NODE(z)->p;
+    u32 zpp = NODE(zp)->p;
+    if (zp == NODE(zpp)->l) {
+      u32 y = NODE(zpp)->r;
+      if(NODE(y)->color == LINE_NODE_RED) {
+        NODE(zp)->color = LINE_NODE_BLACK;
+        NODE(y)->color = LINE_NODE_BLACK;
+        NODE(zpp)->color = LINE_NODE_RED;
+        z = zpp;
       } else { 
-        if(z == z->p->r) {
-          z = z->p;
+        if(z == NODE(zp)->r) {
+          z = zp;
           line_tree_left_rotate(tree, z);
         }
-        z->p->color = LINE_NODE_BLACK;
-        z->p->p->color = LINE_NODE_RED;
-        line_tree_right_rotate(tree, z->p->p);
+        zp = NODE(z)->p;
+        zpp = NODE(zp)->p;
+        NODE(zp)->color = LINE_NODE_BLACK;
+        NODE(zpp)->color = LINE_NODE_RED;
+        line_tree_right_rotate(tree, zpp);
       }
     } else {
-      LineNode *y = z->p->p->l;
-      if(y->color == LINE_NODE_RED) {
-        z->p->color = LINE_NODE_BLACK;
-        y->color = LINE_NODE_BLACK;
-        z->p->p->color = LINE_NODE_RED;
-        z = z->p->p;
+      u32 y = NODE(zpp)->l;
+      if(NODE(y)->color == LINE_NODE_RED) {
+        NODE(zp)->color = LINE_NODE_BLACK;
+        NODE(y)->color = LINE_NODE_BLACK;
+        NODE(zpp)->color = LINE_NODE_RED;
+        z = zpp;
       } else {
-        if(z == z->p->l) {
-          z = z->p;
+        if(z == NODE(zp)->l) {
+          z = zp;
           line_tree_right_rotate(tree, z);
         }
-        z->p->color = LINE_NODE_BLACK;
-        z->p->p->color = LINE_NODE_RED;
-        line_tree_left_rotate(tree, z->p->p);
+        zp = NODE(z)->p;
+        zpp = NODE(zp)->p;
+        NODE(zp)->color = LINE_NODE_BLACK;
+        NODE(zpp)->color = LINE_NODE_RED;
+        line_tree_left_rotate(tree, zpp);
       }
     }
   }
 
-  tree->root->color = LINE_NODE_BLACK;
+  NODE(tree->root)->color = LINE_NODE_BLACK;
 
 }
 
 void line_tree_insert(LineTree *tree, u64 byte_offset) {
   
-  LineNode *node = (LineNode *)malloc(sizeof(*node));
+  u32 z = line_tree_node_alloc(tree);
+  LineNode *node = NODE(z);
+  tree->size += 1;
 
-  u32 last_byte_offset = 0;
-  LineNode *parent = tree->nil;
-  LineNode *current = tree->root;
+  u64 last_byte_offset = 0;
+  u32 parent = LINE_TREE_NIL;
+  u32 current = tree->root;
 
-  while(current != tree->nil) {
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
     
     parent = current;
     last_byte_offset = byte_offset;
     
-    if(byte_offset > current->byte_offset) {
-      byte_offset -= current->byte_offset;
-      current = current->r;
+    if(byte_offset > c->byte_offset) {
+      byte_offset -= c->byte_offset;
+      current = c->r;
     } else {
-      current->total_lines += 1;
+      c->total_lines += 1;
       // TODO: on windows newlines are probably 2 bytes long
-      current->byte_offset += 1;
-      current = current->l;
+      c->byte_offset += 1;
+      current = c->l;
     }
   }
   
@@ -196,193 +458,214 @@ void line_tree_insert(LineTree *tree, u64 byte_offset) {
   node->byte_offset = byte_offset;
   node->total_lines = 1;
 
-  if(parent == tree->nil) {
-    tree->root = node;
+  if(parent == LINE_TREE_NIL) {
+    tree->root = z;
   } else { 
-    if (last_byte_offset > parent->byte_offset) {
-      parent->r = node;
+    if (last_byte_offset > NODE(parent)->byte_offset) {
+      NODE(parent)->r = z;
     } else  {
-      parent->l = node;
+      NODE(parent)->l = z;
     }
   }
 
-  node->l = tree->nil;
-  node->r = tree->nil;
+  node->l = LINE_TREE_NIL;
+  node->r = LINE_TREE_NIL;
   node->color = LINE_NODE_RED;
 
-  line_tree_insert_fixup(tree, node);
+  METRICS_INIT(z);
+  METRICS_UPDATE(z);
+
+  line_tree_insert_fixup(tree, z);
 }
 
 
-void line_tree_delete_fixup(LineTree *tree, LineNode *x) {
-  while(x != tree->root && x->color == LINE_NODE_BLACK) {
-    if(x == x->p->l) {
+void line_tree_delete_fixup(LineTree *tree, u32 x) {
+  while(x != tree->root && NODE(x)->color == LINE_NODE_BLACK) {
+    u32 xp = NODE(x)->p;
+    if(x == NODE(xp)->l) {
       
-      LineNode *w = x->p->r;
+      u32 w = NODE(xp)->r;
       
-      if(w->color == LINE_NODE_RED) {
-        w->color = LINE_NODE_BLACK;
-        x->p->color = LINE_NODE_RED;
-        line_tree_left_rotate(tree, x->p);
-        w = x->p->r;
+      if(NODE(w)->color == LINE_NODE_RED) {
+        NODE(w)->color = LINE_NODE_BLACK;
+        NODE(xp)->color = LINE_NODE_RED;
+        line_tree_left_rotate(tree, xp);
+        w = NODE(xp)->r;
       }
       
-      if(w->l->color == LINE_NODE_BLACK && w->r->color == LINE_NODE_BLACK) {
-        w->color = LINE_NODE_RED;
-        x = x->p;
+      if(NODE(NODE(w)->l)->color == LINE_NODE_BLACK && NODE(NODE(w)->r)->color == LINE_NODE_BLACK) {
+        NODE(w)->color = LINE_NODE_RED;
+        x = xp;
       } else {
         
-        if(w->r->color == LINE_NODE_BLACK) {
-          w->l->color = LINE_NODE_BLACK;
-          w->color = LINE_NODE_RED;
+        if(NODE(NODE(w)->r)->color == LINE_NODE_BLACK) {
+          NODE(NODE(w)->l)->color = LINE_NODE_BLACK;
+          NODE(w)->color = LINE_NODE_RED;
           line_tree_right_rotate(tree, w);
+          w = NODE(xp)->r;
         }
         
-        w->color = x->p->color;
-        x->p->color = LINE_NODE_BLACK;
-        w->r->color = LINE_NODE_BLACK;
-        line_tree_left_rotate(tree, x->p);
+        NODE(w)->color = NODE(xp)->color;
+        NODE(xp)->color = LINE_NODE_BLACK;
+        NODE(NODE(w)->r)->color = LINE_NODE_BLACK;
+        line_tree_left_rotate(tree, xp);
         x = tree->root;
       }
 
     } else {
 
-      LineNode *w = x->p->l;
+      u32 w = NODE(xp)->l;
       
-      if(w->color == LINE_NODE_RED) {
-        w->color = LINE_NODE_BLACK;
-        x->p->color = LINE_NODE_RED;
-        line_tree_right_rotate(tree, x->p);
-        w = x->p->l;
+      if(NODE(w)->color == LINE_NODE_RED) {
+        NODE(w)->color = LINE_NODE_BLACK;
+        NODE(xp)->color = LINE_NODE_RED;
+        line_tree_right_rotate(tree, xp);
+        w = NODE(xp)->l;
       }
       
-      if(w->r->color == LINE_NODE_BLACK && w->l->color == LINE_NODE_BLACK) {
-        w->color = LINE_NODE_RED;
-        x = x->p;
+      if(NODE(NODE(w)->r)->color == LINE_NODE_BLACK && NODE(NODE(w)->l)->color == LINE_NODE_BLACK) {
+        NODE(w)->color = LINE_NODE_RED;
+        x = xp;
       } else {
-        if(w->l->color == LINE_NODE_BLACK) {
-          w->r->color = LINE_NODE_BLACK;
-          w->color = LINE_NODE_RED;
+        if(NODE(NODE(w)->l)->color == LINE_NODE_BLACK) {
+          NODE(NODE(w)->r)->color = LINE_NODE_BLACK;
+          NODE(w)->color = LINE_NODE_RED;
           line_tree_left_rotate(tree, w);
+          w = NODE(xp)->l;
         }
         
-        w->color = x->p->color;
-        x->p->color = LINE_NODE_BLACK;
-        w->l->color = LINE_NODE_BLACK;
-        line_tree_right_rotate(tree, x->p);
+        NODE(w)->color = NODE(xp)->color;
+        NODE(xp)->color = LINE_NODE_BLACK;
+        NODE(NODE(w)->l)->color = LINE_NODE_BLACK;
+        line_tree_right_rotate(tree, xp);
         x = tree->root;
       }
     }
   }
 
-  x->color = LINE_NODE_BLACK;
+  NODE(x)->color = LINE_NODE_BLACK;
 }
 
 // NOTE: this function can only be call using a byteoffset that actualy contains a new line
 bool line_tree_delete(LineTree *tree, u64 byte_offset) {
   
-  u64 saved_byte_offset = byte_offset;
-
   // NOTE: since we are going to delete a node we update all parents nodes
-  LineNode *current = tree->root;
-  while(current != tree->nil && byte_offset != current->byte_offset) {
-    if(byte_offset > current->byte_offset) {
-      byte_offset -= current->byte_offset;
-      current = current->r;
+  u32 current = tree->root;
+  while(current != LINE_TREE_NIL && byte_offset != NODE(current)->byte_offset) {
+    LineNode *c = NODE(current);
+    if(byte_offset > c->byte_offset) {
+      byte_offset -= c->byte_offset;
+      current = c->r;
     } else {
-      assert(current->total_lines > 0);
-      assert(current->byte_offset > 0);
-      current->total_lines -= 1;
+      assert(c->total_lines > 0);
+      assert(c->byte_offset > 0);
+      c->total_lines -= 1;
       // TODO: on windows newlines are probably 2 bytes long
-      current->byte_offset -= 1;
-      current = current->l;
-    }
-  }
-
-  assert(current != tree->nil);
-
-  LineNode *z = current;
-  LineNode *y = z;
-  LineNode *x = tree->nil;
-  LineNodeColor y_original_color = y->color;
-  if(z->l == tree->nil) {
-    x = z->r;
-    line_tree_transplant(tree, z, z->r);
-    if(z->r != tree->nil) {
-      z->r->byte_offset += z->byte_offset;
-      assert(z->r->byte_offset > 0);
-      z->r->byte_offset--;
-
-      LineNode *child = z->r->l;
-      while(child != tree->nil) {
-        child->byte_offset += z->byte_offset;
-        assert(child->byte_offset > 0);
-        child->byte_offset--;
-        child = child->l;
+      c->byte_offset -= 1;
+      current = c->l;
+    }
+  }
+
+  assert(current != LINE_TREE_NIL);
+  tree->size -= 1;
+
+  u32 z = current;
+  LineNode *zn = NODE(z);
+  u32 y = z;
+  u32 x = LINE_TREE_NIL;
+#if defined(LINE_TREE_METRICS)
+  // NOTE: the lowest node whose subtree changed
+  u32 changed = zn->p;
+#endif
+  LineNodeColor y_original_color = (LineNodeColor)NODE(y)->color;
+  if(zn->l == LINE_TREE_NIL) {
+    x = zn->r;
+    line_tree_transplant(tree, z, zn->r);
+    if(zn->r != LINE_TREE_NIL) {
+      LineNode *r = NODE(zn->r);
+      r->byte_offset += zn->byte_offset;
+      assert(r->byte_offset > 0);
+      r->byte_offset--;
+
+      u32 child = r->l;
+      while(child != LINE_TREE_NIL) {
+        LineNode *c = NODE(child);
+        c->byte_offset += zn->byte_offset;
+        assert(c->byte_offset > 0);
+        c->byte_offset--;
+        child = c->l;
       }
 
     }
-  } else if(z->r == tree->nil) {
-    x = z->l;
-    line_tree_transplant(tree, z, z->l);
+  } else if(zn->r == LINE_TREE_NIL) {
+    x = zn->l;
+    line_tree_transplant(tree, z, zn->l);
   } else {
-    y = line_tree_minimun(tree, z->r);
-    y_original_color = y->color;
-    x = y->r;
-    if(y->p != z) {
-      LineNode *parent = y->p;
+    y = line_tree_minimun(tree, zn->r);
+    LineNode *yn = NODE(y);
+    y_original_color = (LineNodeColor)yn->color;
+    x = yn->r;
+#if defined(LINE_TREE_METRICS)
+    changed = yn->p != z ? yn->p : y;
+#endif
+    if(yn->p != z) {
+      u32 parent = yn->p;
       while(parent != z) {
-        assert(parent->byte_offset >= y->byte_offset);
-        assert(parent->total_lines >= y->total_lines);
-        parent->byte_offset -= y->byte_offset;
-        parent->total_lines -= y->total_lines;
-        parent = parent->p;
+        LineNode *pn = NODE(parent);
+        assert(pn->byte_offset >= yn->byte_offset);
+        assert(pn->total_lines >= yn->total_lines);
+        pn->byte_offset -= yn->byte_offset;
+        pn->total_lines -= yn->total_lines;
+        parent = pn->p;
       }
 
-      line_tree_transplant(tree, y, y->r);
-      y->r = z->r;
-      y->r->p = y;
+      line_tree_transplant(tree, y, yn->r);
+      yn->r = zn->r;
+      NODE(yn->r)->p = y;
     } else {
-      x->p = y;
+      NODE(x)->p = y;
     }
     
     line_tree_transplant(tree, z, y);
-    y->l = z->l;
-    y->l->p = y;
-    y->color = z->color;
-    y->total_lines = z->total_lines;
+    yn->l = zn->l;
+    NODE(yn->l)->p = y;
+    yn->color = zn->color;
+    yn->total_lines = zn->total_lines;
     
-    y->byte_offset += z->byte_offset;
-    assert(y->byte_offset > 0);
-    y->byte_offset--;
+    yn->byte_offset += zn->byte_offset;
+    assert(yn->byte_offset > 0);
+    yn->byte_offset--;
   } 
 
+  METRICS_UPDATE(changed);
+
   if(y_original_color == LINE_NODE_BLACK) {
     line_tree_delete_fixup(tree, x);
   }
   
-  free(z);
+  line_tree_node_free(tree, z);
 
   return true;
 }
 
-LineNode *find_offset_parent_node(LineTree *tree, u64 *byte_offset) {
+static u32 find_offset_parent_node(LineTree *tree, u64 *byte_offset) {
   assert(byte_offset);
 
   u64 last_byte_offset = 0; 
   u64 current_byte_offset = *byte_offset;
   
-  LineNode *parent = tree->nil;
-  LineNode *current = tree->root;
+  u32 parent = LINE_TREE_NIL;
+  u32 current = tree->root;
 
-  while(current != tree->nil) {
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
     last_byte_offset = current_byte_offset;
     parent = current;
-    if(current_byte_offset > current->byte_offset) {
-      current_byte_offset -= current->byte_offset;
-      current = current->r;
+    if(current_byte_offset > c->byte_offset) {
+      current_byte_offset -= c->byte_offset;
+      current = c->r;
     } else {
-      current = current->l;
+      current = c->l;
     }
   }
   
@@ -392,45 +675,777 @@ LineNode *find_offset_parent_node(LineTree *tree, u64 *byte_offset) {
 }
 
 void line_tree_propagate_increment_at_byte(LineTree *tree, u64 byte_offset, u64 value) {
-  bool left;
-  LineNode *parent = find_offset_parent_node(tree, &byte_offset);
+  tree->size += value;
+  u32 parent = find_offset_parent_node(tree, &byte_offset);
   
-  if(parent == tree->nil) {
+  if(parent == LINE_TREE_NIL) {
     return;
   }
   
-  if (byte_offset <= parent->byte_offset) {
-    parent->byte_offset += value;
+  if (byte_offset <= NODE(parent)->byte_offset) {
+    NODE(parent)->byte_offset += value;
   }
   
   line_tree_propagate_increment(tree, parent, value, 0);
 }
 
 void line_tree_propagate_decrement_at_byte(LineTree *tree, u64 byte_offset, u64 value) {
-  bool left;
-  LineNode *parent = find_offset_parent_node(tree, &byte_offset);
+  assert(tree->size >= value);
+  tree->size -= value;
+  u32 parent = find_offset_parent_node(tree, &byte_offset);
   
-  if(parent == tree->nil) {
+  if(parent == LINE_TREE_NIL) {
     return;
   }
   
-  if (byte_offset <= parent->byte_offset) {
-    parent->byte_offset -= value;
+  if (byte_offset <= NODE(parent)->byte_offset) {
+    NODE(parent)->byte_offset -= value;
   }
   
   line_tree_propagate_decrement(tree, parent, value, 0);
 }
 
-static u32 line_tree_node_height(LineTree *tree, LineNode *node) {
-  if(node == tree->nil) {
+// NOTE: finds the first new line at or after byte_offset
+static bool line_tree_next_newline(LineTree *tree, u64 byte_offset, u64 *newline_offset) {
+  bool found = false;
+  u64 base = 0;
+  u32 current = tree->root;
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
+    u64 offset = base + c->byte_offset;
+    if(byte_offset <= offset) {
+      *newline_offset = offset;
+      found = true;
+      current = c->l;
+    } else {
+      base = offset;
+      current = c->r;
+    }
+  }
+  return found;
+}
+
+// NOTE: the range functions cut the tree in detached subtrees and join them
+// back. A detached subtree has no parent and its offsets are relative to 0,
+// only the left spine of a subtree is relative to its base so moving it is
+// O(log n)
+static void line_tree_rebase(LineTree *tree, u32 node, s64 delta) {
+  while(node != LINE_TREE_NIL) {
+    LineNode *n = NODE(node);
+    n->byte_offset = (u64)((s64)n->byte_offset + delta);
+    node = n->l;
+  }
+}
+
+static u32 line_tree_subtree_lines(LineTree *tree, u32 node) {
+  u32 lines = 0;
+  while(node != LINE_TREE_NIL) {
+    lines += NODE(node)->total_lines;
+    node = NODE(node)->r;
+  }
+  return lines;
+}
+
+static u32 line_tree_black_height(LineTree *tree, u32 node) {
+  u32 height = 0;
+  while(node != LINE_TREE_NIL) {
+    height += NODE(node)->color == LINE_NODE_BLACK;
+    node = NODE(node)->l;
+  }
+  return height;
+}
+
+// NOTE: joins two detached subtrees with a detached node whose byte_offset
+// holds its offset, every new line of left goes before it and every new line
+// of right after it. The node goes down the spine of the taller subtree to
+// the first black node of the other subtree height and the usual insert
+// fixup restores the colors, O(log n)
+static u32 line_tree_join(LineTree *tree, u32 left, u32 node, u32 right) {
+  NODE(left)->color = LINE_NODE_BLACK;
+  NODE(right)->color = LINE_NODE_BLACK;
+  u32 left_height = line_tree_black_height(tree, left);
+  u32 right_height = line_tree_black_height(tree, right);
+
+  LineNode *k = NODE(node);
+  u64 offset = k->byte_offset;
+  line_tree_rebase(tree, right, -(s64)offset);
+  k->total_lines = line_tree_subtree_lines(tree, left) + 1;
+  k->p = LINE_TREE_NIL;
+
+  if(left_height == right_height) {
+    k->l = left;
+    k->r = right;
+    k->color = LINE_NODE_BLACK;
+    if(left != LINE_TREE_NIL) {
+      NODE(left)->p = node;
+    }
+    if(right != LINE_TREE_NIL) {
+      NODE(right)->p = node;
+    }
+    METRICS_PULL(node);
+    return node;
+  }
+
+  u32 parent = LINE_TREE_NIL;
+  if(left_height > right_height) {
+    u64 base = 0;
+    u32 current = left;
+    u32 height = left_height;
+    while(NODE(current)->color == LINE_NODE_RED || height != right_height) {
+      height -= NODE(current)->color == LINE_NODE_BLACK;
+      parent = current;
+      base += NODE(current)->byte_offset;
+      current = NODE(current)->r;
+    }
+    k->byte_offset = offset - base;
+    k->total_lines = line_tree_subtree_lines(tree, current) + 1;
+    k->l = current;
+    k->r = right;
+    NODE(parent)->r = node;
+    tree->root = left;
+  } else {
+    u32 current = right;
+    u32 height = right_height;
+    while(NODE(current)->color == LINE_NODE_RED || height != left_height) {
+      height -= NODE(current)->color == LINE_NODE_BLACK;
+      parent = current;
+      NODE(current)->total_lines += k->total_lines;
+      // NOTE: right keeps its root, only the spine from current down is
+      // relative to node
+      NODE(current)->byte_offset += offset;
+      current = NODE(current)->l;
+    }
+    k->l = left;
+    k->r = current;
+    NODE(parent)->l = node;
+    tree->root = right;
+  }
+
+  k->p = parent;
+  k->color = LINE_NODE_RED;
+  if(k->l != LINE_TREE_NIL) {
+    NODE(k->l)->p = node;
+  }
+  if(k->r != LINE_TREE_NIL) {
+    NODE(k->r)->p = node;
+  }
+  METRICS_UPDATE(node);
+  line_tree_insert_fixup(tree, node);
+  return tree->root;
+}
+
+// NOTE: splits a detached subtree in the new lines before byte_offset, the
+// first new line at or after it as a detached node (nil when there is none)
+// and the new lines after that one
+static void line_tree_split(LineTree *tree, u32 node, u64 byte_offset, u32 *left, u32 *middle, u32 *right) {
+  if(node == LINE_TREE_NIL) {
+    *left = LINE_TREE_NIL;
+    *middle = LINE_TREE_NIL;
+    *right = LINE_TREE_NIL;
+    return;
+  }
+
+  LineNode *n = NODE(node);
+  u64 offset = n->byte_offset;
+  u32 l = n->l;
+  u32 r = n->r;
+  NODE(l)->p = LINE_TREE_NIL;
+  NODE(r)->p = LINE_TREE_NIL;
+  line_tree_rebase(tree, r, (s64)offset);
+  n->l = LINE_TREE_NIL;
+  n->r = LINE_TREE_NIL;
+
+  if(byte_offset <= offset) {
+    u32 rest;
+    line_tree_split(tree, l, byte_offset, left, middle, &rest);
+    if(*middle == LINE_TREE_NIL) {
+      *middle = node;
+      *right = r;
+    } else {
+      *right = line_tree_join(tree, rest, node, r);
+    }
+  } else {
+    u32 rest;
+    line_tree_split(tree, r, byte_offset, &rest, middle, right);
+    *left = line_tree_join(tree, l, node, rest);
+  }
+}
+
+static void line_tree_set_root(LineTree *tree, u32 root) {
+  tree->root = root;
+  if(root != LINE_TREE_NIL) {
+    NODE(root)->p = LINE_TREE_NIL;
+    NODE(root)->color = LINE_NODE_BLACK;
+  }
+}
+
+void line_tree_insert_offsets(LineTree *tree, u64 byte_offset, u64 size, const u64 *newline_offsets, u64 count) {
+  if(count == 0) {
+    if(size > 0) {
+      line_tree_propagate_increment_at_byte(tree, byte_offset, size);
+    }
+    return;
+  }
+
+  // NOTE: an empty tree, like when a file is loaded, is built in one go
+  if(tree->root == LINE_TREE_NIL) {
+    u64 size_after_insert = tree->size + size;
+    line_tree_build(tree, newline_offsets, count);
+    tree->size = size_after_insert;
+    return;
+  }
+
+  // NOTE: the tree is cut at byte_offset, the new lines after it move by size
+  // and the new lines go in between as a built subtree, one join per side
+  u32 left, middle, right;
+  line_tree_split(tree, tree->root, byte_offset, &left, &middle, &right);
+  if(middle != LINE_TREE_NIL) {
+    NODE(middle)->byte_offset += size;
+    line_tree_rebase(tree, right, (s64)size);
+  }
+
+  u32 first = line_tree_node_alloc(tree);
+  LineNode *f = NODE(first);
+  f->byte_offset = newline_offsets[0];
+  f->l = LINE_TREE_NIL;
+  f->r = LINE_TREE_NIL;
+  METRICS_INIT(first);
+
+  u32 inserted = line_tree_build_subtree(tree, newline_offsets + 1, count - 1);
+  u32 root = line_tree_join(tree, left, first, inserted);
+  if(middle != LINE_TREE_NIL) {
+    root = line_tree_join(tree, root, middle, right);
+  }
+  line_tree_set_root(tree, root);
+  tree->size += size;
+}
+
+void line_tree_insert_range(LineTree *tree, u64 byte_offset, const u8 *bytes, u64 size) {
+  u64 newlines = scan_count_byte(bytes, size, '\n');
+  if(newlines == 0) {
+    line_tree_insert_offsets(tree, byte_offset, size, 0, 0);
+    return;
+  }
+
+  u64 *newline_offsets = (u64 *)malloc(newlines * sizeof(*newline_offsets));
+  assert(newline_offsets);
+  u64 count = scan_collect_byte(bytes, size, '\n', byte_offset, newline_offsets);
+  line_tree_insert_offsets(tree, byte_offset, size, newline_offsets, count);
+  free(newline_offsets);
+}
+
+void line_tree_delete_range(LineTree *tree, u64 byte_offset, u64 count) {
+  if(count == 0) {
+    return;
+  }
+
+  // NOTE: most deletes do not touch a new line, they only move the rest
+  u64 newline_offset = 0;
+  if(!line_tree_next_newline(tree, byte_offset, &newline_offset) || newline_offset >= byte_offset + count) {
+    line_tree_propagate_decrement_at_byte(tree, byte_offset, count);
+    return;
+  }
+
+  // NOTE: the tree is cut at both ends of the range, the deleted new lines
+  // are dropped as a whole subtree and the new lines after the range move
+  // back by count before the ends are joined again
+  u32 rest, middle, right;
+  line_tree_split(tree, tree->root, byte_offset + count, &rest, &middle, &right);
+  u32 left, first, deleted;
+  line_tree_split(tree, rest, byte_offset, &left, &first, &deleted);
+  assert(first != LINE_TREE_NIL);
+  line_tree_subtree_free(tree, deleted);
+  line_tree_node_free(tree, first);
+
+  u32 root = left;
+  if(middle != LINE_TREE_NIL) {
+    NODE(middle)->byte_offset -= count;
+    line_tree_rebase(tree, right, -(s64)count);
+    root = line_tree_join(tree, left, middle, right);
+  }
+  line_tree_set_root(tree, root);
+  assert(tree->size >= count);
+  tree->size -= count;
+}
+
+// NOTE: joins two detached subtrees, the first new line of right is taken
+// out to join them
+static u32 line_tree_concat(LineTree *tree, u32 left, u32 right) {
+  if(right == LINE_TREE_NIL) {
+    return left;
+  }
+  u32 empty, first, rest;
+  line_tree_split(tree, right, 0, &empty, &first, &rest);
+  assert(empty == LINE_TREE_NIL);
+  return line_tree_join(tree, left, first, rest);
+}
+
+// NOTE: applies a group of edits to the detached subtree that holds the new
+// lines between them. The subtree offsets are from before the batch until the
+// group is split down to no edits, then they move by the shift of every edit
+// before them. line_base is the number of new lines before the subtree after
+// the batch. The middle edit cuts the subtree and both halves recurse, so
+// every split and join works on a smaller subtree
+static u32 line_tree_apply(LineTree *tree, u32 root, LineTreeEdit *edits, u32 count, s64 shift, u32 line_base) {
+  if(count == 0) {
+    line_tree_rebase(tree, root, shift);
+    return root;
+  }
+
+  u32 mid = count / 2;
+  LineTreeEdit *e = &edits[mid];
+  s64 mid_shift = shift;
+  for(u32 i = 0; i < mid; i++) {
+    mid_shift += (s64)edits[i].size - (s64)edits[i].count;
+  }
+
+  u32 left, first, right;
+  line_tree_split(tree, root, e->byte_offset, &left, &first, &right);
+  if(first != LINE_TREE_NIL && NODE(first)->byte_offset < e->byte_offset + e->count) {
+    u32 deleted;
+    line_tree_node_free(tree, first);
+    line_tree_split(tree, right, e->byte_offset + e->count, &deleted, &first, &right);
+    line_tree_subtree_free(tree, deleted);
+  }
+  if(first != LINE_TREE_NIL) {
+    right = line_tree_join(tree, LINE_TREE_NIL, first, right);
+  }
+
+  left = line_tree_apply(tree, left, edits, mid, shift, line_base);
+  e->line = line_base + line_tree_subtree_lines(tree, left);
+  right = line_tree_apply(tree, right, edits + mid + 1, count - mid - 1,
+                          mid_shift + (s64)e->size - (s64)e->count, e->line + (u32)e->newline_count);
+
+  if(e->newline_count == 0) {
+    return line_tree_concat(tree, left, right);
+  }
+  u64 start = (u64)((s64)e->byte_offset + mid_shift);
+  u32 node = line_tree_node_alloc(tree);
+  LineNode *n = NODE(node);
+  n->byte_offset = start + e->newline_offsets[0];
+  n->l = LINE_TREE_NIL;
+  n->r = LINE_TREE_NIL;
+  METRICS_INIT(node);
+  u32 inserted = line_tree_build_subtree(tree, e->newline_offsets + 1, e->newline_count - 1);
+  line_tree_rebase(tree, inserted, (s64)start);
+  return line_tree_concat(tree, line_tree_join(tree, left, node, inserted), right);
+}
+
+void line_tree_apply_edits(LineTree *tree, LineTreeEdit *edits, u32 count) {
+  s64 shift = 0;
+  for(u32 i = 0; i < count; i++) {
+    shift += (s64)edits[i].size - (s64)edits[i].count;
+  }
+  u32 root = line_tree_apply(tree, tree->root, edits, count, 0, 0);
+  line_tree_set_root(tree, root);
+  tree->size = (u64)((s64)tree->size + shift);
+}
+
+// NOTE: finds the byte offset of the new line that ends the given line
+static bool line_tree_select(LineTree *tree, u32 line, u64 *newline_offset) {
+  u64 base = 0;
+  u32 current = tree->root;
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
+    u32 left_lines = c->total_lines - 1;
+    if(line < left_lines) {
+      current = c->l;
+    } else if(line == left_lines) {
+      *newline_offset = base + c->byte_offset;
+      return true;
+    } else {
+      line -= c->total_lines;
+      base += c->byte_offset;
+      current = c->r;
+    }
+  }
+  return false;
+}
+
+bool line_tree_find_line(LineTree *tree, u32 line, u64 *byte_offset, u64 *line_len) {
+  u64 start = 0;
+  if(line > 0) {
+    if(!line_tree_select(tree, line - 1, &start)) {
+      return false;
+    }
+    start++;
+  }
+
+  u64 end;
+  if(!line_tree_select(tree, line, &end)) {
+    end = tree->size;
+  }
+
+  *byte_offset = start;
+  *line_len = end - start;
+  return true;
+}
+
+bool line_tree_find_byte(LineTree *tree, u64 byte_offset, u32 *line, u64 *col) {
+  if(byte_offset > tree->size) {
+    return false;
+  }
+
+  u32 lines = 0;
+  u64 start = 0;
+  u64 base = 0;
+  u32 current = tree->root;
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
+    u64 offset = base + c->byte_offset;
+    if(offset < byte_offset) {
+      lines += c->total_lines;
+      start = offset + 1;
+      base = offset;
+      current = c->r;
+    } else {
+      current = c->l;
+    }
+  }
+
+  *line = lines;
+  *col = byte_offset - start;
+  return true;
+}
+
+#if defined(LINE_TREE_METRICS)
+static void line_tree_metrics_init_all(LineTree *tree, u32 node) {
+  if(node == LINE_TREE_NIL) {
+    return;
+  }
+  line_tree_metrics_init_all(tree, NODE(node)->l);
+  line_tree_metrics_init_all(tree, NODE(node)->r);
+  LineMetrics *m = METRICS(node);
+  m->codepoints = 0;
+  m->width = 0;
+  METRICS_PULL(node);
+}
+
+void line_tree_enable_metrics(LineTree *tree) {
+  if(tree->metrics) {
+    return;
+  }
+  tree->metrics = (LineMetrics **)malloc(tree->chunk_capacity * sizeof(*tree->metrics));
+  assert(tree->metrics);
+  for(u32 i = 0; i < tree->chunk_count; i++) {
+    tree->metrics[i] = (LineMetrics *)malloc(LINE_TREE_CHUNK_SIZE * sizeof(LineMetrics));
+    assert(tree->metrics[i]);
+  }
+  memset(METRICS(LINE_TREE_NIL), 0, sizeof(LineMetrics));
+  line_tree_metrics_init_all(tree, tree->root);
+
+  tree->last_codepoints = 0;
+  tree->last_width = 0;
+}
+
+bool line_tree_has_metrics(LineTree *tree) {
+  return tree->metrics != 0;
+}
+
+static u64 line_tree_codepoint_size(LineTree *tree, u32 node) {
+  return tree->metrics ? METRICS(node)->codepoint_size : 0;
+}
+
+static u64 line_tree_extra_rows(LineTree *tree, u32 node) {
+  return tree->rows ? ROWS(node)->extra_count : 0;
+}
+
+// NOTE: returns the node that ends the line, or nil for the last line. Lines
+// past the last one are not valid. The codepoint offset needs the metrics
+static u32 line_tree_select_node(LineTree *tree, u32 line, u64 *codepoint_offset, u64 *row_offset, bool *valid) {
+  u64 offset = 0;
+  u64 row = 0;
+  u32 current = tree->root;
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
+    u32 left_lines = c->total_lines - 1;
+    if(line < left_lines) {
+      current = c->l;
+    } else if(line == left_lines) {
+      *codepoint_offset = offset + line_tree_codepoint_size(tree, c->l);
+      *row_offset = row + left_lines + line_tree_extra_rows(tree, c->l);
+      *valid = true;
+      return current;
+    } else {
+      line -= c->total_lines;
+      offset += line_tree_codepoint_size(tree, c->l) + 1;
+      row += c->total_lines + line_tree_extra_rows(tree, c->l);
+      if(tree->metrics) {
+        offset += METRICS(current)->codepoints;
+      }
+      if(tree->rows) {
+        row += ROWS(current)->extra;
+      }
+      current = c->r;
+    }
+  }
+  *codepoint_offset = offset;
+  *row_offset = row;
+  *valid = line == 0;
+  return LINE_TREE_NIL;
+}
+
+void line_tree_set_line_metrics(LineTree *tree, u32 line, u32 codepoints, u32 width) {
+  if(!tree->metrics && !tree->rows) {
+    return;
+  }
+  u64 codepoint_offset;
+  u64 row_offset;
+  bool valid;
+  u32 node = line_tree_select_node(tree, line, &codepoint_offset, &row_offset, &valid);
+  if(!valid) {
+    return;
+  }
+  if(node == LINE_TREE_NIL) {
+    if(tree->metrics) {
+      tree->last_codepoints = codepoints;
+      tree->last_width = width;
+    }
+    if(tree->rows) {
+      tree->last_rows = line_tree_wrap_rows(tree, width);
+      tree->last_wrap_epoch = tree->wrap_epoch;
+    }
+    return;
+  }
+  if(tree->metrics) {
+    LineMetrics *m = METRICS(node);
+    m->codepoints = codepoints;
+    m->width = width;
+  }
+  if(tree->rows) {
+    LineRows *r = ROWS(node);
+    r->extra = line_tree_wrap_rows(tree, width) - 1;
+    r->wrap_epoch = tree->wrap_epoch;
+  }
+  METRICS_UPDATE(node);
+}
+
+static void line_tree_metrics_pull_all(LineTree *tree, u32 node) {
+  if(node == LINE_TREE_NIL) {
+    return;
+  }
+  line_tree_metrics_pull_all(tree, NODE(node)->l);
+  line_tree_metrics_pull_all(tree, NODE(node)->r);
+  METRICS_PULL(node);
+}
+
+void line_tree_set_all_line_metrics(LineTree *tree, const u32 *codepoints, const u32 *widths, u64 count) {
+  if(!tree->metrics) {
+    return;
+  }
+  u64 line = 0;
+  u32 node = tree->root != LINE_TREE_NIL ? line_tree_minimun(tree, tree->root) : LINE_TREE_NIL;
+  for(; node != LINE_TREE_NIL && line < count; line++) {
+    LineMetrics *m = METRICS(node);
+    m->codepoints = codepoints[line];
+    m->width = widths[line];
+    if(tree->rows) {
+      LineRows *r = ROWS(node);
+      r->extra = line_tree_wrap_rows(tree, widths[line]) - 1;
+      r->wrap_epoch = tree->wrap_epoch;
+    }
+    node = line_tree_successor(tree, node);
+  }
+  if(node == LINE_TREE_NIL && line < count) {
+    tree->last_codepoints = codepoints[line];
+    tree->last_width = widths[line];
+    if(tree->rows) {
+      tree->last_rows = line_tree_wrap_rows(tree, widths[line]);
+      tree->last_wrap_epoch = tree->wrap_epoch;
+    }
+  }
+  line_tree_metrics_pull_all(tree, tree->root);
+}
+
+bool line_tree_line_metrics(LineTree *tree, u32 line, u64 *codepoint_offset, u32 *codepoints, u32 *width) {
+  if(!tree->metrics) {
+    return false;
+  }
+  u64 row_offset;
+  bool valid;
+  u32 node = line_tree_select_node(tree, line, codepoint_offset, &row_offset, &valid);
+  if(!valid) {
+    return false;
+  }
+  if(node == LINE_TREE_NIL) {
+    *codepoints = tree->last_codepoints;
+    *width = tree->last_width;
+  } else {
+    *codepoints = METRICS(node)->codepoints;
+    *width = METRICS(node)->width;
+  }
+  return true;
+}
+
+u32 line_tree_max_width(LineTree *tree) {
+  if(!tree->metrics) {
     return 0;
   }
-  u32 l = line_tree_node_height(tree, node->l);
-  u32 r = line_tree_node_height(tree, node->r);
-  return 1 + max(l, r);
+  return max(METRICS(tree->root)->max_width, tree->last_width);
+}
+
+// NOTE: zeroed rows are lines of one row that were never wrapped, so nothing
+// is visited to turn wrapping on
+static void line_tree_rows_enable(LineTree *tree) {
+  tree->rows = (LineRows **)malloc(tree->chunk_capacity * sizeof(*tree->rows));
+  assert(tree->rows);
+  for(u32 i = 0; i < tree->chunk_count; i++) {
+    tree->rows[i] = (LineRows *)calloc(LINE_TREE_CHUNK_SIZE, sizeof(LineRows));
+    assert(tree->rows[i]);
+  }
+  tree->last_rows = 1;
+  tree->last_wrap_epoch = 0;
+}
+
+static void line_tree_rows_disable(LineTree *tree) {
+  for(u32 i = 0; i < tree->chunk_count; i++) {
+    free(tree->rows[i]);
+  }
+  free(tree->rows);
+  tree->rows = 0;
+  tree->last_rows = 1;
+}
+
+// NOTE: every line is stale now but keeps its old row count until it is
+// wrapped again, nothing is visited here
+void line_tree_rewrap(LineTree *tree) {
+  tree->wrap_epoch++;
+  if(tree->wrap_epoch == 0) {
+    tree->wrap_epoch++;
+  }
+}
+
+void line_tree_set_wrap_columns(LineTree *tree, u32 columns) {
+  if(tree->wrap_columns == columns) {
+    return;
+  }
+  tree->wrap_columns = columns;
+  if(columns == 0) {
+    line_tree_rows_disable(tree);
+    return;
+  }
+  if(!tree->rows) {
+    line_tree_rows_enable(tree);
+  }
+  line_tree_rewrap(tree);
+}
+
+bool line_tree_line_wrapped(LineTree *tree, u32 line) {
+  if(!tree->rows) {
+    return true;
+  }
+  u64 codepoint_offset;
+  u64 row_offset;
+  bool valid;
+  u32 node = line_tree_select_node(tree, line, &codepoint_offset, &row_offset, &valid);
+  if(!valid) {
+    return true;
+  }
+  u32 wrap_epoch = node == LINE_TREE_NIL ? tree->last_wrap_epoch : ROWS(node)->wrap_epoch;
+  return wrap_epoch == tree->wrap_epoch;
 }
 
+u32 line_tree_wrap_lines(LineTree *tree, u32 first_line, u32 count) {
+  if(!tree->metrics || !tree->rows) {
+    return 0;
+  }
+  u64 codepoint_offset;
+  u64 row_offset;
+  bool valid;
+  u32 node = line_tree_select_node(tree, first_line, &codepoint_offset, &row_offset, &valid);
+  if(!valid) {
+    return 0;
+  }
+
+  u32 wrapped = 0;
+  for(u32 i = 0; i < count; i++) {
+    if(node == LINE_TREE_NIL) {
+      if(tree->last_wrap_epoch != tree->wrap_epoch) {
+        tree->last_rows = line_tree_wrap_rows(tree, tree->last_width);
+        tree->last_wrap_epoch = tree->wrap_epoch;
+        wrapped++;
+      }
+      break;
+    }
+    LineRows *r = ROWS(node);
+    if(r->wrap_epoch != tree->wrap_epoch) {
+      r->extra = line_tree_wrap_rows(tree, METRICS(node)->width) - 1;
+      r->wrap_epoch = tree->wrap_epoch;
+      METRICS_UPDATE(node);
+      wrapped++;
+    }
+    node = line_tree_successor(tree, node);
+  }
+  return wrapped;
+}
+
+bool line_tree_line_rows(LineTree *tree, u32 line, u64 *first_row, u32 *rows) {
+  if(!tree->rows) {
+    *first_row = line;
+    *rows = 1;
+    return line <= line_tree_subtree_lines(tree, tree->root);
+  }
+  u64 codepoint_offset;
+  bool valid;
+  u32 node = line_tree_select_node(tree, line, &codepoint_offset, first_row, &valid);
+  if(!valid) {
+    return false;
+  }
+  *rows = node == LINE_TREE_NIL ? tree->last_rows : ROWS(node)->extra + 1;
+  return true;
+}
+
+bool line_tree_find_row(LineTree *tree, u64 row, u32 *line, u32 *line_row) {
+  if(!tree->rows) {
+    *line = (u32)row;
+    *line_row = 0;
+    return row <= line_tree_subtree_lines(tree, tree->root);
+  }
+  u32 lines = 0;
+  u32 current = tree->root;
+  while(current != LINE_TREE_NIL) {
+    LineNode *c = NODE(current);
+    u64 left_rows = c->total_lines - 1 + ROWS(c->l)->extra_count;
+    u32 rows = ROWS(current)->extra + 1;
+    if(row < left_rows) {
+      current = c->l;
+    } else if(row < left_rows + rows) {
+      *line = lines + c->total_lines - 1;
+      *line_row = (u32)(row - left_rows);
+      return true;
+    } else {
+      row -= left_rows + rows;
+      lines += c->total_lines;
+      current = c->r;
+    }
+  }
+  if(row < tree->last_rows) {
+    *line = lines;
+    *line_row = (u32)row;
+    return true;
+  }
+  return false;
+}
+
+u64 line_tree_row_count(LineTree *tree) {
+  u64 lines = (u64)line_tree_subtree_lines(tree, tree->root);
+  if(!tree->rows) {
+    return lines + 1;
+  }
+  return lines + ROWS(tree->root)->extra_count + tree->last_rows;
+}
+#endif
+
 #if 0
+static u32 line_tree_node_height(LineTree *tree, u32 node) {
+  if(node == LINE_TREE_NIL) {
+    return 0;
+  }
+  u32 l = line_tree_node_height(tree, NODE(node)->l);
+  u32 r = line_tree_node_height(tree, NODE(node)->r);
+  return 1 + max(l, r);
+}
+
 static void line_tree_node_draw(struct RenderFont *font, s32 x, s32 y,
                                 LineNode *node, u32 max_height, u32 depth) {
 
@@ -465,8 +1480,9 @@ void line_tree_draw(s32 x, s32 y, struct RenderFont *font, LineTree *tree) {
 #else
 
 static void line_tree_node_draw(LineTree *tree, struct RenderFont *font, s32 base_x, s32 y, 
-                                LineNode *node, u64 abs_line, u32 depth) {
-  if (node == tree->nil) return;
+                                u32 index, u64 abs_line, u32 depth) {
+  if (index == LINE_TREE_NIL) return;
+  LineNode *node = NODE(index);
   
   if (depth > 200) return; 
 
@@ -478,8 +1494,8 @@ static void line_tree_node_draw(LineTree *tree, struct RenderFont *font, s32 bas
 
   s32 current_x = base_x + (abs_line * h_spacing);
 
-  if (node->l != tree->nil) {
-    u64 left_abs_line = abs_line - node->total_lines + node->l->total_lines;
+  if (node->l != LINE_TREE_NIL) {
+    u64 left_abs_line = abs_line - node->total_lines + NODE(node->l)->total_lines;
     s32 left_x = base_x + (left_abs_line * h_spacing);
     render_line(current_x, y, left_x, y + offset_y, 0xffffff);
   } else {
@@ -488,8 +1504,8 @@ static void line_tree_node_draw(LineTree *tree, struct RenderFont *font, s32 bas
     render_rect(null_x - half/2, y + offset_y - half/2, half, half, 0xffffff);
   }
 
-  if (node->r != tree->nil) {
-    u64 right_abs_line = abs_line + node->r->total_lines;
+  if (node->r != LINE_TREE_NIL) {
+    u64 right_abs_line = abs_line + NODE(node->r)->total_lines;
     s32 right_x = base_x + (right_abs_line * h_spacing);
     render_line(current_x, y, right_x, y + offset_y, 0xffffff);
   } else {
@@ -505,21 +1521,21 @@ static void line_tree_node_draw(LineTree *tree, struct RenderFont *font, s32 bas
   sprintf(text, "%llu|%u", (unsigned long long)node->byte_offset, node->total_lines);
   render_text(font, text, current_x - half, y, 0xffffff, color);
 
-  if (node->l != tree->nil) {
-    u64 left_abs_line = abs_line - node->total_lines + node->l->total_lines;
+  if (node->l != LINE_TREE_NIL) {
+    u64 left_abs_line = abs_line - node->total_lines + NODE(node->l)->total_lines;
     line_tree_node_draw(tree, font, base_x, y + offset_y, node->l, left_abs_line, depth + 1);
   }
-  if (node->r != tree->nil) {
-    u64 right_abs_line = abs_line + node->r->total_lines;
+  if (node->r != LINE_TREE_NIL) {
+    u64 right_abs_line = abs_line + NODE(node->r)->total_lines;
     line_tree_node_draw(tree, font, base_x, y + offset_y, node->r, right_abs_line, depth + 1);
   }
 }
 
 void line_tree_draw(s32 start_x, s32 y, struct RenderFont *font, LineTree *tree) {
-  if (tree->root == tree->nil) return;
+  if (tree->root == LINE_TREE_NIL) return;
   
   s32 h_spacing = 60; // Needs to match the spacing in the node_draw function
-  u64 root_abs_line = tree->root->total_lines;
+  u64 root_abs_line = NODE(tree->root)->total_lines;
   
   s32 base_x = start_x - (root_abs_line * h_spacing);
 
@@ -528,3 +1544,6 @@ void line_tree_draw(s32 start_x, s32 y, struct RenderFont *font, LineTree *tree)
 
 #endif
 
+#undef NODE
+#undef METRICS_PULL
+#undef METRICS_UPDATE
@@ -11,32 +11,172 @@ enum LineNodeColor {
   LINE_NODE_RED,
 };
 
+// NOTE: nodes live in a pool owned by the tree and link to each other with
+// 32 bit indices. Index 0 is the nil sentinel.
+#define LINE_TREE_NIL 0
+
+#define LINE_TREE_CHUNK_SHIFT 12
+#define LINE_TREE_CHUNK_SIZE (1 << LINE_TREE_CHUNK_SHIFT)
+#define LINE_TREE_CHUNK_MASK (LINE_TREE_CHUNK_SIZE - 1)
+
 typedef struct LineNode LineNode;
 struct LineNode {
-	LineNode *l;
-	LineNode *r;
-	LineNode *p;
-
 	u64 byte_offset;
 	u32 total_lines;
 
-  LineNodeColor color;
+	u32 l;
+	u32 r;
+	u32 p     : 31;
+	u32 color : 1;
+};
+
+#if defined(LINE_TREE_METRICS)
+// NOTE: with LINE_TREE_METRICS defined every node can also describe the line
+// it ends: its codepoint count and display width with tabs expanded. The
+// subtree codepoint sum (new lines count as one) and the widest line of the
+// subtree are kept for the whole subtree. The tree does not read text, the
+// owner of the text measures lines after editing them with
+// line_tree_set_line_metrics.
+// Metrics live in a second pool indexed like the nodes, it is only allocated
+// by line_tree_enable_metrics so the tree walks stay on small nodes and a tree
+// that never asks for columns does not pay for them.
+typedef struct LineMetrics LineMetrics;
+struct LineMetrics {
+	u64 codepoint_size;
+	u32 codepoints;
+	u32 width;
+	u32 max_width;
+};
+
+// NOTE: soft wrap keeps the rows a line takes at the current wrap columns in
+// a third pool, allocated while wrapping is on. Only the rows past the first
+// are stored and summed for the subtree, so a zeroed entry is a line of one
+// row and visual rows map to lines in O(log n). A wrap width change only
+// bumps wrap_epoch, lines are re-wrapped lazily when they are shown and keep
+// their old row count as an estimate until then. A wrap_epoch of 0 was never
+// wrapped.
+typedef struct LineRows LineRows;
+struct LineRows {
+	u64 extra_count;
+	u32 extra;
+	u32 wrap_epoch;
+};
+#endif
+
+// NOTE: one edit of a batch, count bytes at byte_offset are replaced by size
+// bytes with new lines at newline_offsets, relative to byte_offset. Offsets
+// refer to the text before the batch, line is set to the line of byte_offset
+// after it
+typedef struct LineTreeEdit LineTreeEdit;
+struct LineTreeEdit {
+  u64 byte_offset;
+  u64 count;
+  u64 size;
+  const u64 *newline_offsets;
+  u64 newline_count;
+  u32 line;
 };
 
 typedef struct LineTree LineTree;
 struct LineTree {
-  LineNode *root;
-  LineNode *nil;
+  u32 root;
+
+  // NOTE: the pool grows one chunk at a time so nodes never move, freed
+  // nodes are linked through their p index and keep their children
+  LineNode **chunks;
+  u32 chunk_count;
+  u32 chunk_capacity;
+  u32 node_count;
+  u32 free_list;
+
+#if defined(LINE_TREE_METRICS)
+  // NOTE: one chunk of metrics and of rows per chunk of nodes, 0 until
+  // enabled
+  LineMetrics **metrics;
+  LineRows **rows;
+#endif
 
-  LineNode nil_node;
+  // NOTE: total bytes tracked by the tree, including the last line
+  u64 size;
+
+#if defined(LINE_TREE_METRICS)
+  // NOTE: the last line has no new line and no node
+  u32 last_codepoints;
+  u32 last_width;
+  u32 last_rows;
+  u32 last_wrap_epoch;
+
+  // NOTE: 0 disables wrapping, every line is one row
+  u32 wrap_columns;
+  u32 wrap_epoch;
+#endif
 };
 
 void line_tree_init(LineTree *tree);
+void line_tree_destroy(LineTree *tree);
+
+void line_tree_build(LineTree *tree, const u64 *newline_offsets, u64 count);
 
 void line_tree_insert(LineTree *tree, u64 byte_offset);
 
 bool line_tree_delete(LineTree *tree, u64 byte_offset);
 
+void line_tree_propagate_increment_at_byte(LineTree *tree, u64 byte_offset, u64 value);
+void line_tree_propagate_decrement_at_byte(LineTree *tree, u64 byte_offset, u64 value);
+
+void line_tree_insert_range(LineTree *tree, u64 byte_offset, const u8 *bytes, u64 size);
+// NOTE: same as line_tree_insert_range with the new lines of the inserted
+// bytes already found, newline_offsets are sorted and final
+void line_tree_insert_offsets(LineTree *tree, u64 byte_offset, u64 size, const u64 *newline_offsets, u64 count);
+void line_tree_delete_range(LineTree *tree, u64 byte_offset, u64 count);
+// NOTE: edits are sorted and do not overlap, the tree is changed in one pass
+void line_tree_apply_edits(LineTree *tree, LineTreeEdit *edits, u32 count);
+
+bool line_tree_find_line(LineTree *tree, u32 line, u64 *byte_offset, u64 *line_len);
+bool line_tree_find_byte(LineTree *tree, u64 byte_offset, u32 *line, u64 *col);
+
+#if defined(LINE_TREE_METRICS)
+// NOTE: every line starts with no codepoints, the owner of the text measures
+// them all after enabling
+void line_tree_enable_metrics(LineTree *tree);
+bool line_tree_has_metrics(LineTree *tree);
+// NOTE: also wraps the line when wrapping is on, without metrics only that
+void line_tree_set_line_metrics(LineTree *tree, u32 line, u32 codepoints, u32 width);
+// NOTE: sets the metrics of the first count lines in one pass, for loads
+void line_tree_set_all_line_metrics(LineTree *tree, const u32 *codepoints, const u32 *widths, u64 count);
+bool line_tree_line_metrics(LineTree *tree, u32 line, u64 *codepoint_offset, u32 *codepoints, u32 *width);
+u32 line_tree_max_width(LineTree *tree);
+
+// NOTE: 0 turns wrapping off and frees the rows, every line is one row. Any
+// other width starts with every line stale
+void line_tree_set_wrap_columns(LineTree *tree, u32 columns);
+// NOTE: marks every line stale, for edits that changed all of them
+void line_tree_rewrap(LineTree *tree);
+// NOTE: false if the line has to be measured and wrapped again
+bool line_tree_line_wrapped(LineTree *tree, u32 line);
+// NOTE: re-wraps the stale lines among count lines from first_line with the
+// widths of the metrics, returns how many changed. Without metrics the owner
+// of the text measures stale lines with line_tree_set_line_metrics instead
+u32 line_tree_wrap_lines(LineTree *tree, u32 first_line, u32 count);
+bool line_tree_line_rows(LineTree *tree, u32 line, u64 *first_row, u32 *rows);
+bool line_tree_find_row(LineTree *tree, u64 row, u32 *line, u32 *line_row);
+u64 line_tree_row_count(LineTree *tree);
+#endif
+
 void line_tree_draw(s32 x, s32 y, struct RenderFont *font, LineTree *tree);
 
+static inline LineNode *line_tree_node(LineTree *tree, u32 index) {
+  return &tree->chunks[index >> LINE_TREE_CHUNK_SHIFT][index & LINE_TREE_CHUNK_MASK];
+}
+
+#if defined(LINE_TREE_METRICS)
+static inline LineMetrics *line_tree_metrics(LineTree *tree, u32 index) {
+  return &tree->metrics[index >> LINE_TREE_CHUNK_SHIFT][index & LINE_TREE_CHUNK_MASK];
+}
+
+static inline LineRows *line_tree_rows(LineTree *tree, u32 index) {
+  return &tree->rows[index >> LINE_TREE_CHUNK_SHIFT][index & LINE_TREE_CHUNK_MASK];
+}
+#endif
+
 #endif // _LINE_TREE_H_
@@ -0,0 +1,541 @@
+#include "scan.h"
+
+#include <string.h>
+
+typedef struct ScanKernels ScanKernels;
+struct ScanKernels {
+  u64 (*count_byte)(const u8 *bytes, u64 size, u8 byte);
+  const u8 *(*find_nth_byte)(const u8 *bytes, u64 size, u8 byte, u64 n);
+  u64 (*collect_byte)(const u8 *bytes, u64 size, u8 byte, u64 base, u64 *offsets);
+  const u8 *(*memchr2)(const u8 *bytes, u64 size, u8 a, u8 b);
+  const u8 *(*memchr3)(const u8 *bytes, u64 size, u8 a, u8 b, u8 c);
+  const u8 *(*find_pair)(const u8 *bytes, u64 size, u8 first, u8 last, u64 distance);
+  u64 (*ascii_prefix)(const u8 *bytes, u64 size);
+  u64 (*utf8_length)(const u8 *bytes, u64 size);
+};
+
+// NOTE: scalar kernels, also used for the tails of the simd ones
+
+static u64 scan_count_byte_scalar(const u8 *bytes, u64 size, u8 byte) {
+  u64 count = 0;
+  for(u64 i = 0; i < size; i++) {
+    count += bytes[i] == byte;
+  }
+  return count;
+}
+
+static const u8 *scan_find_nth_byte_scalar(const u8 *bytes, u64 size, u8 byte, u64 n) {
+  for(u64 i = 0; i < size; i++) {
+    if(bytes[i] == byte) {
+      if(n == 0) {
+        return bytes + i;
+      }
+      n--;
+    }
+  }
+  return 0;
+}
+
+static u64 scan_collect_byte_scalar(const u8 *bytes, u64 size, u8 byte, u64 base, u64 *offsets) {
+  u64 count = 0;
+  for(u64 i = 0; i < size; i++) {
+    if(bytes[i] == byte) {
+      offsets[count++] = base + i;
+    }
+  }
+  return count;
+}
+
+static const u8 *scan_memchr2_scalar(const u8 *bytes, u64 size, u8 a, u8 b) {
+  for(u64 i = 0; i < size; i++) {
+    if(bytes[i] == a || bytes[i] == b) {
+      return bytes + i;
+    }
+  }
+  return 0;
+}
+
+static const u8 *scan_memchr3_scalar(const u8 *bytes, u64 size, u8 a, u8 b, u8 c) {
+  for(u64 i = 0; i < size; i++) {
+    if(bytes[i] == a || bytes[i] == b || bytes[i] == c) {
+      return bytes + i;
+    }
+  }
+  return 0;
+}
+
+static const u8 *scan_find_pair_scalar(const u8 *bytes, u64 size, u8 first, u8 last, u64 distance) {
+  for(u64 i = 0; i + distance < size; i++) {
+    if(bytes[i] == first && bytes[i + distance] == last) {
+      return bytes + i;
+    }
+  }
+  return 0;
+}
+
+static u64 scan_ascii_prefix_scalar(const u8 *bytes, u64 size) {
+  for(u64 i = 0; i < size; i++) {
+    if(bytes[i] & 0x80) {
+      return i;
+    }
+  }
+  return size;
+}
+
+static u64 scan_utf8_length_scalar(const u8 *bytes, u64 size) {
+  u64 count = 0;
+  for(u64 i = 0; i < size; i++) {
+    count += (bytes[i] & 0xc0) != 0x80;
+  }
+  return count;
+}
+
+static const ScanKernels scan_kernels_scalar = {
+  scan_count_byte_scalar,
+  scan_find_nth_byte_scalar,
+  scan_collect_byte_scalar,
+  scan_memchr2_scalar,
+  scan_memchr3_scalar,
+  scan_find_pair_scalar,
+  scan_ascii_prefix_scalar,
+  scan_utf8_length_scalar,
+};
+
+#if defined(CPU_X86)
+
+// NOTE: sse2 kernels, 16 bytes per step
+
+CPU_SSE2 static u64 scan_count_byte_sse2(const u8 *bytes, u64 size, u8 byte) {
+  __m128i needle = _mm_set1_epi8((char)byte);
+  u64 count = 0;
+  u64 i = 0;
+  while(size - i >= 16) {
+    // NOTE: the per lane counters are bytes, flush them before they overflow
+    u64 steps = min((size - i) / 16, 255);
+    __m128i counters = _mm_setzero_si128();
+    for(u64 step = 0; step < steps; step++, i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+      counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(v, needle));
+    }
+    __m128i sum = _mm_sad_epu8(counters, _mm_setzero_si128());
+    count += (u64)_mm_cvtsi128_si64(sum) + (u64)_mm_extract_epi16(sum, 4);
+  }
+  return count + scan_count_byte_scalar(bytes + i, size - i, byte);
+}
+
+CPU_SSE2 static const u8 *scan_find_nth_byte_sse2(const u8 *bytes, u64 size, u8 byte, u64 n) {
+  __m128i needle = _mm_set1_epi8((char)byte);
+  u64 i = 0;
+  for(; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    u32 hits = (u32)__builtin_popcount(mask);
+    if(n < hits) {
+      for(; n > 0; n--) {
+        mask &= mask - 1;
+      }
+      return bytes + i + __builtin_ctz(mask);
+    }
+    n -= hits;
+  }
+  return scan_find_nth_byte_scalar(bytes + i, size - i, byte, n);
+}
+
+CPU_SSE2 static u64 scan_collect_byte_sse2(const u8 *bytes, u64 size, u8 byte, u64 base, u64 *offsets) {
+  __m128i needle = _mm_set1_epi8((char)byte);
+  u64 count = 0;
+  u64 i = 0;
+  for(; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    while(mask) {
+      offsets[count++] = base + i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  return count + scan_collect_byte_scalar(bytes + i, size - i, byte, base + i, offsets + count);
+}
+
+CPU_SSE2 static const u8 *scan_memchr2_sse2(const u8 *bytes, u64 size, u8 a, u8 b) {
+  __m128i needle_a = _mm_set1_epi8((char)a);
+  __m128i needle_b = _mm_set1_epi8((char)b);
+  u64 i = 0;
+  for(; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, needle_a), _mm_cmpeq_epi8(v, needle_b));
+    u32 mask = (u32)_mm_movemask_epi8(hit);
+    if(mask) {
+      return bytes + i + __builtin_ctz(mask);
+    }
+  }
+  return scan_memchr2_scalar(bytes + i, size - i, a, b);
+}
+
+CPU_SSE2 static const u8 *scan_memchr3_sse2(const u8 *bytes, u64 size, u8 a, u8 b, u8 c) {
+  __m128i needle_a = _mm_set1_epi8((char)a);
+  __m128i needle_b = _mm_set1_epi8((char)b);
+  __m128i needle_c = _mm_set1_epi8((char)c);
+  u64 i = 0;
+  for(; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, needle_a), _mm_cmpeq_epi8(v, needle_b));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, needle_c));
+    u32 mask = (u32)_mm_movemask_epi8(hit);
+    if(mask) {
+      return bytes + i + __builtin_ctz(mask);
+    }
+  }
+  return scan_memchr3_scalar(bytes + i, size - i, a, b, c);
+}
+
+// NOTE: a lane is a candidate when its byte is first and the byte distance
+// after it is last, both loads are unaligned
+CPU_SSE2 static const u8 *scan_find_pair_sse2(const u8 *bytes, u64 size, u8 first, u8 last, u64 distance) {
+  __m128i needle_first = _mm_set1_epi8((char)first);
+  __m128i needle_last = _mm_set1_epi8((char)last);
+  u64 i = 0;
+  for(; size - i >= distance + 16; i += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i *)(bytes + i));
+    __m128i tail = _mm_loadu_si128((const __m128i *)(bytes + i + distance));
+    __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(head, needle_first), _mm_cmpeq_epi8(tail, needle_last));
+    u32 mask = (u32)_mm_movemask_epi8(hit);
+    if(mask) {
+      return bytes + i + __builtin_ctz(mask);
+    }
+  }
+  return scan_find_pair_scalar(bytes + i, size - i, first, last, distance);
+}
+
+CPU_SSE2 static u64 scan_ascii_prefix_sse2(const u8 *bytes, u64 size) {
+  u64 i = 0;
+  for(; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    u32 mask = (u32)_mm_movemask_epi8(v);
+    if(mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + scan_ascii_prefix_scalar(bytes + i, size - i);
+}
+
+CPU_SSE2 static u64 scan_utf8_length_sse2(const u8 *bytes, u64 size) {
+  // NOTE: continuation bytes are 0x80 to 0xbf, smaller than 0xc0 as signed bytes
+  __m128i limit = _mm_set1_epi8((char)0xc0);
+  u64 continuations = 0;
+  u64 i = 0;
+  while(size - i >= 16) {
+    u64 steps = min((size - i) / 16, 255);
+    __m128i counters = _mm_setzero_si128();
+    for(u64 step = 0; step < steps; step++, i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+      counters = _mm_sub_epi8(counters, _mm_cmplt_epi8(v, limit));
+    }
+    __m128i sum = _mm_sad_epu8(counters, _mm_setzero_si128());
+    continuations += (u64)_mm_cvtsi128_si64(sum) + (u64)_mm_extract_epi16(sum, 4);
+  }
+  return (i - continuations) + scan_utf8_length_scalar(bytes + i, size - i);
+}
+
+static const ScanKernels scan_kernels_sse2 = {
+  scan_count_byte_sse2,
+  scan_find_nth_byte_sse2,
+  scan_collect_byte_sse2,
+  scan_memchr2_sse2,
+  scan_memchr3_sse2,
+  scan_find_pair_sse2,
+  scan_ascii_prefix_sse2,
+  scan_utf8_length_sse2,
+};
+
+// NOTE: avx2 kernels, 32 bytes per step
+
+CPU_AVX2 static u64 scan_sum_counters_avx2(__m256i counters) {
+  __m256i sum = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+  return (u64)_mm256_extract_epi64(sum, 0) + (u64)_mm256_extract_epi64(sum, 1) +
+         (u64)_mm256_extract_epi64(sum, 2) + (u64)_mm256_extract_epi64(sum, 3);
+}
+
+CPU_AVX2 static u64 scan_count_byte_avx2(const u8 *bytes, u64 size, u8 byte) {
+  __m256i needle = _mm256_set1_epi8((char)byte);
+  u64 count = 0;
+  u64 i = 0;
+  while(size - i >= 32) {
+    u64 steps = min((size - i) / 32, 255);
+    __m256i counters = _mm256_setzero_si256();
+    for(u64 step = 0; step < steps; step++, i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+      counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(v, needle));
+    }
+    count += scan_sum_counters_avx2(counters);
+  }
+  return count + scan_count_byte_scalar(bytes + i, size - i, byte);
+}
+
+CPU_AVX2 static const u8 *scan_find_nth_byte_avx2(const u8 *bytes, u64 size, u8 byte, u64 n) {
+  __m256i needle = _mm256_set1_epi8((char)byte);
+  u64 i = 0;
+  for(; size - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    u32 hits = (u32)__builtin_popcount(mask);
+    if(n < hits) {
+      for(; n > 0; n--) {
+        mask &= mask - 1;
+      }
+      return bytes + i + __builtin_ctz(mask);
+    }
+    n -= hits;
+  }
+  return scan_find_nth_byte_scalar(bytes + i, size - i, byte, n);
+}
+
+CPU_AVX2 static u64 scan_collect_byte_avx2(const u8 *bytes, u64 size, u8 byte, u64 base, u64 *offsets) {
+  __m256i needle = _mm256_set1_epi8((char)byte);
+  u64 count = 0;
+  u64 i = 0;
+  for(; size - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    while(mask) {
+      offsets[count++] = base + i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  return count + scan_collect_byte_scalar(bytes + i, size - i, byte, base + i, offsets + count);
+}
+
+CPU_AVX2 static const u8 *scan_memchr2_avx2(const u8 *bytes, u64 size, u8 a, u8 b) {
+  __m256i needle_a = _mm256_set1_epi8((char)a);
+  __m256i needle_b = _mm256_set1_epi8((char)b);
+  u64 i = 0;
+  for(; size - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, needle_a), _mm256_cmpeq_epi8(v, needle_b));
+    u32 mask = (u32)_mm256_movemask_epi8(hit);
+    if(mask) {
+      return bytes + i + __builtin_ctz(mask);
+    }
+  }
+  return scan_memchr2_scalar(bytes + i, size - i, a, b);
+}
+
+CPU_AVX2 static const u8 *scan_memchr3_avx2(const u8 *bytes, u64 size, u8 a, u8 b, u8 c) {
+  __m256i needle_a = _mm256_set1_epi8((char)a);
+  __m256i needle_b = _mm256_set1_epi8((char)b);
+  __m256i needle_c = _mm256_set1_epi8((char)c);
+  u64 i = 0;
+  for(; size - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, needle_a), _mm256_cmpeq_epi8(v, needle_b));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, needle_c));
+    u32 mask = (u32)_mm256_movemask_epi8(hit);
+    if(mask) {
+      return bytes + i + __builtin_ctz(mask);
+    }
+  }
+  return scan_memchr3_scalar(bytes + i, size - i, a, b, c);
+}
+
+CPU_AVX2 static const u8 *scan_find_pair_avx2(const u8 *bytes, u64 size, u8 first, u8 last, u64 distance) {
+  __m256i needle_first = _mm256_set1_epi8((char)first);
+  __m256i needle_last = _mm256_set1_epi8((char)last);
+  u64 i = 0;
+  for(; size - i >= distance + 32; i += 32) {
+    __m256i head = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(bytes + i + distance));
+    __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(head, needle_first), _mm256_cmpeq_epi8(tail, needle_last));
+    u32 mask = (u32)_mm256_movemask_epi8(hit);
+    if(mask) {
+      return bytes + i + __builtin_ctz(mask);
+    }
+  }
+  return scan_find_pair_scalar(bytes + i, size - i, first, last, distance);
+}
+
+CPU_AVX2 static u64 scan_ascii_prefix_avx2(const u8 *bytes, u64 size) {
+  u64 i = 0;
+  for(; size - i >= 32; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    u32 mask = (u32)_mm256_movemask_epi8(v);
+    if(mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + scan_ascii_prefix_scalar(bytes + i, size - i);
+}
+
+CPU_AVX2 static u64 scan_utf8_length_avx2(const u8 *bytes, u64 size) {
+  // NOTE: there is no signed less than in avx2, limit > v is the same thing
+  __m256i limit = _mm256_set1_epi8((char)0xc0);
+  u64 continuations = 0;
+  u64 i = 0;
+  while(size - i >= 32) {
+    u64 steps = min((size - i) / 32, 255);
+    __m256i counters = _mm256_setzero_si256();
+    for(u64 step = 0; step < steps; step++, i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+      counters = _mm256_sub_epi8(counters, _mm256_cmpgt_epi8(limit, v));
+    }
+    continuations += scan_sum_counters_avx2(counters);
+  }
+  return (i - continuations) + scan_utf8_length_scalar(bytes + i, size - i);
+}
+
+static const ScanKernels scan_kernels_avx2 = {
+  scan_count_byte_avx2,
+  scan_find_nth_byte_avx2,
+  scan_collect_byte_avx2,
+  scan_memchr2_avx2,
+  scan_memchr3_avx2,
+  scan_find_pair_avx2,
+  scan_ascii_prefix_avx2,
+  scan_utf8_length_avx2,
+};
+
+#endif // CPU_X86
+
+static ScanKernels g_scan = {
+  scan_count_byte_scalar,
+  scan_find_nth_byte_scalar,
+  scan_collect_byte_scalar,
+  scan_memchr2_scalar,
+  scan_memchr3_scalar,
+  scan_find_pair_scalar,
+  scan_ascii_prefix_scalar,
+  scan_utf8_length_scalar,
+};
+static CpuLevel g_scan_level = CPU_LEVEL_SCALAR;
+
+bool scan_set_level(CpuLevel level) {
+  if(!cpu_level_supported(level)) {
+    return false;
+  }
+
+  switch(level) {
+#if defined(CPU_X86)
+    case CPU_LEVEL_SSE2: {
+      g_scan = scan_kernels_sse2;
+    } break;
+    case CPU_LEVEL_AVX2: {
+      g_scan = scan_kernels_avx2;
+    } break;
+#endif
+    default: {
+      g_scan = scan_kernels_scalar;
+    } break;
+  }
+  g_scan_level = level;
+  return true;
+}
+
+CpuLevel scan_init(void) {
+  CpuLevel level = cpu_best_level();
+  scan_set_level(level);
+  return level;
+}
+
+CpuLevel scan_get_level(void) {
+  return g_scan_level;
+}
+
+u64 scan_count_byte(const u8 *bytes, u64 size, u8 byte) {
+  return g_scan.count_byte(bytes, size, byte);
+}
+
+const u8 *scan_find_nth_byte(const u8 *bytes, u64 size, u8 byte, u64 n) {
+  return g_scan.find_nth_byte(bytes, size, byte, n);
+}
+
+u64 scan_collect_byte(const u8 *bytes, u64 size, u8 byte, u64 base, u64 *offsets) {
+  return g_scan.collect_byte(bytes, size, byte, base, offsets);
+}
+
+const u8 *scan_memchr2(const u8 *bytes, u64 size, u8 a, u8 b) {
+  return g_scan.memchr2(bytes, size, a, b);
+}
+
+const u8 *scan_memchr3(const u8 *bytes, u64 size, u8 a, u8 b, u8 c) {
+  return g_scan.memchr3(bytes, size, a, b, c);
+}
+
+const u8 *scan_find_pair(const u8 *bytes, u64 size, u8 first, u8 last, u64 distance) {
+  return g_scan.find_pair(bytes, size, first, last, distance);
+}
+
+u64 scan_ascii_prefix(const u8 *bytes, u64 size) {
+  return g_scan.ascii_prefix(bytes, size);
+}
+
+u64 scan_utf8_length(const u8 *bytes, u64 size) {
+  return g_scan.utf8_length(bytes, size);
+}
+
+// NOTE: ascii runs are skipped with the simd kernel, the rest is checked one
+// sequence at a time. Rejects overlong encodings, surrogates and codepoints
+// past 0x10ffff
+bool scan_utf8_valid(const u8 *bytes, u64 size) {
+  u64 i = 0;
+  while(i < size) {
+    i += scan_ascii_prefix(bytes + i, size - i);
+    if(i >= size) {
+      break;
+    }
+
+    u8 lead = bytes[i];
+    u32 length;
+    u32 codepoint;
+    u32 smallest;
+    if(lead >= 0xc2 && lead <= 0xdf) {
+      length = 2;
+      codepoint = lead & 0x1f;
+      smallest = 0x80;
+    } else if((lead & 0xf0) == 0xe0) {
+      length = 3;
+      codepoint = lead & 0x0f;
+      smallest = 0x800;
+    } else if(lead >= 0xf0 && lead <= 0xf4) {
+      length = 4;
+      codepoint = lead & 0x07;
+      smallest = 0x10000;
+    } else {
+      return false;
+    }
+
+    if(size - i < length) {
+      return false;
+    }
+    for(u32 j = 1; j < length; j++) {
+      u8 next = bytes[i + j];
+      if((next & 0xc0) != 0x80) {
+        return false;
+      }
+      codepoint = (codepoint << 6) | (next & 0x3f);
+    }
+    if(codepoint < smallest || codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff)) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+// NOTE: ascii runs are one byte per codepoint and skipped with the simd kernel
+u64 scan_utf8_offset(const u8 *bytes, u64 size, u64 n) {
+  u64 i = 0;
+  while(n > 0 && i < size) {
+    u64 ascii = scan_ascii_prefix(bytes + i, min(n, size - i));
+    i += ascii;
+    n -= ascii;
+    if(n == 0 || i >= size) {
+      break;
+    }
+
+    // NOTE: skip the lead byte and its continuation bytes
+    i++;
+    while(i < size && (bytes[i] & 0xc0) == 0x80) {
+      i++;
+    }
+    n--;
+  }
+  return i;
+}
@@ -0,0 +1,40 @@
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include "types.h"
+#include "cpu.h"
+
+// NOTE: byte scanning kernels. Every kernel has a scalar version and, on x86-64,
+// SSE2 and AVX2 versions. The scalar ones are used until scan_init picks the
+// best level the cpu supports, call it once at startup before any thread that
+// scans is started.
+
+CpuLevel scan_init(void);
+// NOTE: forces a level, used by the benchmarks. Returns false if the cpu does
+// not support it
+bool scan_set_level(CpuLevel level);
+CpuLevel scan_get_level(void);
+
+u64 scan_count_byte(const u8 *bytes, u64 size, u8 byte);
+// NOTE: n is zero based, returns 0 when there are not enough matches
+const u8 *scan_find_nth_byte(const u8 *bytes, u64 size, u8 byte, u64 n);
+// NOTE: writes base + position of every match to offsets, returns the count
+u64 scan_collect_byte(const u8 *bytes, u64 size, u8 byte, u64 base, u64 *offsets);
+
+const u8 *scan_memchr2(const u8 *bytes, u64 size, u8 a, u8 b);
+const u8 *scan_memchr3(const u8 *bytes, u64 size, u8 a, u8 b, u8 c);
+// NOTE: first position i where bytes[i] is first and bytes[i + distance] is
+// last, the prefilter of the literal search. Returns 0 when there is none
+const u8 *scan_find_pair(const u8 *bytes, u64 size, u8 first, u8 last, u64 distance);
+
+// NOTE: number of bytes before the first one that is not ascii
+u64 scan_ascii_prefix(const u8 *bytes, u64 size);
+// NOTE: number of codepoints, every byte that is not a continuation byte
+// starts one. Only meaningful for valid utf-8
+u64 scan_utf8_length(const u8 *bytes, u64 size);
+bool scan_utf8_valid(const u8 *bytes, u64 size);
+// NOTE: byte offset of codepoint n, or size when there are fewer codepoints.
+// Only meaningful for valid utf-8
+u64 scan_utf8_offset(const u8 *bytes, u64 size, u64 n);
+
+#endif // _SCAN_H_
@@ -16,6 +16,7 @@ typedef int16_t s16;
 typedef int8_t  s8;
 
 typedef float f32;
+typedef double f64;
 
 #define array_len(array) (sizeof(array)/sizeof(array[0]))
 #define min(a, b) ((a) < (b) ? (a) : (b))
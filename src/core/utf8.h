@@ -0,0 +1,90 @@
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include "types.h"
+
+#define UTF8_REPLACEMENT 0xfffd
+
+// NOTE: returns the number of bytes written to bytes, 0 for codepoints that
+// can not be encoded (surrogates and past 0x10ffff)
+static inline u32 utf8_encode(u32 code, u8 *bytes) {
+  if(code < 0x80) {
+    bytes[0] = (u8)code;
+    return 1;
+  }
+  if(code < 0x800) {
+    bytes[0] = (u8)(0xc0 | (code >> 6));
+    bytes[1] = (u8)(0x80 | (code & 0x3f));
+    return 2;
+  }
+  if(code >= 0xd800 && code <= 0xdfff) {
+    return 0;
+  }
+  if(code < 0x10000) {
+    bytes[0] = (u8)(0xe0 | (code >> 12));
+    bytes[1] = (u8)(0x80 | ((code >> 6) & 0x3f));
+    bytes[2] = (u8)(0x80 | (code & 0x3f));
+    return 3;
+  }
+  if(code <= 0x10ffff) {
+    bytes[0] = (u8)(0xf0 | (code >> 18));
+    bytes[1] = (u8)(0x80 | ((code >> 12) & 0x3f));
+    bytes[2] = (u8)(0x80 | ((code >> 6) & 0x3f));
+    bytes[3] = (u8)(0x80 | (code & 0x3f));
+    return 4;
+  }
+  return 0;
+}
+
+// NOTE: decodes the codepoint at the start of bytes and returns its length.
+// Bytes that do not start a valid sequence decode to UTF8_REPLACEMENT and
+// take one byte, so any input can be walked with it
+static inline u32 utf8_decode(const u8 *bytes, u64 size, u32 *code) {
+  assert(size > 0);
+  u8 lead = bytes[0];
+  if(lead < 0x80) {
+    *code = lead;
+    return 1;
+  }
+
+  u32 length;
+  u32 result;
+  u32 smallest;
+  if(lead >= 0xc2 && lead <= 0xdf) {
+    length = 2;
+    result = lead & 0x1f;
+    smallest = 0x80;
+  } else if((lead & 0xf0) == 0xe0) {
+    length = 3;
+    result = lead & 0x0f;
+    smallest = 0x800;
+  } else if(lead >= 0xf0 && lead <= 0xf4) {
+    length = 4;
+    result = lead & 0x07;
+    smallest = 0x10000;
+  } else {
+    *code = UTF8_REPLACEMENT;
+    return 1;
+  }
+
+  if(size < length) {
+    *code = UTF8_REPLACEMENT;
+    return 1;
+  }
+  for(u32 i = 1; i < length; i++) {
+    if((bytes[i] & 0xc0) != 0x80) {
+      *code = UTF8_REPLACEMENT;
+      return 1;
+    }
+    result = (result << 6) | (bytes[i] & 0x3f);
+  }
+  if(result < smallest || result > 0x10ffff || (result >= 0xd800 && result <= 0xdfff)) {
+    *code = UTF8_REPLACEMENT;
+    return 1;
+  }
+
+  *code = result;
+  return length;
+}
+
+#endif // _UTF8_H_
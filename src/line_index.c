@@ -0,0 +1,191 @@
+#include "line_index.h"
+#include "os.h"
+#include "core/scan.h"
+
+#include <stdlib.h>
+
+#define LINE_INDEX_MAX_WORKERS 64
+// NOTE: below this a chunk is not worth a thread
+#define LINE_INDEX_MIN_CHUNK_SIZE (4 << 20)
+
+typedef struct LineIndexChunk LineIndexChunk;
+struct LineIndexChunk {
+	const u8 *bytes;
+	u64 start;
+	u64 end;
+
+	u64 count;
+	u64 *offsets;
+
+	// NOTE: only used by the utf-8 build, base is the codepoint offset of start
+	bool valid;
+	u64 codepoints;
+	u64 base;
+	u64 *cuts;
+	u64 cut_count;
+};
+
+static s32 line_index_count(void *data) {
+	LineIndexChunk *chunk = (LineIndexChunk *)data;
+	chunk->count = scan_count_byte(chunk->bytes + chunk->start, chunk->end - chunk->start, '\n');
+	return 0;
+}
+
+static s32 line_index_collect(void *data) {
+	LineIndexChunk *chunk = (LineIndexChunk *)data;
+	u64 count = scan_collect_byte(chunk->bytes + chunk->start, chunk->end - chunk->start, '\n',
+			chunk->start, chunk->offsets);
+	assert(count == chunk->count);
+	return 0;
+}
+
+static s32 line_index_count_utf8(void *data) {
+	LineIndexChunk *chunk = (LineIndexChunk *)data;
+	const u8 *bytes = chunk->bytes + chunk->start;
+	u64 size = chunk->end - chunk->start;
+	chunk->valid = scan_utf8_valid(bytes, size);
+	if(chunk->valid) {
+		chunk->count = scan_count_byte(bytes, size, '\n');
+		chunk->codepoints = scan_utf8_length(bytes, size);
+	}
+	return 0;
+}
+
+// NOTE: sorted byte offsets of the chunk to codepoint offsets, in place
+static void line_index_to_codepoints(LineIndexChunk *chunk, u64 *offsets, u64 count) {
+	u64 byte_offset = chunk->start;
+	u64 codepoint_offset = chunk->base;
+	for(u64 i = 0; i < count; i++) {
+		codepoint_offset += scan_utf8_length(chunk->bytes + byte_offset, offsets[i] - byte_offset);
+		byte_offset = offsets[i];
+		offsets[i] = codepoint_offset;
+	}
+}
+
+static s32 line_index_collect_utf8(void *data) {
+	LineIndexChunk *chunk = (LineIndexChunk *)data;
+	line_index_collect(chunk);
+	line_index_to_codepoints(chunk, chunk->offsets, chunk->count);
+	line_index_to_codepoints(chunk, chunk->cuts, chunk->cut_count);
+	return 0;
+}
+
+// NOTE: the first chunk runs on the calling thread
+static void line_index_run(LineIndexChunk *chunks, u32 chunk_count, OsThreadProc proc) {
+	OsThread threads[LINE_INDEX_MAX_WORKERS];
+	for(u32 i = 1; i < chunk_count; i++) {
+		threads[i] = os_thread_create(proc, &chunks[i]);
+	}
+	proc(&chunks[0]);
+	for(u32 i = 1; i < chunk_count; i++) {
+		os_thread_join(threads[i]);
+	}
+}
+
+static u32 line_index_chunk_count(u64 size) {
+	u64 max_chunks = max(size / LINE_INDEX_MIN_CHUNK_SIZE, 1);
+	return (u32)min(min((u64)os_cpu_count(), (u64)LINE_INDEX_MAX_WORKERS), max_chunks);
+}
+
+static void line_index_chunks_init(LineIndexChunk *chunks, u32 chunk_count, const u8 *bytes, u64 size) {
+	u64 chunk_size = size / chunk_count;
+	for(u32 i = 0; i < chunk_count; i++) {
+		chunks[i].bytes = bytes;
+		chunks[i].start = i * chunk_size;
+		chunks[i].end = i == chunk_count - 1 ? size : (i + 1) * chunk_size;
+		chunks[i].count = 0;
+		chunks[i].offsets = 0;
+		chunks[i].valid = true;
+		chunks[i].codepoints = 0;
+		chunks[i].base = 0;
+		chunks[i].cuts = 0;
+		chunks[i].cut_count = 0;
+	}
+}
+
+// NOTE: prefix sum of the counts gives every chunk its slice of the array
+static u64 *line_index_offsets(LineIndexChunk *chunks, u32 chunk_count, u64 *total) {
+	*total = 0;
+	for(u32 i = 0; i < chunk_count; i++) {
+		*total += chunks[i].count;
+	}
+	u64 *newline_offsets = (u64 *)malloc(max(*total, 1) * sizeof(*newline_offsets));
+	assert(newline_offsets);
+	u64 first = 0;
+	for(u32 i = 0; i < chunk_count; i++) {
+		chunks[i].offsets = newline_offsets + first;
+		first += chunks[i].count;
+	}
+	return newline_offsets;
+}
+
+void line_index_build(LineTree *tree, const u8 *bytes, u64 size) {
+	u32 chunk_count = line_index_chunk_count(size);
+	LineIndexChunk chunks[LINE_INDEX_MAX_WORKERS];
+	line_index_chunks_init(chunks, chunk_count, bytes, size);
+
+	line_index_run(chunks, chunk_count, line_index_count);
+
+	u64 total;
+	u64 *newline_offsets = line_index_offsets(chunks, chunk_count, &total);
+
+	line_index_run(chunks, chunk_count, line_index_collect);
+
+	line_tree_build(tree, newline_offsets, total);
+	tree->size = size;
+
+	free(newline_offsets);
+}
+
+bool line_index_build_utf8(LineTree *tree, const u8 *bytes, u64 size, u64 *cuts, u64 cut_count) {
+	u32 chunk_count = line_index_chunk_count(size);
+	LineIndexChunk chunks[LINE_INDEX_MAX_WORKERS];
+	line_index_chunks_init(chunks, chunk_count, bytes, size);
+
+	// NOTE: a chunk boundary moves back to the start of its codepoint, if it is
+	// not found in 3 bytes the text is not utf-8 and the next chunk fails
+	for(u32 i = 1; i < chunk_count; i++) {
+		u64 start = chunks[i].start;
+		while(chunks[i].start - start < 3 && (bytes[start] & 0xc0) == 0x80) {
+			start--;
+		}
+		if((bytes[start] & 0xc0) != 0x80) {
+			chunks[i].start = start;
+			chunks[i-1].end = start;
+		}
+	}
+
+	u64 first_cut = 0;
+	for(u32 i = 0; i < chunk_count; i++) {
+		u64 last_cut = first_cut;
+		while(last_cut < cut_count && cuts[last_cut] <= chunks[i].end) {
+			last_cut++;
+		}
+		chunks[i].cuts = cuts + first_cut;
+		chunks[i].cut_count = last_cut - first_cut;
+		first_cut = last_cut;
+	}
+	assert(first_cut == cut_count);
+
+	line_index_run(chunks, chunk_count, line_index_count_utf8);
+
+	u64 codepoints = 0;
+	for(u32 i = 0; i < chunk_count; i++) {
+		if(!chunks[i].valid) {
+			return false;
+		}
+		chunks[i].base = codepoints;
+		codepoints += chunks[i].codepoints;
+	}
+
+	u64 total;
+	u64 *newline_offsets = line_index_offsets(chunks, chunk_count, &total);
+
+	line_index_run(chunks, chunk_count, line_index_collect_utf8);
+
+	line_tree_build(tree, newline_offsets, total);
+	tree->size = codepoints;
+
+	free(newline_offsets);
+	return true;
+}
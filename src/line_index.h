@@ -0,0 +1,19 @@
+#ifndef _LINE_INDEX_H_
+#define _LINE_INDEX_H_
+
+#include "core/types.h"
+#include "core/line_tree.h"
+
+// NOTE: builds the line tree of a whole document in one go. The document is
+// split in chunks, the new lines of every chunk are counted and collected on
+// worker threads and the results are joined with a prefix sum into the sorted
+// offsets line_tree_build wants. Any previous content of the tree is dropped.
+void line_index_build(LineTree *tree, const u8 *bytes, u64 size);
+// NOTE: the same for a tree that counts codepoints. The chunks start at a
+// codepoint and the workers also validate them and count their codepoints,
+// returns false if the bytes are not utf-8. cuts are sorted byte offsets at
+// the start of codepoints (the ends of the pieces of the piece table), they
+// are converted to codepoint offsets in place
+bool line_index_build_utf8(LineTree *tree, const u8 *bytes, u64 size, u64 *cuts, u64 cut_count);
+
+#endif // _LINE_INDEX_H_
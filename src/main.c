@@ -1,116 +1,494 @@
 #include <stdlib.h>
+#include <string.h>
+
+// NOTE: the line tree can carry codepoint counts and display widths so columns
+// map to offsets without reading text, and the rows of wrapped lines. Both are
+// kept apart from the nodes, the widths are only allocated once the widest
+// line is asked for and the rows while wrapping is on
+#define LINE_TREE_METRICS
 
 #include "core/bitmap.c"
+#include "core/scan.c"
 #include "core/line_tree.c"
 #include "os_backend_sdl2.c"
 #include "font_backend_freetype.c"
 #include "render_backend_software.c"
+#include "line_index.c"
+// NOTE: the text buffer backend is selected at build time, the piece table is
+// the default and -DTEXT_BUFFER_BACKEND_UTF8, -DTEXT_BUFFER_BACKEND_GAP or
+// -DTEXT_BUFFER_BACKEND_ASCII build the others so they can be compared on the
+// same workloads
+#if defined(TEXT_BUFFER_BACKEND_GAP)
+#include "text_buffer_gap.c"
+#include "text_buffer_snapshot.c"
+#elif defined(TEXT_BUFFER_BACKEND_ASCII)
 #include "text_buffer_ascii.c"
+#include "text_buffer_snapshot.c"
+#else
+// NOTE: the utf-8 backend is the piece table counting codepoints
+#include "text_buffer_piece.c"
+#endif
+#include "text_buffer_columns.c"
+#include "text_buffer_edits.c"
+#include "undo.c"
+#include "search.c"
 
 #define WINDOW_WIDTH (1920/2)
 #define WINDOW_HEIGHT (1080/2)
 
+// NOTE: the cursor caches its index and the line it is on so moves inside a
+// line and plain typing never touch the line index. Crossing to another line
+// looks that line up once and jumps re-anchor with cursor_set_index
 typedef struct Cursor Cursor;
 struct Cursor {
 	u32 col;
 	u32 row;
 	u32 last_col;
-};
 
-u64 cursor_get_index(Cursor *cursor, TextBuffer text) {
+	u64 index;
+	u64 line_index;
 	u32 line_size;
+
+	// NOTE: the selection goes from anchor to index, it is empty when they match
+	u64 anchor;
+};
+
+static bool cursor_set_line(Cursor *cursor, TextBuffer text, u32 row, u32 col) {
 	u64 line_index;
-	assert(text_buffer_line(text, cursor->row, &line_index, &line_size));
-	assert(cursor->col <= line_size);
-	return line_index + cursor->col;
+	u32 line_size;
+	if(!text_buffer_line(text, row, &line_index, &line_size)) {
+		return false;
+	}
+	cursor->row = row;
+	cursor->col = min(col, line_size);
+	cursor->line_index = line_index;
+	cursor->line_size = line_size;
+	cursor->index = line_index + cursor->col;
+	return true;
+}
+
+void cursor_set_index(Cursor *cursor, TextBuffer text, u64 index) {
+	u32 row;
+	u64 col;
+	index = min(index, text_buffer_size(text));
+	bool found = line_tree_find_byte(text_buffer_line_tree(text), index, &row, &col);
+	assert(found);
+	cursor_set_line(cursor, text, row, (u32)col);
+	cursor->last_col = cursor->col;
+}
+
+u64 cursor_get_index(Cursor *cursor, TextBuffer text) {
+	assert(cursor->index == cursor->line_index + cursor->col);
+	assert(cursor->col <= cursor->line_size);
+	return cursor->index;
 }
 
 bool cursor_move_right(Cursor *cursor, TextBuffer text) {
-	u64 index = cursor_get_index(cursor, text);
-	u64 size = text_buffer_size(text);
-	
-	if(index < size) {
-		u32 code = text_buffer_get(text, index);
-		if(code == (u32)'\n') {
-			cursor->row++;
-			cursor->col = 0;
-		} else {
-			cursor->col++;
+	if(cursor->col < cursor->line_size) {
+		cursor->col++;
+		cursor->index++;
+	} else if(!cursor_set_line(cursor, text, cursor->row+1, 0)) {
+		return false;
+	}
+
+	cursor->last_col = cursor->col;
+	return true;
+}
+
+bool cursor_move_left(Cursor *cursor, TextBuffer text) {
+	if(cursor->col > 0) {
+		cursor->col--;
+		cursor->index--;
+	} else if(cursor->row == 0 || !cursor_set_line(cursor, text, cursor->row-1, UINT32_MAX)) {
+		return false;
+	}
+
+	cursor->last_col = cursor->col;
+	return true;
+}
+
+bool cursor_move_up(Cursor *cursor, TextBuffer text) {
+	if(cursor->row == 0) {
+		return false;
+	}
+	return cursor_set_line(cursor, text, cursor->row-1, cursor->last_col);
+}
+
+bool cursor_move_down(Cursor *cursor, TextBuffer text) {
+	return cursor_set_line(cursor, text, cursor->row+1, cursor->last_col);
+}
+
+// NOTE: inserts at the cursor and moves it past the text. size is in bytes,
+// the cursor moves by however many units the buffer grew
+void cursor_insert(Cursor *cursor, TextBuffer text, Undo *undo, u8 *bytes, u64 size) {
+	u64 old_size = text_buffer_size(text);
+	if(!undo_insert(undo, text, cursor->index, bytes, size)) {
+		return;
+	}
+	u64 count = text_buffer_size(text) - old_size;
+
+	if(memchr(bytes, '\n', size)) {
+		cursor_set_index(cursor, text, cursor->index + count);
+		return;
+	}
+	cursor->col += (u32)count;
+	cursor->index += count;
+	cursor->line_size += (u32)count;
+	cursor->last_col = cursor->col;
+}
+
+// NOTE: deletes the unit before the cursor, at the start of a line that is
+// the new line and the two lines join
+bool cursor_delete_backward(Cursor *cursor, TextBuffer text, Undo *undo) {
+	if(cursor->col > 0) {
+		if(!undo_delete(undo, text, cursor->index-1, 1)) {
+			return false;
 		}
+		cursor->col--;
+		cursor->index--;
+		cursor->line_size--;
+	} else {
+		u32 line_size = cursor->line_size;
+		if(cursor->row == 0 || !cursor_set_line(cursor, text, cursor->row-1, UINT32_MAX)) {
+			return false;
+		}
+		if(!undo_delete(undo, text, cursor->index, 1)) {
+			return false;
+		}
+		cursor->line_size += line_size;
+	}
+
+	cursor->last_col = cursor->col;
+	return true;
+}
+
+static u64 cursor_selection_start(Cursor *cursor) {
+	return min(cursor->anchor, cursor->index);
+}
+
+static u64 cursor_selection_end(Cursor *cursor) {
+	return max(cursor->anchor, cursor->index);
+}
+
+// NOTE: the cursors are kept sorted and never overlap, every input event
+// becomes one batch of edits for all of them. The last cursor is the one the
+// view follows
+typedef struct Cursors Cursors;
+struct Cursors {
+	Cursor *items;
+	u32 count;
+	u32 capacity;
+
+	TextBufferEdit *edits;
+	u32 edit_capacity;
+};
 
-		cursor->last_col = cursor->col;
-		return true;
+void cursors_add(Cursors *cursors, Cursor cursor) {
+	if(cursors->count == cursors->capacity) {
+		cursors->capacity = cursors->capacity ? cursors->capacity * 2 : 16;
+		cursors->items = (Cursor *)realloc(cursors->items, cursors->capacity * sizeof(*cursors->items));
+		assert(cursors->items);
 	}
+	cursors->items[cursors->count++] = cursor;
+}
 
-	return false;
+void cursors_destroy(Cursors *cursors) {
+	free(cursors->items);
+	free(cursors->edits);
 }
 
-bool cursor_move_left(Cursor *cursor, TextBuffer text) {
-	u64 index = cursor_get_index(cursor, text);
-	u64 size = text_buffer_size(text);
-
-	if(index > 0) {
-		if(cursor->col > 0) {
-			cursor->col--;
-		} else {
-			u64 prev_index;
-			u32 size;
-			if(text_buffer_line(text, cursor->row-1, &prev_index, &size)) {
-				cursor->col = size;
-				cursor->row--;
+static int cursor_compare(const void *a, const void *b) {
+	u64 sa = cursor_selection_start((Cursor *)a);
+	u64 sb = cursor_selection_start((Cursor *)b);
+	if(sa != sb) {
+		return sa < sb ? -1 : 1;
+	}
+	return 0;
+}
+
+// NOTE: sorts the cursors and merges the ones that overlap or sit on the same
+// index, a merged cursor selects both selections
+void cursors_normalize(Cursors *cursors, TextBuffer text) {
+	qsort(cursors->items, cursors->count, sizeof(*cursors->items), cursor_compare);
+	u32 count = 0;
+	for(u32 i = 0; i < cursors->count; i++) {
+		Cursor *cursor = &cursors->items[i];
+		if(count > 0) {
+			Cursor *prev = &cursors->items[count-1];
+			if(cursor_selection_start(cursor) < cursor_selection_end(prev) || cursor->index == prev->index) {
+				u64 start = cursor_selection_start(prev);
+				u64 end = max(cursor_selection_end(prev), cursor_selection_end(cursor));
+				cursor_set_index(prev, text, end);
+				prev->anchor = start;
+				continue;
 			}
+		}
+		cursors->items[count++] = *cursor;
+	}
+	cursors->count = count;
+}
+
+static TextBufferEdit *cursors_reserve_edits(Cursors *cursors) {
+	if(cursors->edit_capacity < cursors->count) {
+		cursors->edit_capacity = cursors->capacity;
+		cursors->edits = (TextBufferEdit *)realloc(cursors->edits, cursors->edit_capacity * sizeof(*cursors->edits));
+		assert(cursors->edits);
+	}
+	return cursors->edits;
+}
+
+// NOTE: moves every cursor to the end of its edit, the edits are in cursor
+// order and each one inserted units units
+static void cursors_shift(Cursors *cursors, TextBuffer text, u64 units) {
+	s64 shift = 0;
+	for(u32 i = 0; i < cursors->count; i++) {
+		TextBufferEdit *edit = &cursors->edits[i];
+		u64 edit_units = edit->size ? units : 0;
+		Cursor *cursor = &cursors->items[i];
+		cursor_set_index(cursor, text, (u64)((s64)edit->index + shift) + edit_units);
+		cursor->anchor = cursor->index;
+		shift += (s64)edit_units - (s64)edit->count;
+	}
+	cursors_normalize(cursors, text);
+}
 
+// NOTE: replaces every selection with the bytes, or inserts them at every
+// cursor
+void cursors_insert(Cursors *cursors, TextBuffer text, Undo *undo, u8 *bytes, u64 size) {
+	Cursor *first = &cursors->items[0];
+	if(cursors->count == 1 && first->anchor == first->index) {
+		cursor_insert(first, text, undo, bytes, size);
+		first->anchor = first->index;
+		return;
+	}
+
+	TextBufferEdit *edits = cursors_reserve_edits(cursors);
+	u64 deleted = 0;
+	for(u32 i = 0; i < cursors->count; i++) {
+		Cursor *cursor = &cursors->items[i];
+		edits[i].index = cursor_selection_start(cursor);
+		edits[i].count = cursor_selection_end(cursor) - edits[i].index;
+		edits[i].bytes = bytes;
+		edits[i].size = size;
+		deleted += edits[i].count;
+	}
+
+	// NOTE: the size grows by codepoints in the utf-8 backend
+	u64 old_size = text_buffer_size(text);
+	if(!undo_apply_edits(undo, text, edits, cursors->count)) {
+		return;
+	}
+	u64 units = (text_buffer_size(text) + deleted - old_size) / cursors->count;
+	cursors_shift(cursors, text, units);
+}
+
+// NOTE: deletes every selection, or the unit before every cursor without one
+void cursors_delete_backward(Cursors *cursors, TextBuffer text, Undo *undo) {
+	Cursor *first = &cursors->items[0];
+	if(cursors->count == 1 && first->anchor == first->index) {
+		cursor_delete_backward(first, text, undo);
+		first->anchor = first->index;
+		return;
+	}
+
+	TextBufferEdit *edits = cursors_reserve_edits(cursors);
+	u64 end = 0;
+	for(u32 i = 0; i < cursors->count; i++) {
+		Cursor *cursor = &cursors->items[i];
+		u64 start = cursor_selection_start(cursor);
+		u64 count = cursor_selection_end(cursor) - start;
+		// NOTE: a cursor right after the selection of the previous one has
+		// nothing left to delete
+		if(count == 0 && start > end) {
+			start--;
+			count = 1;
 		}
+		edits[i].index = start;
+		edits[i].count = count;
+		edits[i].bytes = 0;
+		edits[i].size = 0;
+		end = start + count;
+	}
 
-		cursor->last_col = cursor->col;
-		return true;
+	if(!undo_apply_edits(undo, text, edits, cursors->count)) {
+		return;
 	}
-	
-	return false;
+	cursors_shift(cursors, text, 0);
 }
 
-bool cursor_move_up(Cursor *cursor, TextBuffer text) {
-	if(cursor->row == 0) {
-		return false;
+typedef bool (*CursorMove)(Cursor *cursor, TextBuffer text);
+
+// NOTE: with select the anchor stays and the selection grows
+void cursors_move(Cursors *cursors, TextBuffer text, CursorMove move, bool select) {
+	for(u32 i = 0; i < cursors->count; i++) {
+		Cursor *cursor = &cursors->items[i];
+		move(cursor, text);
+		if(!select) {
+			cursor->anchor = cursor->index;
+		}
 	}
+	cursors_normalize(cursors, text);
+}
 
-	u64 index;
-	u32 size;
-	if(!text_buffer_line(text, cursor->row-1, &index, &size)) {
-		return false;
+// NOTE: adds a cursor one line below the last one or above the first one
+void cursors_add_vertical(Cursors *cursors, TextBuffer text, bool down) {
+	Cursor cursor = down ? cursors->items[cursors->count-1] : cursors->items[0];
+	bool moved = down ? cursor_move_down(&cursor, text) : cursor_move_up(&cursor, text);
+	if(moved) {
+		cursor.anchor = cursor.index;
+		cursors_add(cursors, cursor);
+		cursors_normalize(cursors, text);
 	}
-	
-	cursor->row--;
-	cursor->col = min(cursor->last_col, size);
+}
 
-	return true;
+// NOTE: underlines the selected columns of every visible row, glyphs paint
+// their own background so the selection can not go behind them
+static void render_selection(TextBuffer text, Cursor *cursor, u64 first_row, u32 visible_rows,
+                             s32 x, s32 y, s32 ma, s32 lh) {
+	u32 wrap_columns = text_buffer_wrap_columns(text);
+	u64 start = cursor_selection_start(cursor);
+	u64 end = cursor_selection_end(cursor);
+	u32 start_line;
+	u32 end_line;
+	u64 start_col;
+	u64 end_col;
+	LineTree *lines = text_buffer_line_tree(text);
+	line_tree_find_byte(lines, start, &start_line, &start_col);
+	line_tree_find_byte(lines, end, &end_line, &end_col);
+
+	// NOTE: lines above the view are not walked
+	u32 first_line;
+	u32 first_line_row;
+	if(text_buffer_find_row(text, first_row, &first_line, &first_line_row) && first_line > start_line) {
+		start_line = first_line;
+		start_col = 0;
+	}
+
+	for(u32 line = start_line; line <= end_line; line++) {
+		u64 index;
+		u32 size;
+		if(!text_buffer_line(text, line, &index, &size)) {
+			break;
+		}
+		u32 line_start_column;
+		u32 line_end_column;
+		u64 row = text_buffer_row_from_offset(text, line, line == start_line ? start_col : 0, &line_start_column);
+		u64 last_row = text_buffer_row_from_offset(text, line, line == end_line ? end_col : size, &line_end_column);
+		if(row >= first_row + visible_rows) {
+			break;
+		}
+		for(; row <= last_row; row++) {
+			u32 from = line_start_column;
+			u32 to = row == last_row ? line_end_column : wrap_columns;
+			if(row >= first_row && row < first_row + visible_rows && to > from) {
+				render_rect(x + (s32)from * ma, y + (s32)(row - first_row) * lh, (s32)(to - from) * ma, 2, 0x4080ff);
+			}
+			line_start_column = 0;
+		}
+	}
 }
 
-bool cursor_move_down(Cursor *cursor, TextBuffer text) {
-	u64 index;
-	u32 size;
-	if(!text_buffer_line(text, cursor->row+1, &index, &size)) {
-		return false;
+// NOTE: Ctrl+F looks for the selection of the last cursor and Ctrl+Shift+F
+// takes it as a regex, pressing it again on the match it selected goes to the
+// next one. The search runs SEARCH_FRAME_BUDGET bytes per frame and wraps
+// around the end of the buffer once
+typedef struct Finder Finder;
+struct Finder {
+	Search search;
+	bool ready;
+	bool running;
+	bool wrapped;
+	bool matched;
+	SearchMatch match;
+};
+
+static void finder_start(Finder *finder, Cursors *cursors, TextBuffer text, SearchMode mode) {
+	Cursor *cursor = &cursors->items[cursors->count-1];
+	u64 start = cursor_selection_start(cursor);
+	u64 end = cursor_selection_end(cursor);
+	bool next = finder->ready && finder->search.mode == mode &&
+		(start == end || (finder->matched && start == finder->match.index && end == finder->match.index + finder->match.count));
+	if(!next) {
+		if(start == end) {
+			return;
+		}
+		// NOTE: the selection is in units, the pattern is its bytes
+		u64 size = 0;
+		TextBufferChunks chunks;
+		text_buffer_chunks_begin(&chunks, text, start, end - start);
+		while(text_buffer_chunks_next(&chunks)) {
+			size += chunks.size;
+		}
+		u8 *pattern = (u8 *)malloc(size);
+		assert(pattern);
+		size = 0;
+		text_buffer_chunks_begin(&chunks, text, start, end - start);
+		while(text_buffer_chunks_next(&chunks)) {
+			memcpy(pattern + size, chunks.data, chunks.size);
+			size += chunks.size;
+		}
+		if(finder->ready) {
+			search_destroy(&finder->search);
+		}
+		finder->ready = search_init(&finder->search, pattern, size, mode);
+		free(pattern);
+		if(!finder->ready) {
+			return;
+		}
 	}
-	
-	cursor->row++;
-	cursor->col = min(cursor->last_col, size);
+	search_begin(&finder->search, end);
+	finder->running = true;
+	finder->wrapped = end == 0;
+	finder->matched = false;
+}
 
-	return true;
+// NOTE: positions are stale after an edit, the next search starts over
+static void finder_cancel(Finder *finder) {
+	finder->running = false;
+	finder->matched = false;
+}
+
+static void finder_step(Finder *finder, Cursors *cursors, TextBuffer text) {
+	if(!finder->running) {
+		return;
+	}
+	switch(search_step(&finder->search, text, SEARCH_FRAME_BUDGET, &finder->match)) {
+		case SEARCH_FOUND: {
+			Cursor cursor = {0};
+			cursor_set_index(&cursor, text, finder->match.index + finder->match.count);
+			cursor.anchor = finder->match.index;
+			cursors->items[0] = cursor;
+			cursors->count = 1;
+			finder->running = false;
+			finder->matched = true;
+		} break;
+		case SEARCH_PENDING: {} break;
+		case SEARCH_DONE: {
+			if(finder->wrapped) {
+				finder->running = false;
+			} else {
+				search_begin(&finder->search, 0);
+				finder->wrapped = true;
+			}
+		} break;
+	}
+}
+
+static void finder_destroy(Finder *finder) {
+	if(finder->ready) {
+		search_destroy(&finder->search);
+	}
+	memset(finder, 0, sizeof(*finder));
 }
 
 static void load_line_tree_from_file(LineTree *tree, char *path) {
-  OsFile file = os_read_file(path);
-  char *scan = (char *)file.data;
-  u32 offset = 0;
-  while(*scan) {
-    if(*scan == '\n') {
-      line_tree_insert(tree, offset);
-    }
-    scan++;
-    offset++;
+  OsFile file;
+  if(!os_map_file(path, &file)) {
+    return;
   }
-  free(file.data);
+  os_advise_file(&file, 0, file.size, OS_FILE_ADVICE_SEQUENTIAL);
+  line_index_build(tree, file.data, file.size);
+  os_unmap_file(&file);
 }
 
 int main_(void) {
@@ -122,6 +500,7 @@ int main_(void) {
 	window_def.flags  = 0;
 	
 	os_init(window_def, 60);
+	scan_init();
 	font_init();
 	render_init();
 
@@ -129,6 +508,7 @@ int main_(void) {
 			"/usr/share/fonts/truetype/liberation/LiberationMono-Regular.ttf", 15);
   
   LineTree tree;
+  line_tree_init(&tree);
   load_line_tree_from_file(&tree, "./test.txt");
   
 	u32 bg = 0x000000;
@@ -176,6 +556,7 @@ int main(void) {
 	window_def.flags  = 0;
 	
 	os_init(window_def, 60);
+	scan_init();
 	font_init();
 	render_init();
 	
@@ -188,24 +569,38 @@ int main(void) {
 	u32 bg = 0x000000;
 	u32 fg = 0xffffff;
 	
-	Cursor cursor;
-	TextBuffer text = text_buffer_create();
-
-  LineTree tree;
-  line_tree_init(&tree);
+	Cursors cursors = {0};
+	Undo undo;
+	undo_init(&undo, UNDO_MEMORY_LIMIT);
+	Finder finder = {0};
+	// NOTE: the view starts at row scroll_row of line scroll_line
+	u32 scroll_line = 0;
+	u32 scroll_row = 0;
+	s32 window_width = WINDOW_WIDTH;
+	s32 window_height = WINDOW_HEIGHT;
+	s32 x = 10;
+	s32 y = lh;
+	// NOTE: F1 shows the line tree for debugging, drawing it walks every node
+	// each frame so it is off by default
+	bool show_line_tree = false;
 
 // NOTE: loading test
 
-  // OsFile file = os_read_file("./src/core/line_tree.h");
-  OsFile file = os_read_file("./test.txt");
-  for(u64 i = 0;  i < file.size; i++) {
-    text_buffer_insert(text, i, (u32)file.data[i]);
-    if(file.data[i] == '\n') {
-      line_tree_insert(&tree, i);
-    } else {
-      line_tree_propagate_increment_at_byte(&tree, i, 1);
-    }
+  // NOTE: the mapping has to outlive the text buffer, the piece table reads
+  // the original text straight from it
+  OsFile file = {0};
+  if(os_map_file("./test.txt", &file)) {
+    os_advise_file(&file, 0, file.size, OS_FILE_ADVICE_SEQUENTIAL);
   }
+  TextBuffer text = text_buffer_create_from_bytes(file.data, file.size);
+  if(!text) {
+    text = text_buffer_create();
+  }
+  os_advise_file(&file, 0, file.size, OS_FILE_ADVICE_NORMAL);
+  text_buffer_set_wrap_columns(text, (u32)max((window_width - x) / ma, 1));
+  Cursor cursor = {0};
+  cursor_set_index(&cursor, text, 0);
+  cursors_add(&cursors, cursor);
 
 //////////////////////////////
 
@@ -221,77 +616,143 @@ int main(void) {
 				} break;
 				case OS_EVENT_WINDOW_RESIZE: {
 					render_resize(event.window.width, event.window.height);
+					window_width = event.window.width;
+					window_height = event.window.height;
+					text_buffer_set_wrap_columns(text, (u32)max((window_width - x) / ma, 1));
 				} break;
 				case OS_EVENT_TEXT: {
-					for(u32 i = 0; i < event.text.size; i++) {
-						u64 index = cursor_get_index(&cursor, text);
-						text_buffer_insert(text, index, (u32)event.text.data[i]);
-            line_tree_propagate_increment_at_byte(&tree, index, 1);
-						cursor_move_right(&cursor, text);
-					}
+					finder_cancel(&finder);
+					cursors_insert(&cursors, text, &undo, (u8 *)event.text.data, event.text.size);
 				} break;
 				case OS_EVENT_KEYDOWN: {
+					bool select = (event.key.mods & OS_KEY_MOD_SHIFT) != 0;
+					bool add_cursor = (event.key.mods & OS_KEY_MOD_CTRL) && (event.key.mods & OS_KEY_MOD_ALT);
+					bool ctrl = (event.key.mods & OS_KEY_MOD_CTRL) != 0;
+					if(event.key.code != OS_KEY_UNKNOW && event.key.code != OS_KEY_F1 &&
+					   !(ctrl && event.key.code == OS_KEY_F)) {
+						finder_cancel(&finder);
+					}
+					// NOTE: moving the cursor ends the current run of typing
+					if(event.key.code == OS_KEY_RIGHT || event.key.code == OS_KEY_LEFT ||
+					   event.key.code == OS_KEY_UP || event.key.code == OS_KEY_DOWN) {
+						undo_seal(&undo);
+					}
 					if(event.key.code == OS_KEY_ENTER) {
-						u64 index = cursor_get_index(&cursor, text);
-						text_buffer_insert(text, index, (u32)'\n');
-            line_tree_insert(&tree, index);
-						cursor_move_right(&cursor, text);
+						cursors_insert(&cursors, text, &undo, (u8 *)"\n", 1);
 					}	
 					if(event.key.code == OS_KEY_BACKSPACE) {
-						if(cursor_move_left(&cursor, text)) {
-							u64 index = cursor_get_index(&cursor, text);
-              u32 code = text_buffer_get(text, index);
-              text_buffer_delete(text, index);
-              
-              if(code == (u32)'\n') {
-                assert(line_tree_delete(&tree, index));
-              } else {
-                line_tree_propagate_decrement_at_byte(&tree, index, 1);
-              } 
-						
-            }
+						cursors_delete_backward(&cursors, text, &undo);
 					}	
 					if(event.key.code == OS_KEY_RIGHT) {
-						cursor_move_right(&cursor, text);
+						cursors_move(&cursors, text, cursor_move_right, select);
 					}	
 					if(event.key.code == OS_KEY_LEFT) {
-						cursor_move_left(&cursor, text);
+						cursors_move(&cursors, text, cursor_move_left, select);
 					}	
 					if(event.key.code == OS_KEY_UP) {
-						cursor_move_up(&cursor, text);
+						if(add_cursor) {
+							cursors_add_vertical(&cursors, text, false);
+						} else {
+							cursors_move(&cursors, text, cursor_move_up, select);
+						}
 					}	
 					if(event.key.code == OS_KEY_DOWN) {
-						cursor_move_down(&cursor, text);
+						if(add_cursor) {
+							cursors_add_vertical(&cursors, text, true);
+						} else {
+							cursors_move(&cursors, text, cursor_move_down, select);
+						}
 					}	
 					if(event.key.code == OS_KEY_TAB) {
-						u64 index = cursor_get_index(&cursor, text);
-						text_buffer_insert(text, index, (u32)' ');
-						text_buffer_insert(text, index+1, (u32)' ');
-						cursor_move_right(&cursor, text);
-						cursor_move_right(&cursor, text);
-            line_tree_propagate_increment_at_byte(&tree, index, 2);
+						cursors_insert(&cursors, text, &undo, (u8 *)"  ", 2);
+					}	
+					if(ctrl && (event.key.code == OS_KEY_Z || event.key.code == OS_KEY_Y)) {
+						u64 index;
+						bool redo = event.key.code == OS_KEY_Y || (event.key.mods & OS_KEY_MOD_SHIFT);
+						if(redo ? undo_redo(&undo, text, &index) : undo_undo(&undo, text, &index)) {
+							Cursor cursor = {0};
+							cursor_set_index(&cursor, text, index);
+							cursor.anchor = cursor.index;
+							cursors.items[0] = cursor;
+							cursors.count = 1;
+						}
+					}	
+					if(ctrl && event.key.code == OS_KEY_F) {
+						finder_start(&finder, &cursors, text, select ? SEARCH_REGEX : SEARCH_LITERAL);
+					}	
+					if(event.key.code == OS_KEY_F1) {
+						show_line_tree = !show_line_tree;
+					}	
+					if(event.key.code == OS_KEY_SCAPE) {
+						// NOTE: back to one cursor without selection
+						Cursor *last = &cursors.items[cursors.count-1];
+						last->anchor = last->index;
+						cursors.items[0] = *last;
+						cursors.count = 1;
 					}	
 				} break;
 				default: {} break;
 			}
   	}
 
+		finder_step(&finder, &cursors, text);
+
 		render_clear(bg);
 
-    line_tree_draw(600, 50, font, &tree);
+		if(show_line_tree) {
+			line_tree_draw(600, 50, font, text_buffer_line_tree(text));
+		}
 		
-		int x = 10;
-		int y = lh;
-		render_text_buffer(font, text, x, y, fg, bg);
+		// NOTE: keep the last cursor inside the visible rows. Only the lines on
+		// screen are re-wrapped, rows above them may still be estimates but
+		// both rows come from the same tree so they compare fine
+		Cursor *cursor = &cursors.items[cursors.count-1];
+		u32 visible_rows = (u32)max(window_height / lh - 1, 1);
+		text_buffer_wrap_lines(text, scroll_line, visible_rows);
+		u32 cursor_column;
+		u64 cursor_row = text_buffer_row_from_offset(text, cursor->row, cursor->col, &cursor_column);
+		u64 first_row = text_buffer_line_row(text, scroll_line) + scroll_row;
+		if(cursor_row < first_row) {
+			first_row = cursor_row;
+		}
+		if(cursor_row >= first_row + visible_rows) {
+			first_row = cursor_row - visible_rows + 1;
+		}
+		if(!text_buffer_find_row(text, first_row, &scroll_line, &scroll_row)) {
+			scroll_line = cursor->row;
+			scroll_row = 0;
+		}
+		text_buffer_wrap_lines(text, scroll_line, visible_rows);
+
+		render_text_buffer(font, text, scroll_line, scroll_row, x, y, fg, bg);
 
-		render_rect(x+(cursor.col*ma), (y-metrics.ascender)+(cursor.row*lh), 2, lh, 0x00ff00);
+		// NOTE: the last visible line is at most visible_rows lines below the
+		// first one, cursors outside of them are skipped without a lookup
+		first_row = text_buffer_line_row(text, scroll_line) + scroll_row;
+		for(u32 i = 0; i < cursors.count; i++) {
+			Cursor *c = &cursors.items[i];
+			if(c->row < scroll_line || c->row > scroll_line + visible_rows) {
+				continue;
+			}
+			cursor_row = text_buffer_row_from_offset(text, c->row, c->col, &cursor_column);
+			if(cursor_row >= first_row && cursor_row < first_row + visible_rows) {
+				render_rect(x+(cursor_column*ma), (y-metrics.ascender)+((s32)(cursor_row-first_row)*lh), 2, lh, 0x00ff00);
+			}
+			if(c->anchor != c->index) {
+				render_selection(text, c, first_row, visible_rows, x, y - metrics.ascender + lh - 2, ma, lh);
+			}
+		}
 
 		render_flush();
 
 		os_frame_end();
 	}
 
+	cursors_destroy(&cursors);
+	finder_destroy(&finder);
+	undo_destroy(&undo);
 	text_buffer_destroy(text);
+	os_unmap_file(&file);
 	render_font_destroy(font);
 
 	render_shutdown();
@@ -3,6 +3,9 @@
 
 typedef void * OsWindow;
 typedef void * OsSurface;
+typedef void * OsThread;
+
+typedef s32 (*OsThreadProc)(void *data);
 
 typedef enum OsEventType OsEventType;
 enum OsEventType {
@@ -32,6 +35,10 @@ enum OsKeyCode {
 	OS_KEY_LEFT,
 	OS_KEY_UP,
 	OS_KEY_DOWN,
+	OS_KEY_Z,
+	OS_KEY_Y,
+	OS_KEY_F,
+	OS_KEY_F1,
 	OS_KEY_UNKNOW,
 };
 
@@ -47,9 +54,17 @@ struct OsEventText {
 	u32 size;
 };
 
+typedef enum OsKeyMod OsKeyMod;
+enum OsKeyMod {
+	OS_KEY_MOD_SHIFT = 1 << 0,
+	OS_KEY_MOD_CTRL  = 1 << 1,
+	OS_KEY_MOD_ALT   = 1 << 2,
+};
+
 typedef struct OsEventKey OsEventKey;
 struct OsEventKey {
 	OsKeyCode code;
+	u32 mods;
 };
 
 typedef struct OsEvent OsEvent;
@@ -76,6 +91,14 @@ struct OsFile {
   u64 size;
 };
 
+typedef enum OsFileAdvice OsFileAdvice;
+enum OsFileAdvice {
+  OS_FILE_ADVICE_NORMAL,
+  OS_FILE_ADVICE_SEQUENTIAL,
+  OS_FILE_ADVICE_RANDOM,
+  OS_FILE_ADVICE_WILLNEED,
+};
+
 void os_init(OsWindowDef window_def, u32 fps);
 void os_shutdown(void);
 
@@ -95,7 +118,16 @@ OsSurface os_surface_create(u32 *pixels, u32 width, u32 height);
 void os_surface_destroy(OsSurface surface);
 void os_surface_blit(OsSurface dst, OsSurface src);
 
-OsFile os_read_file(char *path);
+// NOTE: os_read_file copies the file into memory that must be released with
+// free, os_map_file maps it read only and pages are loaded when touched
+bool os_read_file(char *path, OsFile *file);
+bool os_map_file(char *path, OsFile *file);
+void os_unmap_file(OsFile *file);
+void os_advise_file(OsFile *file, u64 offset, u64 size, OsFileAdvice advice);
+
+u32 os_cpu_count(void);
+OsThread os_thread_create(OsThreadProc proc, void *data);
+void os_thread_join(OsThread thread);
 
 
 #endif // _OS_H_
@@ -1,6 +1,10 @@
 #include <SDL2/SDL.h>
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "string.h"
 #include "os.h"
@@ -105,10 +109,32 @@ bool os_event_poll(OsEvent *event) {
 				event->key.code = OS_KEY_DOWN;
 			} else if(sym == SDLK_TAB) {
 				event->key.code = OS_KEY_TAB;
+			} else if(sym == SDLK_ESCAPE) {
+				event->key.code = OS_KEY_SCAPE;
+			} else if(sym == SDLK_z) {
+				event->key.code = OS_KEY_Z;
+			} else if(sym == SDLK_y) {
+				event->key.code = OS_KEY_Y;
+			} else if(sym == SDLK_f) {
+				event->key.code = OS_KEY_F;
+			} else if(sym == SDLK_F1) {
+				event->key.code = OS_KEY_F1;
 			} else {
 				event->key.code = OS_KEY_UNKNOW;
 			}
 
+			u16 mod = e.key.keysym.mod;
+			event->key.mods = 0;
+			if(mod & KMOD_SHIFT) {
+				event->key.mods |= OS_KEY_MOD_SHIFT;
+			}
+			if(mod & KMOD_CTRL) {
+				event->key.mods |= OS_KEY_MOD_CTRL;
+			}
+			if(mod & KMOD_ALT) {
+				event->key.mods |= OS_KEY_MOD_ALT;
+			}
+
 		} break;
 		default: { 
 			event->type = OS_EVENT_UNKNOW;
@@ -174,23 +200,122 @@ void os_surface_blit(OsSurface dst, OsSurface src) {
 	SDL_BlitSurface((SDL_Surface *)src, 0, (SDL_Surface *)dst, 0);
 }
 
-OsFile os_read_file(char *path) {
-    OsFile resutl;
-    
-    FILE *file = fopen(path, "rb");
-    assert(file);
+bool os_read_file(char *path, OsFile *file) {
+    file->data = 0;
+    file->size = 0;
+
+    FILE *handle = fopen(path, "rb");
+    if(!handle) {
+        return false;
+    }
+
+    if(fseeko(handle, 0, SEEK_END) != 0) {
+        fclose(handle);
+        return false;
+    }
+    off_t size = ftello(handle);
+    if(size < 0 || fseeko(handle, 0, SEEK_SET) != 0) {
+        fclose(handle);
+        return false;
+    }
+
+    u8 *data = (u8 *)malloc((u64)size + 1);
+    if(!data) {
+        fclose(handle);
+        return false;
+    }
+
+    if(fread(data, 1, (u64)size, handle) != (u64)size) {
+        free(data);
+        fclose(handle);
+        return false;
+    }
+    data[size] = '\0';
+
+    fclose(handle);
+
+    file->data = data;
+    file->size = (u64)size;
+    return true;
+}
+
+bool os_map_file(char *path, OsFile *file) {
+    file->data = 0;
+    file->size = 0;
 
-    fseek(file, 0, SEEK_END);
-    u32 size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
 
-    resutl.data = (u8 *)malloc(size + 1);
-    resutl.size = size;
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
 
-    fread(resutl.data, resutl.size, 1, file);
-    resutl.data[resutl.size] = '\0';
+    // NOTE: mmap fails on empty files, an empty mapping is still a valid file
+    if(st.st_size > 0) {
+        void *data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        file->data = (u8 *)data;
+        file->size = (u64)st.st_size;
+    }
 
-    fclose(file);
+    // NOTE: the mapping keeps the file alive after the descriptor is closed
+    close(fd);
+    return true;
+}
+
+void os_unmap_file(OsFile *file) {
+    if(file->data) {
+        munmap(file->data, (size_t)file->size);
+    }
+    file->data = 0;
+    file->size = 0;
+}
+
+void os_advise_file(OsFile *file, u64 offset, u64 size, OsFileAdvice advice) {
+    if(!file->data || offset >= file->size) {
+        return;
+    }
+
+    // NOTE: madvise wants a page aligned address
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 start = offset & ~(page_size - 1);
+    u64 end = min(offset + size, file->size);
+
+    int flags = MADV_NORMAL;
+    switch(advice) {
+        case OS_FILE_ADVICE_NORMAL: {
+            flags = MADV_NORMAL;
+        } break;
+        case OS_FILE_ADVICE_SEQUENTIAL: {
+            flags = MADV_SEQUENTIAL;
+        } break;
+        case OS_FILE_ADVICE_RANDOM: {
+            flags = MADV_RANDOM;
+        } break;
+        case OS_FILE_ADVICE_WILLNEED: {
+            flags = MADV_WILLNEED;
+        } break;
+    }
+    madvise(file->data + start, (size_t)(end - start), flags);
+}
+
+u32 os_cpu_count(void) {
+    return (u32)max(SDL_GetCPUCount(), 1);
+}
+
+OsThread os_thread_create(OsThreadProc proc, void *data) {
+    SDL_Thread *thread = SDL_CreateThread(proc, "babl worker", data);
+    assert(thread);
+    return (OsThread)thread;
+}
 
-    return resutl;
+void os_thread_join(OsThread thread) {
+    SDL_WaitThread((SDL_Thread *)thread, 0);
 }
@@ -7,6 +7,17 @@ typedef struct TextBuffer * TextBuffer;
 typedef struct RenderFont * RenderFont;
 struct FontMetrics;
 
+// NOTE: glyphs are rasterized on first use and cached in one atlas for every
+// font, these count how the cache is doing since render_init
+typedef struct RenderGlyphStats RenderGlyphStats;
+struct RenderGlyphStats {
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+	u32 glyphs;
+	u32 atlas_bytes;
+};
+
 void render_init(void);
 void render_shutdown(void);
 
@@ -16,11 +27,12 @@ void render_flush(void);
 
 void render_rect(s32 x, s32 y, s32 width, s32 height, u32 color);
 void render_text(RenderFont rf, char *text, s32 x, s32 y, u32 fg, u32 bg);
-void render_text_buffer(RenderFont rf, TextBuffer tb, s32 x, s32 y, u32 fg, u32 bg);
+void render_text_buffer(RenderFont rf, TextBuffer tb, u32 first_line, u32 first_row, s32 x, s32 y, u32 fg, u32 bg);
 void render_line(s32 x0, s32 y0, s32 x1, s32 y1, u32 color);
 
 RenderFont render_font_create(char *path, u32 size);
 void render_font_destroy(RenderFont font);
 void render_font_get_metrics(RenderFont rf, struct FontMetrics *metrics);
+void render_get_glyph_stats(RenderGlyphStats *stats);
 
 #endif // _RENDER_H_
@@ -4,19 +4,99 @@
 #include "text_buffer.h"
 
 #include "core/bitmap.h"
+#include "core/utf8.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+// NOTE: glyphs are packed in shelves of one 8 bit atlas shared by every
+// font. A glyph goes on the lowest shelf that fits it without wasting more
+// than a quarter of the shelf height, otherwise a new shelf opens under the
+// last one. The atlas starts small and doubles its height up to max_height,
+// the pitch never changes so the glyphs already in it keep their place. The
+// rects of evicted glyphs are kept and given to new glyphs that fit them
+#define RENDER_ATLAS_WIDTH 512
+#define RENDER_ATLAS_HEIGHT 64
+// NOTE: glyphs are rasterized here before going to the atlas, bigger glyphs
+// are cut
+#define RENDER_GLYPH_MAX_SIZE 128
+
+// NOTE: glyphs are rasterized the first time they are drawn and kept until
+// the atlas bytes reach the budget or the table is full, then the least
+// recently used glyphs are evicted. The size has to be a power of two and
+// the budget has to fit the biggest glyph
+#define RENDER_GLYPH_CACHE_BUDGET (1 << 20)
+#define RENDER_GLYPH_CACHE_SIZE 8192
+#define RENDER_GLYPH_NONE 0xffffffff
+
+typedef struct RenderShelf RenderShelf;
+struct RenderShelf {
+	u32 y;
+	u32 height;
+	// NOTE: where the next glyph of the shelf goes
+	u32 x;
+};
+
+typedef struct RenderSlot RenderSlot;
+struct RenderSlot {
+	u16 x;
+	u16 y;
+	u16 width;
+	u16 height;
+};
+
+typedef struct RenderAtlas RenderAtlas;
+struct RenderAtlas {
+	BitmapU8 bitmap;
+	u32 max_height;
+	RenderShelf *shelves;
+	u32 shelf_count;
+	u32 shelf_capacity;
+	// NOTE: first row under the last shelf
+	u32 bottom;
+	RenderSlot *slots;
+	u32 slot_count;
+	u32 slot_capacity;
+};
+
+// NOTE: a cached glyph, where it is in the atlas and the metrics needed to
+// draw it
 typedef struct RenderGlyph RenderGlyph;
 struct RenderGlyph {
-	BitmapU8 bitmap;
-	GlyphMetrics metrics;
+	Font *font;
+	u32 size;
+	u32 codepoint;
+	u32 hash;
+	// NOTE: neighbours in the lru list, the most recently used glyph is first.
+	// Free glyphs are linked with next
+	u32 prev;
+	u32 next;
+	RenderSlot slot;
+	u16 width;
+	u16 height;
+	s16 bearing_x;
+	s16 bearing_y;
+	s16 advance;
+};
+
+typedef struct RenderGlyphCache RenderGlyphCache;
+struct RenderGlyphCache {
+	RenderAtlas atlas;
+	RenderGlyph *glyphs;
+	u32 glyph_count;
+	u32 free_glyph;
+	u32 first;
+	u32 last;
+	// NOTE: open addressing with linear probing, entries are glyph indices
+	u32 *table;
+	u32 table_capacity;
+	u8 *scratch;
+	RenderGlyphStats stats;
 };
 
 struct RenderFont {
 	Font *font;
-	RenderGlyph glyphs[256];
+	u32 size;
 };
 
 typedef struct RenderSoft RenderSoft;
@@ -25,35 +105,351 @@ struct RenderSoft {
 	OsSurface window_surface;
 	OsSurface surface;
 	BitmapU32 backbuffer;
+	RenderGlyphCache glyphs;
 };
 
 RenderSoft g_render_soft;
 
+static void render_atlas_create(RenderAtlas *atlas, u32 max_height) {
+	memset(atlas, 0, sizeof(*atlas));
+	atlas->max_height = max_height;
+	BitmapU8 *bitmap = &atlas->bitmap;
+	bitmap->width = RENDER_ATLAS_WIDTH;
+	bitmap->height = RENDER_ATLAS_HEIGHT;
+	bitmap->pitch = bitmap->width;
+	u32 size = bitmap->width*bitmap->height;
+	bitmap->buffer = (u8 *)malloc(size);
+	assert(bitmap->buffer);
+	memset(bitmap->buffer, 0, size);
+}
+
+static void render_atlas_destroy(RenderAtlas *atlas) {
+	free(atlas->bitmap.buffer);
+	free(atlas->shelves);
+	free(atlas->slots);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+static void render_atlas_grow(RenderAtlas *atlas, u32 height) {
+	BitmapU8 *bitmap = &atlas->bitmap;
+	u32 new_height = bitmap->height;
+	while(new_height < height) {
+		new_height *= 2;
+	}
+	new_height = min(new_height, atlas->max_height);
+	if(new_height <= bitmap->height) {
+		return;
+	}
+	u32 old_size = bitmap->pitch*bitmap->height;
+	u32 new_size = bitmap->pitch*new_height;
+	u8 *buffer = (u8 *)realloc(bitmap->buffer, new_size);
+	assert(buffer);
+	memset(buffer + old_size, 0, new_size - old_size);
+	bitmap->buffer = buffer;
+	bitmap->height = new_height;
+}
+
+// NOTE: finds room for a width x height glyph, returns false if the atlas is
+// at max_height and nothing fits
+static bool render_atlas_alloc(RenderAtlas *atlas, u32 width, u32 height, RenderSlot *result) {
+	assert(width <= atlas->bitmap.width);
+
+	u32 best_slot = RENDER_GLYPH_NONE;
+	for(u32 i = 0; i < atlas->slot_count; i++) {
+		RenderSlot *slot = &atlas->slots[i];
+		if(slot->width < width || slot->height < height || slot->height - height > slot->height / 4) {
+			continue;
+		}
+		if(best_slot == RENDER_GLYPH_NONE ||
+		   slot->width * slot->height < atlas->slots[best_slot].width * atlas->slots[best_slot].height) {
+			best_slot = i;
+		}
+	}
+	if(best_slot != RENDER_GLYPH_NONE) {
+		*result = atlas->slots[best_slot];
+		atlas->slots[best_slot] = atlas->slots[--atlas->slot_count];
+		return true;
+	}
+
+	RenderShelf *best = 0;
+	for(u32 i = 0; i < atlas->shelf_count; i++) {
+		RenderShelf *shelf = &atlas->shelves[i];
+		if(shelf->height < height || shelf->height - height > shelf->height / 4 ||
+		   shelf->x + width > atlas->bitmap.width) {
+			continue;
+		}
+		if(!best || shelf->height < best->height) {
+			best = shelf;
+		}
+	}
+
+	if(!best) {
+		if(atlas->bottom + height > atlas->max_height) {
+			return false;
+		}
+		if(atlas->shelf_count == atlas->shelf_capacity) {
+			atlas->shelf_capacity = atlas->shelf_capacity ? atlas->shelf_capacity * 2 : 16;
+			atlas->shelves = (RenderShelf *)realloc(atlas->shelves, atlas->shelf_capacity * sizeof(RenderShelf));
+			assert(atlas->shelves);
+		}
+		render_atlas_grow(atlas, atlas->bottom + height);
+		best = &atlas->shelves[atlas->shelf_count++];
+		best->y = atlas->bottom;
+		best->height = height;
+		best->x = 0;
+		atlas->bottom += height;
+	}
+
+	result->x = (u16)best->x;
+	result->y = (u16)best->y;
+	result->width = (u16)width;
+	result->height = (u16)height;
+	best->x += width;
+	return true;
+}
+
+static void render_atlas_free(RenderAtlas *atlas, RenderSlot slot) {
+	if(atlas->slot_count == atlas->slot_capacity) {
+		atlas->slot_capacity = atlas->slot_capacity ? atlas->slot_capacity * 2 : 64;
+		atlas->slots = (RenderSlot *)realloc(atlas->slots, atlas->slot_capacity * sizeof(RenderSlot));
+		assert(atlas->slots);
+	}
+	atlas->slots[atlas->slot_count++] = slot;
+}
+
+// NOTE: forgets every shelf and slot, only called when no glyph is cached
+static void render_atlas_reset(RenderAtlas *atlas) {
+	atlas->shelf_count = 0;
+	atlas->slot_count = 0;
+	atlas->bottom = 0;
+}
+
+static void render_glyph_cache_create(RenderGlyphCache *cache) {
+	assert((RENDER_GLYPH_CACHE_SIZE & (RENDER_GLYPH_CACHE_SIZE - 1)) == 0);
+	assert(RENDER_GLYPH_CACHE_BUDGET / RENDER_ATLAS_WIDTH >= RENDER_GLYPH_MAX_SIZE);
+	memset(cache, 0, sizeof(*cache));
+	render_atlas_create(&cache->atlas, RENDER_GLYPH_CACHE_BUDGET / RENDER_ATLAS_WIDTH);
+	cache->glyphs = (RenderGlyph *)malloc(RENDER_GLYPH_CACHE_SIZE * sizeof(RenderGlyph));
+	cache->table_capacity = RENDER_GLYPH_CACHE_SIZE * 2;
+	cache->table = (u32 *)malloc(cache->table_capacity * sizeof(u32));
+	cache->scratch = (u8 *)malloc(RENDER_GLYPH_MAX_SIZE*RENDER_GLYPH_MAX_SIZE);
+	assert(cache->glyphs && cache->table && cache->scratch);
+	memset(cache->table, 0xff, cache->table_capacity * sizeof(u32));
+	cache->free_glyph = RENDER_GLYPH_NONE;
+	cache->first = RENDER_GLYPH_NONE;
+	cache->last = RENDER_GLYPH_NONE;
+}
+
+static void render_glyph_cache_destroy(RenderGlyphCache *cache) {
+	render_atlas_destroy(&cache->atlas);
+	free(cache->glyphs);
+	free(cache->table);
+	free(cache->scratch);
+	memset(cache, 0, sizeof(*cache));
+}
+
+static u32 render_glyph_hash(Font *font, u32 size, u32 codepoint) {
+	u64 pointer = (u64)(uintptr_t)font;
+	u32 hash = 2166136261u;
+	hash = (hash ^ (u32)pointer) * 16777619u;
+	hash = (hash ^ (u32)(pointer >> 32)) * 16777619u;
+	hash = (hash ^ size) * 16777619u;
+	hash = (hash ^ codepoint) * 16777619u;
+	return hash ^ (hash >> 15);
+}
+
+static void render_glyph_unlink(RenderGlyphCache *cache, u32 index) {
+	RenderGlyph *glyph = &cache->glyphs[index];
+	if(glyph->prev != RENDER_GLYPH_NONE) {
+		cache->glyphs[glyph->prev].next = glyph->next;
+	} else {
+		cache->first = glyph->next;
+	}
+	if(glyph->next != RENDER_GLYPH_NONE) {
+		cache->glyphs[glyph->next].prev = glyph->prev;
+	} else {
+		cache->last = glyph->prev;
+	}
+}
+
+static void render_glyph_push_front(RenderGlyphCache *cache, u32 index) {
+	RenderGlyph *glyph = &cache->glyphs[index];
+	glyph->prev = RENDER_GLYPH_NONE;
+	glyph->next = cache->first;
+	if(cache->first != RENDER_GLYPH_NONE) {
+		cache->glyphs[cache->first].prev = index;
+	} else {
+		cache->last = index;
+	}
+	cache->first = index;
+}
+
+// NOTE: empties the table slot of the glyph and moves back the glyphs after
+// it that probed past it, so lookups never need tombstones
+static void render_glyph_table_remove(RenderGlyphCache *cache, u32 index) {
+	u32 mask = cache->table_capacity - 1;
+	u32 slot = cache->glyphs[index].hash & mask;
+	while(cache->table[slot] != index) {
+		slot = (slot + 1) & mask;
+	}
+	u32 hole = slot;
+	for(;;) {
+		slot = (slot + 1) & mask;
+		u32 other = cache->table[slot];
+		if(other == RENDER_GLYPH_NONE) {
+			break;
+		}
+		u32 home = cache->glyphs[other].hash & mask;
+		if(((slot - home) & mask) >= ((slot - hole) & mask)) {
+			cache->table[hole] = other;
+			hole = slot;
+		}
+	}
+	cache->table[hole] = RENDER_GLYPH_NONE;
+}
+
+static void render_glyph_remove(RenderGlyphCache *cache, u32 index) {
+	RenderGlyph *glyph = &cache->glyphs[index];
+	render_glyph_unlink(cache, index);
+	render_glyph_table_remove(cache, index);
+	if(glyph->slot.width && glyph->slot.height) {
+		render_atlas_free(&cache->atlas, glyph->slot);
+	}
+	glyph->font = 0;
+	glyph->next = cache->free_glyph;
+	cache->free_glyph = index;
+	cache->stats.glyphs--;
+}
+
+static bool render_glyph_evict(RenderGlyphCache *cache) {
+	if(cache->last == RENDER_GLYPH_NONE) {
+		return false;
+	}
+	render_glyph_remove(cache, cache->last);
+	cache->stats.evictions++;
+	return true;
+}
+
+static u32 render_glyph_add(RenderGlyphCache *cache, RenderFont rf, u32 codepoint, u32 hash) {
+	u8 *scratch = cache->scratch;
+	memset(scratch, 0, RENDER_GLYPH_MAX_SIZE*RENDER_GLYPH_MAX_SIZE);
+	GlyphMetrics metrics;
+	font_glyph_rasterize(rf->font, codepoint, scratch, RENDER_GLYPH_MAX_SIZE, RENDER_GLYPH_MAX_SIZE, &metrics);
+	u32 width = (u32)min(max(metrics.width, 0), RENDER_GLYPH_MAX_SIZE);
+	u32 height = (u32)min(max(metrics.height, 0), RENDER_GLYPH_MAX_SIZE);
+
+	if(cache->free_glyph == RENDER_GLYPH_NONE && cache->glyph_count == RENDER_GLYPH_CACHE_SIZE) {
+		render_glyph_evict(cache);
+	}
+	u32 index;
+	if(cache->free_glyph != RENDER_GLYPH_NONE) {
+		index = cache->free_glyph;
+		cache->free_glyph = cache->glyphs[index].next;
+	} else {
+		index = cache->glyph_count++;
+	}
+
+	RenderSlot slot = {0};
+	if(width && height) {
+		while(!render_atlas_alloc(&cache->atlas, width, height, &slot)) {
+			if(!render_glyph_evict(cache)) {
+				// NOTE: the free rects left have the wrong shapes, start over
+				render_atlas_reset(&cache->atlas);
+				bool fits = render_atlas_alloc(&cache->atlas, width, height, &slot);
+				assert(fits);
+				break;
+			}
+		}
+
+		BitmapU8 src;
+		src.width = width;
+		src.height = height;
+		src.pitch = RENDER_GLYPH_MAX_SIZE;
+		src.buffer = scratch;
+		Rect dst_rect = (Rect){slot.x, slot.y, slot.x + width - 1, slot.y + height - 1};
+		bitmap_u8_blit_u8(&cache->atlas.bitmap, &src, &dst_rect);
+	}
+
+	RenderGlyph *glyph = &cache->glyphs[index];
+	glyph->font = rf->font;
+	glyph->size = rf->size;
+	glyph->codepoint = codepoint;
+	glyph->hash = hash;
+	glyph->slot = slot;
+	glyph->width = (u16)width;
+	glyph->height = (u16)height;
+	glyph->bearing_x = (s16)metrics.bearing_x;
+	glyph->bearing_y = (s16)metrics.bearing_y;
+	glyph->advance = (s16)metrics.advance;
+	render_glyph_push_front(cache, index);
+
+	u32 mask = cache->table_capacity - 1;
+	u32 table_slot = hash & mask;
+	while(cache->table[table_slot] != RENDER_GLYPH_NONE) {
+		table_slot = (table_slot + 1) & mask;
+	}
+	cache->table[table_slot] = index;
+	cache->stats.glyphs++;
+	return index;
+}
+
+// NOTE: returns the glyph of codepoint, rasterizing it if it is not cached.
+// Control codes have no glyph and return 0. The glyph is only valid until
+// the next call
+static RenderGlyph *render_glyph_get(RenderFont rf, u32 codepoint) {
+	if(codepoint < 32 || (codepoint >= 127 && codepoint < 160)) {
+		return 0;
+	}
+
+	RenderGlyphCache *cache = &g_render_soft.glyphs;
+	u32 hash = render_glyph_hash(rf->font, rf->size, codepoint);
+	u32 mask = cache->table_capacity - 1;
+	u32 slot = hash & mask;
+	while(cache->table[slot] != RENDER_GLYPH_NONE) {
+		u32 index = cache->table[slot];
+		RenderGlyph *glyph = &cache->glyphs[index];
+		if(glyph->hash == hash && glyph->font == rf->font && glyph->size == rf->size &&
+		   glyph->codepoint == codepoint) {
+			if(cache->first != index) {
+				render_glyph_unlink(cache, index);
+				render_glyph_push_front(cache, index);
+			}
+			cache->stats.hits++;
+			return glyph;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	cache->stats.misses++;
+	return &cache->glyphs[render_glyph_add(cache, rf, codepoint, hash)];
+}
+
+void render_get_glyph_stats(RenderGlyphStats *stats) {
+	RenderGlyphCache *cache = &g_render_soft.glyphs;
+	*stats = cache->stats;
+	stats->atlas_bytes = cache->atlas.bitmap.pitch*cache->atlas.bitmap.height;
+}
+
 RenderFont render_font_create(char *path, u32 size) {
 	RenderFont rf = (RenderFont)malloc(sizeof(*rf));
+	memset(rf, 0, sizeof(*rf));
 
 	rf->font = font_create(path, size);
-	for(u32 code = 32; code < 128; code++) {
-		RenderGlyph *glyph = &rf->glyphs[code];
-		BitmapU8 *bitmap = &glyph->bitmap;
-		bitmap->width = 64;
-		bitmap->height = 64;
-		bitmap->pitch = bitmap->width;
-		u32 size = bitmap->width*bitmap->height;
-		bitmap->buffer = (u8 *)malloc(size);
-		memset(bitmap->buffer, 0, size);
-		font_glyph_rasterize(rf->font, code, bitmap->buffer, bitmap->width, bitmap->height, &glyph->metrics);
-	}
+	rf->size = size;
 	
 	return rf;
 }
 
 void render_font_destroy(RenderFont rf) {
-	for(u32 code = 32; code < 128; code++) {
-		u8 *buffer = rf->glyphs[code].bitmap.buffer;
-		if(buffer) {
-			free(buffer);
+	// NOTE: a new font could get the same address, its glyphs have to go
+	RenderGlyphCache *cache = &g_render_soft.glyphs;
+	u32 index = cache->first;
+	while(index != RENDER_GLYPH_NONE) {
+		u32 next = cache->glyphs[index].next;
+		if(cache->glyphs[index].font == rf->font) {
+			render_glyph_remove(cache, index);
 		}
+		index = next;
 	}
 	font_destroy(rf->font);
 	free(rf);
@@ -99,9 +495,11 @@ void render_init() {
 			g_render_soft.backbuffer.width,	
 			g_render_soft.backbuffer.height);
 
+	render_glyph_cache_create(&g_render_soft.glyphs);
 }
 
 void render_shutdown(void) {
+	render_glyph_cache_destroy(&g_render_soft.glyphs);
 	os_surface_destroy(g_render_soft.surface);
 	backbuffer_destroy(&g_render_soft.backbuffer);
 }
@@ -130,22 +528,22 @@ void render_flush(void) {
 }
 
 void render_glyph(RenderGlyph *glyph, s32 x, s32 y, u32 fg, u32 bg) {
-	if(!glyph->bitmap.buffer) {
+	if(glyph->width == 0 || glyph->height == 0) {
 		return;
 	}
 
-	Rect gr = (Rect){0, 0, glyph->metrics.width-1, glyph->metrics.height-1};
+	Rect gr = (Rect){0, 0, glyph->width-1, glyph->height-1};
 	Rect dr = rect_translate(gr, x, y);
 	Rect clip = bitmap_u32_get_rect(&g_render_soft.backbuffer);
 	clip = rect_intersection(clip, dr);
 	
-	BitmapU8 *src = &glyph->bitmap;
+	BitmapU8 *src = &g_render_soft.glyphs.atlas.bitmap;
 	BitmapU32 *dst = &g_render_soft.backbuffer; 
 
-	s32 src_y = clip.top - dr.top; 
+	s32 src_y = glyph->slot.y + clip.top - dr.top; 
 	s32 dst_y = clip.top;
 	while(dst_y <= clip.bottom) {
-		u8 *src_ptr = src->buffer + src_y * src->pitch + (clip.left - dr.left);
+		u8 *src_ptr = src->buffer + src_y * src->pitch + glyph->slot.x + (clip.left - dr.left);
 		u32 *dst_ptr = dst->buffer + dst_y * dst->width + clip.left;	
 
 		s32 width = clip.right - clip.left + 1;
@@ -167,48 +565,97 @@ void render_glyph(RenderGlyph *glyph, s32 x, s32 y, u32 fg, u32 bg) {
 
 void render_text(RenderFont rf, char *text, s32 x, s32 y, u32 fg, u32 bg) {
 	s32 pos = x;
-	while(*text) {
-		u32 code = (u32)*text++;
+	u64 size = strlen(text);
+	u64 i = 0;
+	while(i < size) {
+		u32 code;
+		i += utf8_decode((u8 *)text + i, size - i, &code);
 		
-		if(code >= array_len(rf->glyphs)) {
+		RenderGlyph *glyph = render_glyph_get(rf, code);
+		if(!glyph) {
 			continue;
 		}
+		render_glyph(glyph, pos + glyph->bearing_x, y - glyph->bearing_y, fg, bg);
 		
-		RenderGlyph *glyph = &rf->glyphs[code];
-		render_glyph(glyph, pos + glyph->metrics.bearing_x, y - glyph->metrics.bearing_y, fg, bg);
-		
-		pos += glyph->metrics.advance;
+		pos += glyph->advance;
 	}
 	
 }
 
-void render_text_buffer(RenderFont rf, TextBuffer tb, s32 x, s32 y, u32 fg, u32 bg) {
+// NOTE: only the lines that fit in the backbuffer are drawn, the line tree
+// takes us straight to first_line so the cost depends on the window size and
+// not on the size of the document
+// NOTE: glyphs sit on a grid of max_advance columns. With soft wrap on, the
+// glyph at column c of a line goes in row c / wrap_columns, the same rule the
+// line tree uses to count rows. first_row skips rows of the first line
+void render_text_buffer(RenderFont rf, TextBuffer tb, u32 first_line, u32 first_row, s32 x, s32 y, u32 fg, u32 bg) {
 	FontMetrics metrics;
 	render_font_get_metrics(rf, &metrics);
+
+	BitmapU32 *dst = &g_render_soft.backbuffer;
+	u32 wrap_columns = text_buffer_wrap_columns(tb);
 	
-	u64 size = text_buffer_size(tb);
-	
-	s32 pos_x = x;
 	s32 pos_y = y;
-	for(u64 i = 0; i < size; i++) {
-
-		u32 code = text_buffer_get(tb, i);
-		
-		if(code >= array_len(rf->glyphs)) {
-			continue;
+	u32 skip_rows = first_row;
+	for(u32 line = first_line; pos_y - metrics.ascender < (s32)dst->height; line++) {
+		u64 index;
+		u32 size;
+		if(!text_buffer_line(tb, line, &index, &size)) {
+			break;
 		}
-		
-		if(code == (u32)'\n') {
-			pos_y += metrics.height;
-			pos_x = x;
-			continue;
+
+		// NOTE: y of the first row of the line, it can be above y
+		s32 line_y = pos_y - (s32)skip_rows * metrics.height;
+		bool visible = true;
+		u32 column = 0;
+		TextBufferChunks chunks;
+		text_buffer_chunks_begin(&chunks, tb, index, size);
+		while(visible && text_buffer_chunks_next(&chunks)) {
+			u64 i = 0;
+			while(i < chunks.size) {
+				u32 code;
+				i += utf8_decode(chunks.data + i, chunks.size - i, &code);
+				
+				u32 glyph_column = column;
+				if(code == (u32)'\t') {
+					column = (column / TEXT_BUFFER_TAB_WIDTH + 1) * TEXT_BUFFER_TAB_WIDTH;
+					continue;
+				}
+				column++;
+				if(code < 32) {
+					continue;
+				}
+
+				u32 row = 0;
+				if(wrap_columns) {
+					row = glyph_column / wrap_columns;
+					glyph_column -= row * wrap_columns;
+				}
+				if(row < skip_rows) {
+					continue;
+				}
+				s32 pos_x = x + (s32)glyph_column * metrics.max_advance;
+				s32 glyph_y = line_y + (s32)row * metrics.height;
+				if(glyph_y - metrics.ascender >= (s32)dst->height ||
+				   (!wrap_columns && pos_x >= (s32)dst->width)) {
+					visible = false;
+					break;
+				}
+
+				RenderGlyph *glyph = render_glyph_get(rf, code);
+				if(!glyph) {
+					continue;
+				}
+				render_glyph(glyph, pos_x + glyph->bearing_x, glyph_y - glyph->bearing_y, fg, bg);
+			}
 		}
-		
-		RenderGlyph *glyph = &rf->glyphs[code];
-		render_glyph(glyph, pos_x + glyph->metrics.bearing_x, pos_y - glyph->metrics.bearing_y, fg, bg);
-		
-		pos_x += glyph->metrics.advance;
 
+		u32 rows = 1;
+		if(wrap_columns && column > 0) {
+			rows = (column - 1) / wrap_columns + 1;
+		}
+		pos_y = line_y + (s32)max(rows, skip_rows) * metrics.height;
+		skip_rows = 0;
 	}
 }
 
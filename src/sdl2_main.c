@@ -4,27 +4,93 @@
 #include <stdbool.h>
 
 #include "babl.h"
+#include "blend.h"
+
+// NOTE: scaled draws gather this many source pixels at a time and blend them
+// with the same kernels as the unscaled ones
+#define SDL2_BLEND_ROW 256
+
+typedef enum Sdl2PresentMode Sdl2PresentMode;
+enum Sdl2PresentMode {
+  // NOTE: draws straight into the locked streaming texture
+  SDL2_PRESENT_DIRECT,
+  // NOTE: draws into a malloc'd backbuffer and uploads the damaged rects,
+  // used when the texture can not be locked or with --present-copy
+  SDL2_PRESENT_COPY,
+};
+
+Sdl2PresentMode present_mode;
+bool present_locked;
 
+// NOTE: the pixels being drawn, backbuffer_x and backbuffer_y are the screen
+// position of the first one. They are not 0 when only a rect of the texture
+// is locked and the pitch is the one the texture gives
 unsigned char *backbuffer;
 int backbuffer_w;
 int backbuffer_h;
+int backbuffer_pitch;
+int backbuffer_x;
+int backbuffer_y;
 BablRect clipping;
+BablRect user_clipping;
+
+// NOTE: redraw are the rects invalidated for this frame, every draw call runs
+// once per rect with the clip narrowed to it. upload are the rects the draw
+// calls wrote, only they are copied to the texture. Rects invalidated while
+// the texture is locked wait in pending for the next frame
+BablDamage redraw;
+BablDamage upload;
+BablDamage pending;
+
+static u32 *sdl2_pixel(s32 x, s32 y) {
+  return (u32 *)(backbuffer + (y - backbuffer_y) * backbuffer_pitch) + (x - backbuffer_x);
+}
+
+static BablRect sdl2_screen_rect(void) {
+  BablRect r;
+  r.left = 0;
+  r.top = 0;
+  r.right = backbuffer_w;
+  r.bottom = backbuffer_h;
+  return r;
+}
+
+static bool sdl2_clip_damage(u32 index) {
+  clipping = babl_rect_intersection(user_clipping, redraw.rects[index]);
+  return !babl_rect_empty(clipping);
+}
+
+void sdl2_invalidate(BablRect *rect) {
+  BablRect r = sdl2_screen_rect();
+  if(rect) {
+    r = babl_rect_intersection(r, *rect);
+  }
+  babl_damage_add(present_locked ? &pending : &redraw, r);
+}
 
 void sdl2_clear(u32 color) {
+  for(u32 i = 0; i < redraw.count; ++i) {
+    BablRect r = redraw.rects[i];
+    s32 width = babl_rect_width(r);
+    for(s32 y = r.top; y < r.bottom; ++y) {
+      u32 *dst_ptr = sdl2_pixel(r.left, y);
+      for(s32 x = 0; x < width; ++x) {
+        *dst_ptr++ = color;
+      }
+    }
+    babl_damage_add(&upload, r);
+  }
 }
 
 void sdl2_set_clip(BablRect *clip) {
   if(clip) {
-    clipping = *clip;
+    user_clipping = *clip;
   } else {
-    clipping.left = 0;
-    clipping.top = 0;
-    clipping.right = backbuffer_w;
-    clipping.bottom = backbuffer_h;
+    user_clipping = sdl2_screen_rect();
   }
 }
 
-void sdl2_draw_line(s32 x0, s32 y0, s32 x1, s32 y1, u32 color) {
+static void sdl2_draw_line_clipped(s32 x0, s32 y0, s32 x1, s32 y1, u32 color) {
   s32 dx = abs(x1 - x0);
   s32 sx = x0 < x1 ? 1 : -1;
   s32 dy = -abs(y1 - y0);
@@ -33,7 +99,7 @@ void sdl2_draw_line(s32 x0, s32 y0, s32 x1, s32 y1, u32 color) {
   while (1) {
     if (x0 >= clipping.left && x0 < clipping.right && 
         y0 >= clipping.top && y0 < clipping.bottom) {
-      ((u32 *)backbuffer)[y0 * backbuffer_w + x0] = color;
+      *sdl2_pixel(x0, y0) = color;
     }
     if (x0 == x1 && y0 == y1) break;
       s32 e2 = 2 * err;
@@ -48,22 +114,47 @@ void sdl2_draw_line(s32 x0, s32 y0, s32 x1, s32 y1, u32 color) {
   }
 }
 
-void sdl2_draw_rect(s32 x, s32 y, s32 width, s32 height, u32 color) {
+void sdl2_draw_line(s32 x0, s32 y0, s32 x1, s32 y1, u32 color) {
+  BablRect bounds;
+  bounds.left = min(x0, x1);
+  bounds.top = min(y0, y1);
+  bounds.right = max(x0, x1) + 1;
+  bounds.bottom = max(y0, y1) + 1;
+  for(u32 i = 0; i < redraw.count; ++i) {
+    if(sdl2_clip_damage(i)) {
+      sdl2_draw_line_clipped(x0, y0, x1, y1, color);
+      babl_damage_add(&upload, babl_rect_intersection(clipping, bounds));
+    }
+  }
+}
+
+// NOTE: right and bottom are exclusive as in every other rect, drawing them
+// would spill out of the damaged rect
+static void sdl2_draw_rect_clipped(s32 x, s32 y, s32 width, s32 height, u32 color) {
   BablRect dr;
   dr.left = x;
   dr.right = x + width;
   dr.top = y;
   dr.bottom = y + height;
   BablRect clip = babl_rect_intersection(clipping, dr);
-	u32 dst_y = clip.top;
-	while(dst_y <= clip.bottom) {
-		u32 *dst_ptr = (u32 *)backbuffer + dst_y * backbuffer_w + clip.left;
-		s32 width = clip.right - clip.left + 1;
+	s32 dst_y = clip.top;
+	while(dst_y < clip.bottom) {
+		u32 *dst_ptr = sdl2_pixel(clip.left, dst_y);
+		s32 width = clip.right - clip.left;
 		for(s32 i = 0; i < width; i++) {
 			*dst_ptr++ = color;
 		}
 		dst_y++;
 	}
+  babl_damage_add(&upload, clip);
+}
+
+void sdl2_draw_rect(s32 x, s32 y, s32 width, s32 height, u32 color) {
+  for(u32 i = 0; i < redraw.count; ++i) {
+    if(sdl2_clip_damage(i)) {
+      sdl2_draw_rect_clipped(x, y, width, height, color);
+    }
+  }
 }
 
 struct BablTextureU32 {
@@ -109,7 +200,7 @@ void sdl2_update_texture_u32(BablTextureU32 *texture, BablRect *dst, u32 *pixels
   }
 }
 
-void sdl2_draw_texture_u32(BablTextureU32 *texture, BablRect *src, BablRect *dst) {
+static void sdl2_draw_texture_u32_clipped(BablTextureU32 *texture, BablRect *src, BablRect *dst) {
   BablRect ur;
   ur.left = 0;
   ur.top = 0;
@@ -142,35 +233,41 @@ void sdl2_draw_texture_u32(BablTextureU32 *texture, BablRect *src, BablRect *dst
   u32 src_step_y_fixed = (src_h << 16) / dst_h;
   u32 src_row_fixed = (tr.top << 16) + (offset_y * src_step_y_fixed);
   u32 src_start_x_fixed = (tr.left << 16) + (offset_x * src_step_x_fixed);
-  u32 dst_row = ur.top;
-  u32 dst_start_x = ur.left;
-  for(u32 y = ur.top; y < ur.bottom; ++y) {
-    u32 src_x_fixed = src_start_x_fixed;
+  if(babl_rect_empty(ur)) {
+    return;
+  }
+  u32 count = ur.right - ur.left;
+  u32 row[SDL2_BLEND_ROW];
+  for(s32 y = ur.top; y < ur.bottom; ++y) {
     u32 *src_y_ptr = texture->pixels + (src_row_fixed >> 16) * texture->width;
-    u32 *dst_ptr = (u32 *)backbuffer + dst_row * backbuffer_w + dst_start_x;
-    for(u32 x = ur.left; x < ur.right; ++x) {
-      u32 *src_ptr = src_y_ptr + (src_x_fixed >> 16);
-      u32 s = *src_ptr;
-      u32 d = *dst_ptr;
-      u32 a = (s >> 24) & 0xff;
-      u32 src_r = (s >> 16) & 0xff;
-      u32 src_g = (s >> 8) & 0xff;
-      u32 src_b = (s >> 0) & 0xff;
-      u32 dst_r = (d >> 16) & 0xff;
-      u32 dst_g = (d >> 8) & 0xff;
-      u32 dst_b = (d >> 0) & 0xff;
-			u32 inv = 255 - a;
-			u32 r = (dst_r * inv + src_r * a) >> 8;
-			u32 g = (dst_g * inv + src_g * a) >> 8;
-			u32 b = (dst_b * inv + src_b * a) >> 8;
-			*dst_ptr++ = (0xff << 24) | (r << 16) | (g << 8) | b;
-      src_x_fixed += src_step_x_fixed;
+    u32 *dst_ptr = sdl2_pixel(ur.left, y);
+    if(src_step_x_fixed == 1 << 16) {
+      blend_row_u32(dst_ptr, src_y_ptr + (src_start_x_fixed >> 16), count);
+    } else {
+      u32 src_x_fixed = src_start_x_fixed;
+      for(u32 x = 0; x < count; x += SDL2_BLEND_ROW) {
+        u32 run = min(count - x, SDL2_BLEND_ROW);
+        for(u32 i = 0; i < run; ++i) {
+          row[i] = src_y_ptr[src_x_fixed >> 16];
+          src_x_fixed += src_step_x_fixed;
+        }
+        blend_row_u32(dst_ptr + x, row, run);
+      }
     }
-    dst_row++;
     src_row_fixed += src_step_y_fixed;
   }
 }
 
+void sdl2_draw_texture_u32(BablTextureU32 *texture, BablRect *src, BablRect *dst) {
+  BablRect bounds = dst ? *dst : sdl2_screen_rect();
+  for(u32 i = 0; i < redraw.count; ++i) {
+    if(sdl2_clip_damage(i)) {
+      sdl2_draw_texture_u32_clipped(texture, src, dst);
+      babl_damage_add(&upload, babl_rect_intersection(clipping, bounds));
+    }
+  }
+}
+
 struct BablTextureU8 {
   u8 *pixels;
   u32 width;
@@ -214,7 +311,7 @@ void sdl2_update_texture_u8(BablTextureU8 *texture, BablRect *dst, u8 *pixels, s
   }
 }
 
-void sdl2_draw_texture_u8(BablTextureU8 *texture, BablRect *src, BablRect *dst, u32 color) {
+static void sdl2_draw_texture_u8_clipped(BablTextureU8 *texture, BablRect *src, BablRect *dst, u32 color) {
   BablRect ur;
   ur.left = 0;
   ur.top = 0;
@@ -247,40 +344,111 @@ void sdl2_draw_texture_u8(BablTextureU8 *texture, BablRect *src, BablRect *dst,
   u32 src_step_y_fixed = (src_h << 16) / dst_h;
   u32 src_row_fixed = (tr.top << 16) + (offset_y * src_step_y_fixed);
   u32 src_start_x_fixed = (tr.left << 16) + (offset_x * src_step_x_fixed);
-  u32 dst_row = ur.top;
-  u32 dst_start_x = ur.left;
-  u32 src_r = (color >> 16) & 0xff;
-  u32 src_g = (color >> 8) & 0xff;
-  u32 src_b = (color >> 0) & 0xff;
-  for(u32 y = ur.top; y < ur.bottom; ++y) {
-    u32 src_x_fixed = src_start_x_fixed;
+  if(babl_rect_empty(ur)) {
+    return;
+  }
+  u32 count = ur.right - ur.left;
+  u8 row[SDL2_BLEND_ROW];
+  for(s32 y = ur.top; y < ur.bottom; ++y) {
     u8 *src_y_ptr = texture->pixels + (src_row_fixed >> 16) * texture->width;
-    u32 *dst_ptr = (u32 *)backbuffer + dst_row * backbuffer_w + dst_start_x;
-    for(u32 x = ur.left; x < ur.right; ++x) {
-      u8 *src_ptr = src_y_ptr + (src_x_fixed >> 16);
-      u32 a = (u32)*src_ptr;
-      u32 d = *dst_ptr;
-      u32 dst_r = (d >> 16) & 0xff;
-      u32 dst_g = (d >> 8) & 0xff;
-      u32 dst_b = (d >> 0) & 0xff;
-			u32 inv = 255 - a;
-      u32 r = (dst_r * inv + src_r * a) >> 8;
-			u32 g = (dst_g * inv + src_g * a) >> 8;
-			u32 b = (dst_b * inv + src_b * a) >> 8;
-			*dst_ptr++ = (0xff << 24) | (r << 16) | (g << 8) | b;
-      src_x_fixed += src_step_x_fixed;
+    u32 *dst_ptr = sdl2_pixel(ur.left, y);
+    if(src_step_x_fixed == 1 << 16) {
+      blend_row_u8(dst_ptr, src_y_ptr + (src_start_x_fixed >> 16), count, color);
+    } else {
+      u32 src_x_fixed = src_start_x_fixed;
+      for(u32 x = 0; x < count; x += SDL2_BLEND_ROW) {
+        u32 run = min(count - x, SDL2_BLEND_ROW);
+        for(u32 i = 0; i < run; ++i) {
+          row[i] = src_y_ptr[src_x_fixed >> 16];
+          src_x_fixed += src_step_x_fixed;
+        }
+        blend_row_u8(dst_ptr + x, row, run, color);
+      }
     }
-    dst_row++;
     src_row_fixed += src_step_y_fixed;
   }
 }
 
+void sdl2_draw_texture_u8(BablTextureU8 *texture, BablRect *src, BablRect *dst, u32 color) {
+  BablRect bounds = dst ? *dst : sdl2_screen_rect();
+  for(u32 i = 0; i < redraw.count; ++i) {
+    if(sdl2_clip_damage(i)) {
+      sdl2_draw_texture_u8_clipped(texture, src, dst, color);
+      babl_damage_add(&upload, babl_rect_intersection(clipping, bounds));
+    }
+  }
+}
+
+static bool sdl2_alloc_backbuffer(void) {
+  backbuffer = realloc(backbuffer, backbuffer_w*backbuffer_h*sizeof(u32));
+  backbuffer_pitch = backbuffer_w*sizeof(u32);
+  backbuffer_x = 0;
+  backbuffer_y = 0;
+  return backbuffer != NULL;
+}
+
+// NOTE: the locked pixels may not hold the last frame, the damaged rects
+// become their bounding box and all of it is redrawn. Returns false if the
+// texture can not be locked
+static bool sdl2_present_direct(BablCtx *babl, SDL_Texture *texture) {
+  if(redraw.count == 0) {
+    present_locked = true;
+    babl_update_and_render(babl);
+    present_locked = false;
+    return true;
+  }
+  BablRect bounds = redraw.rects[0];
+  for(u32 i = 1; i < redraw.count; ++i) {
+    bounds = babl_rect_union(bounds, redraw.rects[i]);
+  }
+  SDL_Rect rect;
+  rect.x = bounds.left;
+  rect.y = bounds.top;
+  rect.w = babl_rect_width(bounds);
+  rect.h = babl_rect_height(bounds);
+  void *pixels;
+  int pitch;
+  if(SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0) {
+    return false;
+  }
+  babl_damage_clear(&redraw);
+  babl_damage_add(&redraw, bounds);
+  backbuffer = pixels;
+  backbuffer_pitch = pitch;
+  backbuffer_x = bounds.left;
+  backbuffer_y = bounds.top;
+
+  present_locked = true;
+  babl_update_and_render(babl);
+  present_locked = false;
+
+  SDL_UnlockTexture(texture);
+  backbuffer = NULL;
+  return true;
+}
+
+// NOTE: the texture keeps the pixels of earlier frames, only what was drawn
+// this frame is uploaded. A frame without damage uploads nothing
+static void sdl2_present_copy(BablCtx *babl, SDL_Texture *texture) {
+  babl_update_and_render(babl);
+  for(u32 i = 0; i < upload.count; ++i) {
+    BablRect r = upload.rects[i];
+    SDL_Rect rect;
+    rect.x = r.left;
+    rect.y = r.top;
+    rect.w = babl_rect_width(r);
+    rect.h = babl_rect_height(r);
+    SDL_UpdateTexture(texture, &rect, sdl2_pixel(r.left, r.top), backbuffer_pitch);
+  }
+}
+
 int main(int argc, char **argv) {
 
 	if(SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
     SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "%s", SDL_GetError());
     return 1;
   }
+  blend_init();
 
   SDL_Window *window = SDL_CreateWindow(
       "babl", 
@@ -332,14 +500,19 @@ int main(int argc, char **argv) {
       backbuffer_w,
       backbuffer_h);
 
-  backbuffer = malloc(backbuffer_w*backbuffer_h*format->BytesPerPixel);
-  if(backbuffer == NULL) {
+  present_mode = SDL2_PRESENT_DIRECT;
+  if(argc > 1 && strcmp(argv[1], "--present-copy") == 0) {
+    present_mode = SDL2_PRESENT_COPY;
+  }
+  if(present_mode == SDL2_PRESENT_COPY && !sdl2_alloc_backbuffer()) {
     SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "malloc fails: out of memory");
     return 1;
   }
   sdl2_set_clip(NULL);
+  sdl2_invalidate(NULL);
   
   BablRenderer sdl2_render_api;
+  sdl2_render_api.invalidate = sdl2_invalidate;
   sdl2_render_api.clear = sdl2_clear;
   sdl2_render_api.set_clip = sdl2_set_clip;
   sdl2_render_api.draw_line = sdl2_draw_line;
@@ -385,38 +558,42 @@ int main(int argc, char **argv) {
                 backbuffer_w,
                 backbuffer_h);
           
-            backbuffer = realloc(backbuffer, backbuffer_w*backbuffer_h*format->BytesPerPixel);
-            if(backbuffer == NULL) {
+            if(present_mode == SDL2_PRESENT_COPY && !sdl2_alloc_backbuffer()) {
               SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "realloc fails: out of memory");
               return 1;
             }
             sdl2_set_clip(NULL);
+            babl_damage_clear(&redraw);
+            sdl2_invalidate(NULL);
           }
         } break;
 
       }
     }
     
-    memset(backbuffer, 0xaa, backbuffer_w*backbuffer_h*format->BytesPerPixel);
-    babl_update_and_render(&babl);
+    if(present_mode == SDL2_PRESENT_DIRECT && !sdl2_present_direct(&babl, backbuffer_texture)) {
+      SDL_Log("SDL_LockTexture fails, using the copy path: %s", SDL_GetError());
+      present_mode = SDL2_PRESENT_COPY;
+      if(!sdl2_alloc_backbuffer()) {
+        SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "malloc fails: out of memory");
+        return 1;
+      }
+      sdl2_invalidate(NULL);
+    }
+    if(present_mode == SDL2_PRESENT_COPY) {
+      sdl2_present_copy(&babl, backbuffer_texture);
+    }
+
+    babl_damage_clear(&redraw);
+    babl_damage_clear(&upload);
+    for(u32 i = 0; i < pending.count; ++i) {
+      babl_damage_add(&redraw, pending.rects[i]);
+    }
+    babl_damage_clear(&pending);
     
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
 
-    int pitch;
-    void *pixels;
-    SDL_LockTexture(backbuffer_texture, NULL, &pixels, &pitch); 
-    
-    Uint8 *dst = pixels;
-    Uint8 *src = backbuffer;
-    for(int y = 0; y < backbuffer_h; ++y) {
-      memcpy(dst, src, backbuffer_w*format->BytesPerPixel); 
-      src += backbuffer_w*format->BytesPerPixel;
-      dst += pitch;
-    }
-
-    SDL_UnlockTexture(backbuffer_texture);
-
     SDL_RenderCopy(renderer, backbuffer_texture, NULL, NULL);
     SDL_RenderPresent(renderer);
   }
@@ -0,0 +1,938 @@
+#include "search.h"
+#include "core/scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_DFA_UNKNOWN UINT32_MAX
+// NOTE: the empty set without restarts, nothing can match from it
+#define SEARCH_DFA_DEAD 0
+
+#define SEARCH_DFA_MATCH   (1 << 0)
+// NOTE: a new match may start at every byte, the start state is added to
+// every transition
+#define SEARCH_DFA_RESTART (1 << 1)
+
+typedef enum SearchNodeType SearchNodeType;
+enum SearchNodeType {
+	SEARCH_NODE_SET,
+	SEARCH_NODE_EMPTY,
+	SEARCH_NODE_CONCAT,
+	SEARCH_NODE_ALT,
+	SEARCH_NODE_STAR,
+	SEARCH_NODE_PLUS,
+	SEARCH_NODE_QUEST,
+};
+
+typedef struct SearchNode SearchNode;
+struct SearchNode {
+	SearchNodeType type;
+	u32 a;
+	u32 b;
+	u8 set[32];
+};
+
+typedef struct SearchParser SearchParser;
+struct SearchParser {
+	const u8 *at;
+	const u8 *end;
+	bool error;
+
+	SearchNode *nodes;
+	u32 count;
+	u32 capacity;
+};
+
+typedef struct SearchFragment SearchFragment;
+struct SearchFragment {
+	u32 start;
+	u32 end;
+};
+
+static void search_set_add(u8 *set, u8 byte) {
+	set[byte >> 3] |= (u8)(1 << (byte & 7));
+}
+
+static bool search_set_has(const u8 *set, u8 byte) {
+	return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+static void search_set_range(u8 *set, u8 first, u8 last) {
+	for(u32 byte = first; byte <= last; byte++) {
+		search_set_add(set, (u8)byte);
+	}
+}
+
+// NOTE: the regex parser builds a tree of nodes that is compiled twice, once
+// for the forward DFA and once reversed for the backward pass
+
+static u32 search_node(SearchParser *parser, SearchNodeType type, u32 a, u32 b) {
+	if(parser->count == parser->capacity) {
+		parser->capacity = parser->capacity ? parser->capacity * 2 : 64;
+		parser->nodes = (SearchNode *)realloc(parser->nodes, parser->capacity * sizeof(*parser->nodes));
+		assert(parser->nodes);
+	}
+	SearchNode *node = &parser->nodes[parser->count];
+	node->type = type;
+	node->a = a;
+	node->b = b;
+	memset(node->set, 0, sizeof(node->set));
+	return parser->count++;
+}
+
+static u32 search_node_set(SearchParser *parser, const u8 *set) {
+	u32 node = search_node(parser, SEARCH_NODE_SET, 0, 0);
+	memcpy(parser->nodes[node].set, set, sizeof(parser->nodes[node].set));
+	return node;
+}
+
+static u32 search_node_range(SearchParser *parser, u8 first, u8 last) {
+	u8 set[32] = {0};
+	search_set_range(set, first, last);
+	return search_node_set(parser, set);
+}
+
+// NOTE: any multi byte utf-8 sequence, without checking for overlong forms
+static u32 search_node_non_ascii(SearchParser *parser) {
+	u32 two = search_node(parser, SEARCH_NODE_CONCAT, search_node_range(parser, 0xc0, 0xdf), search_node_range(parser, 0x80, 0xbf));
+	u32 three = search_node_range(parser, 0xe0, 0xef);
+	for(u32 i = 0; i < 2; i++) {
+		three = search_node(parser, SEARCH_NODE_CONCAT, three, search_node_range(parser, 0x80, 0xbf));
+	}
+	u32 four = search_node_range(parser, 0xf0, 0xf7);
+	for(u32 i = 0; i < 3; i++) {
+		four = search_node(parser, SEARCH_NODE_CONCAT, four, search_node_range(parser, 0x80, 0xbf));
+	}
+	return search_node(parser, SEARCH_NODE_ALT, two, search_node(parser, SEARCH_NODE_ALT, three, four));
+}
+
+// NOTE: the ascii bytes that are not in the set or any other codepoint
+static u32 search_node_negated(SearchParser *parser, const u8 *set) {
+	u8 negated[32] = {0};
+	for(u32 byte = 0; byte < 0x80; byte++) {
+		if(!search_set_has(set, (u8)byte)) {
+			search_set_add(negated, (u8)byte);
+		}
+	}
+	return search_node(parser, SEARCH_NODE_ALT, search_node_set(parser, negated), search_node_non_ascii(parser));
+}
+
+// NOTE: \d \w \s, returns false for any other letter
+static bool search_class_escape(u8 letter, u8 *set) {
+	switch(letter | 0x20) {
+		case 'd': {
+			search_set_range(set, '0', '9');
+		} break;
+		case 'w': {
+			search_set_range(set, '0', '9');
+			search_set_range(set, 'a', 'z');
+			search_set_range(set, 'A', 'Z');
+			search_set_add(set, '_');
+		} break;
+		case 's': {
+			search_set_add(set, ' ');
+			search_set_range(set, '\t', '\r');
+		} break;
+		default: {
+			return false;
+		} break;
+	}
+	return true;
+}
+
+// NOTE: \n \t \r and escaped punctuation, returns false for anything else
+static bool search_byte_escape(u8 letter, u8 *byte) {
+	switch(letter) {
+		case 'n': {
+			*byte = '\n';
+		} break;
+		case 't': {
+			*byte = '\t';
+		} break;
+		case 'r': {
+			*byte = '\r';
+		} break;
+		default: {
+			bool alnum = (letter >= '0' && letter <= '9') || ((letter | 0x20) >= 'a' && (letter | 0x20) <= 'z');
+			if(alnum || letter >= 0x80) {
+				return false;
+			}
+			*byte = letter;
+		} break;
+	}
+	return true;
+}
+
+static u32 search_parse_class(SearchParser *parser) {
+	u8 set[32] = {0};
+	bool negated = false;
+	if(parser->at < parser->end && *parser->at == '^') {
+		negated = true;
+		parser->at++;
+	}
+
+	bool first = true;
+	while(parser->at < parser->end && (*parser->at != ']' || first)) {
+		first = false;
+		u8 byte = *parser->at++;
+		if(byte == '\\') {
+			if(parser->at == parser->end) {
+				break;
+			}
+			u8 letter = *parser->at++;
+			if(search_class_escape(letter, set)) {
+				// NOTE: the negated escapes can not be mixed into a class
+				if(letter >= 'A' && letter <= 'Z') {
+					parser->error = true;
+				}
+				continue;
+			}
+			if(!search_byte_escape(letter, &byte)) {
+				parser->error = true;
+				continue;
+			}
+		}
+		if(byte >= 0x80) {
+			parser->error = true;
+			continue;
+		}
+
+		if(parser->at + 1 < parser->end && parser->at[0] == '-' && parser->at[1] != ']') {
+			u8 last = parser->at[1];
+			parser->at += 2;
+			if(last == '\\' && parser->at < parser->end) {
+				if(!search_byte_escape(*parser->at++, &last)) {
+					parser->error = true;
+				}
+			}
+			if(last >= 0x80 || last < byte) {
+				parser->error = true;
+				continue;
+			}
+			search_set_range(set, byte, last);
+		} else {
+			search_set_add(set, byte);
+		}
+	}
+
+	if(parser->at == parser->end) {
+		parser->error = true;
+		return 0;
+	}
+	parser->at++;
+	return negated ? search_node_negated(parser, set) : search_node_set(parser, set);
+}
+
+static u32 search_parse_alt(SearchParser *parser);
+
+static u32 search_parse_atom(SearchParser *parser) {
+	u8 byte = *parser->at++;
+	switch(byte) {
+		case '(': {
+			u32 node = search_parse_alt(parser);
+			if(parser->at == parser->end || *parser->at != ')') {
+				parser->error = true;
+				return node;
+			}
+			parser->at++;
+			return node;
+		} break;
+		case '[': {
+			return search_parse_class(parser);
+		} break;
+		case '.': {
+			u8 set[32] = {0};
+			search_set_add(set, '\n');
+			return search_node_negated(parser, set);
+		} break;
+		case '*':
+		case '+':
+		case '?': {
+			parser->error = true;
+			return search_node(parser, SEARCH_NODE_EMPTY, 0, 0);
+		} break;
+		case '\\': {
+			if(parser->at == parser->end) {
+				parser->error = true;
+				return search_node(parser, SEARCH_NODE_EMPTY, 0, 0);
+			}
+			u8 letter = *parser->at++;
+			u8 set[32] = {0};
+			if(search_class_escape(letter, set)) {
+				if(letter >= 'A' && letter <= 'Z') {
+					return search_node_negated(parser, set);
+				}
+				return search_node_set(parser, set);
+			}
+			if(!search_byte_escape(letter, &byte)) {
+				parser->error = true;
+			}
+		} break;
+		default: {} break;
+	}
+
+	// NOTE: a multi byte codepoint is one atom so a quantifier repeats all of it
+	u8 set[32] = {0};
+	search_set_add(set, byte);
+	u32 node = search_node_set(parser, set);
+	if(byte >= 0xc0) {
+		while(parser->at < parser->end && (*parser->at & 0xc0) == 0x80) {
+			memset(set, 0, sizeof(set));
+			search_set_add(set, *parser->at++);
+			node = search_node(parser, SEARCH_NODE_CONCAT, node, search_node_set(parser, set));
+		}
+	}
+	return node;
+}
+
+static u32 search_parse_repeat(SearchParser *parser) {
+	u32 node = search_parse_atom(parser);
+	while(parser->at < parser->end) {
+		u8 byte = *parser->at;
+		if(byte == '*') {
+			node = search_node(parser, SEARCH_NODE_STAR, node, 0);
+		} else if(byte == '+') {
+			node = search_node(parser, SEARCH_NODE_PLUS, node, 0);
+		} else if(byte == '?') {
+			node = search_node(parser, SEARCH_NODE_QUEST, node, 0);
+		} else {
+			break;
+		}
+		parser->at++;
+	}
+	return node;
+}
+
+static u32 search_parse_concat(SearchParser *parser) {
+	u32 node = search_node(parser, SEARCH_NODE_EMPTY, 0, 0);
+	bool empty = true;
+	while(parser->at < parser->end && *parser->at != '|' && *parser->at != ')') {
+		u32 next = search_parse_repeat(parser);
+		node = empty ? next : search_node(parser, SEARCH_NODE_CONCAT, node, next);
+		empty = false;
+	}
+	return node;
+}
+
+static u32 search_parse_alt(SearchParser *parser) {
+	u32 node = search_parse_concat(parser);
+	while(parser->at < parser->end && *parser->at == '|') {
+		parser->at++;
+		node = search_node(parser, SEARCH_NODE_ALT, node, search_parse_concat(parser));
+	}
+	return node;
+}
+
+// NOTE: thompson construction, every fragment ends in an empty state whose
+// out is patched by the fragment that follows
+
+static u32 search_nfa_state(SearchDfa *dfa, SearchNfaType type, u32 out, u32 out1) {
+	if(dfa->nfa_count == dfa->nfa_capacity) {
+		dfa->nfa_capacity = dfa->nfa_capacity ? dfa->nfa_capacity * 2 : 64;
+		dfa->nfa = (SearchNfaState *)realloc(dfa->nfa, dfa->nfa_capacity * sizeof(*dfa->nfa));
+		assert(dfa->nfa);
+		dfa->sets = (u8 (*)[32])realloc(dfa->sets, dfa->nfa_capacity * sizeof(*dfa->sets));
+		assert(dfa->sets);
+	}
+	SearchNfaState *state = &dfa->nfa[dfa->nfa_count];
+	state->type = type;
+	state->out = out;
+	state->out1 = out1;
+	state->set = dfa->nfa_count;
+	return dfa->nfa_count++;
+}
+
+static SearchFragment search_compile(SearchDfa *dfa, SearchNode *nodes, u32 index, bool reverse) {
+	SearchNode *node = &nodes[index];
+	SearchFragment fragment;
+	switch(node->type) {
+		case SEARCH_NODE_SET: {
+			fragment.end = search_nfa_state(dfa, SEARCH_NFA_EMPTY, 0, 0);
+			fragment.start = search_nfa_state(dfa, SEARCH_NFA_SET, fragment.end, 0);
+			memcpy(dfa->sets[dfa->nfa[fragment.start].set], node->set, sizeof(node->set));
+		} break;
+		case SEARCH_NODE_EMPTY: {
+			fragment.start = search_nfa_state(dfa, SEARCH_NFA_EMPTY, 0, 0);
+			fragment.end = fragment.start;
+		} break;
+		case SEARCH_NODE_CONCAT: {
+			SearchFragment a = search_compile(dfa, nodes, node->a, reverse);
+			SearchFragment b = search_compile(dfa, nodes, node->b, reverse);
+			if(reverse) {
+				SearchFragment swap = a;
+				a = b;
+				b = swap;
+			}
+			dfa->nfa[a.end].out = b.start;
+			fragment.start = a.start;
+			fragment.end = b.end;
+		} break;
+		case SEARCH_NODE_ALT: {
+			SearchFragment a = search_compile(dfa, nodes, node->a, reverse);
+			SearchFragment b = search_compile(dfa, nodes, node->b, reverse);
+			fragment.start = search_nfa_state(dfa, SEARCH_NFA_SPLIT, a.start, b.start);
+			fragment.end = search_nfa_state(dfa, SEARCH_NFA_EMPTY, 0, 0);
+			dfa->nfa[a.end].out = fragment.end;
+			dfa->nfa[b.end].out = fragment.end;
+		} break;
+		case SEARCH_NODE_STAR:
+		case SEARCH_NODE_PLUS:
+		case SEARCH_NODE_QUEST: {
+			SearchFragment a = search_compile(dfa, nodes, node->a, reverse);
+			fragment.end = search_nfa_state(dfa, SEARCH_NFA_EMPTY, 0, 0);
+			u32 split = search_nfa_state(dfa, SEARCH_NFA_SPLIT, a.start, fragment.end);
+			if(node->type == SEARCH_NODE_QUEST) {
+				dfa->nfa[a.end].out = fragment.end;
+			} else {
+				dfa->nfa[a.end].out = split;
+			}
+			fragment.start = node->type == SEARCH_NODE_PLUS ? a.start : split;
+		} break;
+	}
+	return fragment;
+}
+
+// NOTE: adds the states that consume bytes or match reachable from state
+// without consuming anything. States marked in this round are skipped
+static u32 search_closure(SearchDfa *dfa, u32 state, u32 *ids, u32 count, bool keep_match) {
+	u32 top = 0;
+	dfa->stack[top++] = state;
+	while(top > 0) {
+		u32 current = dfa->stack[--top];
+		if(dfa->marks[current] == dfa->mark) {
+			continue;
+		}
+		dfa->marks[current] = dfa->mark;
+		SearchNfaState *nfa = &dfa->nfa[current];
+		switch(nfa->type) {
+			case SEARCH_NFA_SET: {
+				ids[count++] = current;
+			} break;
+			case SEARCH_NFA_MATCH: {
+				if(keep_match) {
+					ids[count++] = current;
+				}
+			} break;
+			case SEARCH_NFA_SPLIT: {
+				dfa->stack[top++] = nfa->out1;
+				dfa->stack[top++] = nfa->out;
+			} break;
+			case SEARCH_NFA_EMPTY: {
+				dfa->stack[top++] = nfa->out;
+			} break;
+		}
+	}
+	return count;
+}
+
+static void search_dfa_next_mark(SearchDfa *dfa) {
+	dfa->mark++;
+	if(dfa->mark == 0) {
+		memset(dfa->marks, 0, dfa->nfa_count * sizeof(*dfa->marks));
+		dfa->mark = 1;
+	}
+}
+
+static int search_id_compare(const void *a, const void *b) {
+	u32 ia = *(const u32 *)a;
+	u32 ib = *(const u32 *)b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static u32 search_dfa_hash(const u32 *ids, u32 count, u8 flags) {
+	u32 hash = 2166136261u ^ flags;
+	for(u32 i = 0; i < count; i++) {
+		hash = (hash ^ ids[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static u32 search_dfa_add(SearchDfa *dfa, u32 *ids, u32 count, u8 flags);
+
+// NOTE: drops every state, the dead and start states are added back first so
+// they keep their meaning
+static void search_dfa_flush(SearchDfa *dfa) {
+	dfa->state_total = 0;
+	dfa->id_count = 0;
+	memset(dfa->table, 0xff, dfa->table_capacity * sizeof(*dfa->table));
+
+	search_dfa_add(dfa, dfa->next, 0, 0);
+	dfa->start = search_dfa_add(dfa, dfa->next, 0, SEARCH_DFA_RESTART);
+	dfa->start_anchored = search_dfa_add(dfa, dfa->start_ids, dfa->start_count, 0);
+}
+
+static u32 search_dfa_add(SearchDfa *dfa, u32 *ids, u32 count, u8 flags) {
+	qsort(ids, count, sizeof(*ids), search_id_compare);
+	for(u32 i = 0; i < count; i++) {
+		if(dfa->nfa[ids[i]].type == SEARCH_NFA_MATCH) {
+			flags |= SEARCH_DFA_MATCH;
+		}
+	}
+
+	u32 mask = dfa->table_capacity - 1;
+	u32 slot = search_dfa_hash(ids, count, flags) & mask;
+	while(dfa->table[slot] != SEARCH_DFA_UNKNOWN) {
+		u32 state = dfa->table[slot];
+		if(dfa->state_flags[state] == flags && dfa->state_count[state] == count &&
+		   memcmp(dfa->ids + dfa->state_first[state], ids, count * sizeof(*ids)) == 0) {
+			return state;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if(dfa->state_total == dfa->state_capacity) {
+		dfa->state_capacity = min(dfa->state_capacity ? dfa->state_capacity * 2 : 64, SEARCH_DFA_MAX_STATES);
+		dfa->transitions = (u32 *)realloc(dfa->transitions, dfa->state_capacity * 256 * sizeof(*dfa->transitions));
+		dfa->state_first = (u32 *)realloc(dfa->state_first, dfa->state_capacity * sizeof(*dfa->state_first));
+		dfa->state_count = (u32 *)realloc(dfa->state_count, dfa->state_capacity * sizeof(*dfa->state_count));
+		dfa->state_flags = (u8 *)realloc(dfa->state_flags, dfa->state_capacity * sizeof(*dfa->state_flags));
+		assert(dfa->transitions && dfa->state_first && dfa->state_count && dfa->state_flags);
+	}
+	if(dfa->id_count + count > dfa->id_capacity) {
+		while(dfa->id_count + count > dfa->id_capacity) {
+			dfa->id_capacity *= 2;
+		}
+		dfa->ids = (u32 *)realloc(dfa->ids, dfa->id_capacity * sizeof(*dfa->ids));
+		assert(dfa->ids);
+	}
+
+	u32 state = dfa->state_total++;
+	dfa->state_first[state] = (u32)dfa->id_count;
+	dfa->state_count[state] = count;
+	dfa->state_flags[state] = flags;
+	memcpy(dfa->ids + dfa->id_count, ids, count * sizeof(*ids));
+	dfa->id_count += count;
+	memset(dfa->transitions + (u64)state * 256, 0xff, 256 * sizeof(*dfa->transitions));
+	dfa->table[slot] = state;
+	return state;
+}
+
+// NOTE: adds the closures after byte of the states in ids
+static u32 search_dfa_move(SearchDfa *dfa, u32 *ids, u32 count, u8 byte, u32 next) {
+	for(u32 i = 0; i < count; i++) {
+		SearchNfaState *nfa = &dfa->nfa[ids[i]];
+		if(nfa->type == SEARCH_NFA_SET && search_set_has(dfa->sets[nfa->set], byte)) {
+			next = search_closure(dfa, nfa->out, dfa->next, next, true);
+		}
+	}
+	return next;
+}
+
+static u32 search_dfa_step(SearchDfa *dfa, u32 state, u8 byte) {
+	u32 next = dfa->transitions[(u64)state * 256 + byte];
+	if(next != SEARCH_DFA_UNKNOWN) {
+		return next;
+	}
+
+	// NOTE: a restart moves a new match along with the ones in progress, the
+	// state only keeps the ones in progress so the start state is also the
+	// one where nothing is being matched
+	search_dfa_next_mark(dfa);
+	u8 flags = dfa->state_flags[state] & SEARCH_DFA_RESTART;
+	u32 count = search_dfa_move(dfa, dfa->ids + dfa->state_first[state], dfa->state_count[state], byte, 0);
+	if(flags) {
+		count = search_dfa_move(dfa, dfa->start_ids, dfa->start_count, byte, count);
+	}
+
+	// NOTE: next lives outside of the cache and survives the flush, the
+	// transition is not cached since state is gone
+	bool flushed = false;
+	if(dfa->state_total == SEARCH_DFA_MAX_STATES) {
+		search_dfa_flush(dfa);
+		flushed = true;
+	}
+	next = search_dfa_add(dfa, dfa->next, count, flags);
+	if(!flushed) {
+		dfa->transitions[(u64)state * 256 + byte] = next;
+	}
+	return next;
+}
+
+// NOTE: the same state without restarts, no new match starts after it
+static u32 search_dfa_anchor(SearchDfa *dfa, u32 state) {
+	if(!(dfa->state_flags[state] & SEARCH_DFA_RESTART)) {
+		return state;
+	}
+	u32 count = dfa->state_count[state];
+	memcpy(dfa->next, dfa->ids + dfa->state_first[state], count * sizeof(*dfa->next));
+	if(dfa->state_total == SEARCH_DFA_MAX_STATES) {
+		search_dfa_flush(dfa);
+	}
+	return search_dfa_add(dfa, dfa->next, count, 0);
+}
+
+static void search_dfa_init(SearchDfa *dfa, SearchParser *parser, u32 root, bool reverse) {
+	memset(dfa, 0, sizeof(*dfa));
+	SearchFragment fragment = search_compile(dfa, parser->nodes, root, reverse);
+	u32 match = search_nfa_state(dfa, SEARCH_NFA_MATCH, 0, 0);
+	dfa->nfa[fragment.end].out = match;
+	dfa->nfa_start = fragment.start;
+
+	// NOTE: every nfa state is pushed at most once per mark
+	dfa->stack = (u32 *)malloc(dfa->nfa_count * 2 * sizeof(*dfa->stack));
+	dfa->marks = (u32 *)calloc(dfa->nfa_count, sizeof(*dfa->marks));
+	dfa->next = (u32 *)malloc(dfa->nfa_count * sizeof(*dfa->next));
+	assert(dfa->stack && dfa->marks && dfa->next);
+	dfa->mark = 0;
+
+	dfa->id_capacity = 1024;
+	dfa->ids = (u32 *)malloc(dfa->id_capacity * sizeof(*dfa->ids));
+	assert(dfa->ids);
+	dfa->table_capacity = SEARCH_DFA_MAX_STATES * 2;
+	dfa->table = (u32 *)malloc(dfa->table_capacity * sizeof(*dfa->table));
+	assert(dfa->table);
+
+	// NOTE: the match state is left out of the start so matches are never empty
+	dfa->start_ids = (u32 *)malloc(dfa->nfa_count * sizeof(*dfa->start_ids));
+	assert(dfa->start_ids);
+	search_dfa_next_mark(dfa);
+	dfa->start_count = search_closure(dfa, dfa->nfa_start, dfa->start_ids, 0, false);
+	search_dfa_flush(dfa);
+}
+
+static void search_dfa_destroy(SearchDfa *dfa) {
+	free(dfa->nfa);
+	free(dfa->sets);
+	free(dfa->transitions);
+	free(dfa->state_first);
+	free(dfa->state_count);
+	free(dfa->state_flags);
+	free(dfa->ids);
+	free(dfa->table);
+	free(dfa->stack);
+	free(dfa->marks);
+	free(dfa->next);
+	free(dfa->start_ids);
+	memset(dfa, 0, sizeof(*dfa));
+}
+
+bool search_init(Search *search, const u8 *pattern, u64 size, SearchMode mode) {
+	memset(search, 0, sizeof(*search));
+	if(size == 0) {
+		return false;
+	}
+
+	if(mode == SEARCH_REGEX) {
+		SearchParser parser = {0};
+		parser.at = pattern;
+		parser.end = pattern + size;
+		u32 root = search_parse_alt(&parser);
+		if(parser.at != parser.end) {
+			parser.error = true;
+		}
+		if(parser.error) {
+			free(parser.nodes);
+			return false;
+		}
+		search_dfa_init(&search->forward, &parser, root, false);
+		search_dfa_init(&search->reverse, &parser, root, true);
+		free(parser.nodes);
+
+		// NOTE: the bytes that can start a match
+		SearchDfa *forward = &search->forward;
+		u8 first[32] = {0};
+		for(u32 i = 0; i < forward->start_count; i++) {
+			SearchNfaState *nfa = &forward->nfa[forward->start_ids[i]];
+			for(u32 j = 0; j < 32; j++) {
+				first[j] |= forward->sets[nfa->set][j];
+			}
+		}
+		for(u32 byte = 0; byte < 256; byte++) {
+			if(search_set_has(first, (u8)byte)) {
+				if(search->first_count == array_len(search->first_bytes)) {
+					search->first_count = 0;
+					break;
+				}
+				search->first_bytes[search->first_count++] = (u8)byte;
+			}
+		}
+	}
+
+	search->mode = mode;
+	search->size = size;
+	search->pattern = (u8 *)malloc(size);
+	search->carry = (u8 *)malloc(size);
+	search->scratch = (u8 *)malloc(size * 2);
+	assert(search->pattern && search->carry && search->scratch);
+	memcpy(search->pattern, pattern, size);
+	search->units = text_buffer_units(pattern, size);
+	return true;
+}
+
+void search_destroy(Search *search) {
+	if(search->mode == SEARCH_REGEX) {
+		search_dfa_destroy(&search->forward);
+		search_dfa_destroy(&search->reverse);
+	}
+	free(search->pattern);
+	free(search->carry);
+	free(search->scratch);
+	free(search->spans);
+	memset(search, 0, sizeof(*search));
+}
+
+void search_begin(Search *search, u64 index) {
+	search->index = index;
+}
+
+static void search_found(Search *search, TextBuffer buffer, u64 index, u64 count, SearchMatch *match) {
+	match->index = index;
+	match->count = count;
+	bool found = line_tree_find_byte(text_buffer_line_tree(buffer), index, &match->line, &match->column);
+	assert(found);
+	search->index = index + count;
+}
+
+static const u8 *search_literal_candidate(Search *search, const u8 *bytes, u64 size) {
+	if(search->size == 1) {
+		return (const u8 *)memchr(bytes, search->pattern[0], size);
+	}
+	return scan_find_pair(bytes, size, search->pattern[0], search->pattern[search->size - 1], search->size - 1);
+}
+
+static SearchStatus search_literal_step(Search *search, TextBuffer buffer, u64 budget, SearchMatch *match) {
+	u64 begin = search->index;
+	u64 buffer_size = text_buffer_size(buffer);
+	u64 size = search->size;
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, begin, buffer_size - begin);
+
+	u64 carry_size = 0;
+	u64 scanned = 0;
+	u64 index = begin;
+	while(text_buffer_chunks_next(&chunks)) {
+		const u8 *data = chunks.data;
+		u64 data_size = chunks.size;
+
+		// NOTE: matches that start in the carried bytes and end in this chunk
+		if(carry_size > 0) {
+			u64 head = min(size - 1, data_size);
+			memcpy(search->scratch, search->carry, carry_size);
+			memcpy(search->scratch + carry_size, data, head);
+			for(u64 i = 0; i < carry_size && i + size <= carry_size + head; i++) {
+				if(memcmp(search->scratch + i, search->pattern, size) == 0) {
+					u64 units = text_buffer_units(search->carry + i, carry_size - i);
+					search_found(search, buffer, index - units, search->units, match);
+					return SEARCH_FOUND;
+				}
+			}
+		}
+
+		const u8 *at = data;
+		const u8 *end = data + data_size;
+		while(at < end) {
+			const u8 *candidate = search_literal_candidate(search, at, (u64)(end - at));
+			if(!candidate) {
+				break;
+			}
+			if((u64)(end - candidate) >= size && memcmp(candidate, search->pattern, size) == 0) {
+				search_found(search, buffer, index + text_buffer_units(data, (u64)(candidate - data)), search->units, match);
+				return SEARCH_FOUND;
+			}
+			at = candidate + 1;
+		}
+
+		// NOTE: keeps the last size - 1 bytes of everything scanned
+		u64 keep = min(size - 1, carry_size + data_size);
+		if(data_size >= keep) {
+			memcpy(search->carry, end - keep, keep);
+		} else {
+			u64 old = keep - data_size;
+			memmove(search->carry, search->carry + carry_size - old, old);
+			memcpy(search->carry + old, data, data_size);
+		}
+		carry_size = keep;
+		index = chunks.index;
+		scanned += data_size;
+
+		if(scanned >= budget) {
+			u64 resume = index - text_buffer_units(search->carry, carry_size);
+			if(resume > begin && index < buffer_size) {
+				search->index = resume;
+				return SEARCH_PENDING;
+			}
+		}
+	}
+
+	search->index = buffer_size;
+	return SEARCH_DONE;
+}
+
+static void search_span_push(Search *search, const u8 *data, u64 size, u64 index, u64 position) {
+	if(search->span_count == search->span_capacity) {
+		search->span_capacity = search->span_capacity ? search->span_capacity * 2 : 64;
+		search->spans = (SearchSpan *)realloc(search->spans, search->span_capacity * sizeof(*search->spans));
+		assert(search->spans);
+	}
+	SearchSpan *span = &search->spans[search->span_count++];
+	span->data = data;
+	span->size = size;
+	span->index = index;
+	span->position = position;
+}
+
+static u64 search_span_unit(Search *search, u32 span, u64 offset) {
+	return search->spans[span].index + text_buffer_units(search->spans[span].data, offset);
+}
+
+static const u8 *search_regex_skip(Search *search, const u8 *bytes, u64 size) {
+	switch(search->first_count) {
+		case 1: {
+			return (const u8 *)memchr(bytes, search->first_bytes[0], size);
+		} break;
+		case 2: {
+			return scan_memchr2(bytes, size, search->first_bytes[0], search->first_bytes[1]);
+		} break;
+		case 3: {
+			return scan_memchr3(bytes, size, search->first_bytes[0], search->first_bytes[1], search->first_bytes[2]);
+		} break;
+		default: {} break;
+	}
+	return bytes;
+}
+
+static SearchStatus search_regex_step(Search *search, TextBuffer buffer, u64 budget, SearchMatch *match) {
+	SearchDfa *forward = &search->forward;
+	SearchDfa *reverse = &search->reverse;
+	u64 begin = search->index;
+	u64 buffer_size = text_buffer_size(buffer);
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, begin, buffer_size - begin);
+	search->span_count = 0;
+
+	// NOTE: pass one, forward to where the first match ends and on while any
+	// match that started before it can still grow. The window starts where
+	// the DFA was last in its start state, no match starts before it
+	u32 state = forward->start;
+	u32 window_span = 0;
+	u64 window_offset = 0;
+	bool found = false;
+	u64 first_end = 0;
+	u32 end_span = 0;
+	u64 end_offset = 0;
+	u64 scanned = 0;
+	u64 position = 0;
+	u64 index = begin;
+	bool done = false;
+	while(!done && text_buffer_chunks_next(&chunks)) {
+		search_span_push(search, chunks.data, chunks.size, index, position);
+		u32 span = search->span_count - 1;
+		const u8 *data = chunks.data;
+		for(u64 i = 0; i < chunks.size; i++) {
+			if(state == forward->start) {
+				const u8 *skip = search_regex_skip(search, data + i, chunks.size - i);
+				window_span = span;
+				if(!skip) {
+					window_offset = chunks.size;
+					break;
+				}
+				i = (u64)(skip - data);
+				window_offset = i;
+			}
+			state = search_dfa_step(forward, state, data[i]);
+			if(forward->state_flags[state] & SEARCH_DFA_MATCH) {
+				if(!found) {
+					found = true;
+					first_end = position + i + 1;
+					state = search_dfa_anchor(forward, state);
+				}
+				end_span = span;
+				end_offset = i + 1;
+			}
+			if(found && state == SEARCH_DFA_DEAD) {
+				done = true;
+				break;
+			}
+		}
+		index = chunks.index;
+		position += chunks.size;
+		scanned += chunks.size;
+
+		if(!found) {
+			if(window_span > 0) {
+				memmove(search->spans, search->spans + window_span, (search->span_count - window_span) * sizeof(*search->spans));
+				search->span_count -= window_span;
+				window_span = 0;
+			}
+			if(scanned >= budget && index < buffer_size) {
+				u64 resume = search_span_unit(search, window_span, window_offset);
+				if(resume > begin) {
+					search->index = resume;
+					return SEARCH_PENDING;
+				}
+			}
+		}
+	}
+	if(!found) {
+		search->index = buffer_size;
+		return SEARCH_DONE;
+	}
+
+	// NOTE: pass two, backward from the last end with the reversed regex. New
+	// matches are started at every end from the first one on, the last start
+	// seen is the leftmost one
+	u32 span = end_span;
+	u64 offset = end_offset;
+	u32 start_span = span;
+	u64 start_offset = offset;
+	state = reverse->start;
+	while(span > window_span || offset > window_offset) {
+		if(offset == 0) {
+			span--;
+			offset = search->spans[span].size;
+			continue;
+		}
+		offset--;
+		if(search->spans[span].position + offset + 1 < first_end) {
+			state = search_dfa_anchor(reverse, state);
+		}
+		state = search_dfa_step(reverse, state, search->spans[span].data[offset]);
+		if(reverse->state_flags[state] & SEARCH_DFA_MATCH) {
+			start_span = span;
+			start_offset = offset;
+		}
+		if(state == SEARCH_DFA_DEAD) {
+			break;
+		}
+	}
+
+	// NOTE: pass three, forward from the start to its longest end
+	span = start_span;
+	offset = start_offset;
+	end_span = span;
+	end_offset = offset;
+	state = forward->start_anchored;
+	while(span < search->span_count) {
+		if(offset == search->spans[span].size) {
+			span++;
+			offset = 0;
+			continue;
+		}
+		state = search_dfa_step(forward, state, search->spans[span].data[offset]);
+		offset++;
+		if(forward->state_flags[state] & SEARCH_DFA_MATCH) {
+			end_span = span;
+			end_offset = offset;
+		}
+		if(state == SEARCH_DFA_DEAD) {
+			break;
+		}
+	}
+
+	u64 start = search_span_unit(search, start_span, start_offset);
+	u64 end = search_span_unit(search, end_span, end_offset);
+	assert(end > start);
+	search_found(search, buffer, start, end - start, match);
+	return SEARCH_FOUND;
+}
+
+SearchStatus search_step(Search *search, TextBuffer buffer, u64 budget, SearchMatch *match) {
+	if(search->index >= text_buffer_size(buffer)) {
+		search->index = text_buffer_size(buffer);
+		return SEARCH_DONE;
+	}
+	if(search->mode == SEARCH_REGEX) {
+		return search_regex_step(search, buffer, budget, match);
+	}
+	return search_literal_step(search, buffer, budget, match);
+}
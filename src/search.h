@@ -0,0 +1,148 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include "core/types.h"
+#include "text_buffer.h"
+
+// NOTE: find over the chunks of a text buffer, the text is never copied.
+// Literals are found with scan_find_pair on the first and last byte of the
+// pattern and verified with memcmp, the few bytes around a chunk boundary are
+// checked apart. Regular expressions are compiled to a byte NFA that becomes a
+// DFA lazily while searching. A match takes three DFA passes over the chunks
+// since the last time no match was in progress: forward to where the first
+// match ends, backward to the leftmost start and forward again to the longest
+// end, so matches are leftmost-longest and never empty.
+//
+// Searching is incremental: search_step scans about budget bytes and returns,
+// so the first matches of a big file show up before the rest is searched.
+// Matches are in the units of the buffer and carry their line and column from
+// the line tree. Positions are only valid until the buffer changes, after an
+// edit the search has to start again with search_begin.
+//
+// Regex syntax: literal bytes, . (any codepoint but a new line), [] and [^]
+// with ascii bytes and ranges, \d \w \s \D \W \S \n \t \r and escaped
+// punctuation, (), |, *, + and ?. A negated class also matches every non
+// ascii codepoint. There are no anchors, counted repetitions or captures.
+
+#define SEARCH_DFA_MAX_STATES 4096
+#define SEARCH_FRAME_BUDGET (8 << 20)
+
+typedef enum SearchMode SearchMode;
+enum SearchMode {
+	SEARCH_LITERAL,
+	SEARCH_REGEX,
+};
+
+typedef enum SearchStatus SearchStatus;
+enum SearchStatus {
+	SEARCH_FOUND,
+	// NOTE: the budget ran out, call search_step again
+	SEARCH_PENDING,
+	SEARCH_DONE,
+};
+
+typedef struct SearchMatch SearchMatch;
+struct SearchMatch {
+	u64 index;
+	u64 count;
+	u32 line;
+	u64 column;
+};
+
+typedef enum SearchNfaType SearchNfaType;
+enum SearchNfaType {
+	SEARCH_NFA_SET,
+	SEARCH_NFA_SPLIT,
+	SEARCH_NFA_EMPTY,
+	SEARCH_NFA_MATCH,
+};
+
+typedef struct SearchNfaState SearchNfaState;
+struct SearchNfaState {
+	SearchNfaType type;
+	u32 out;
+	u32 out1;
+	// NOTE: index of the 256 bit byte set of a SEARCH_NFA_SET state
+	u32 set;
+};
+
+// NOTE: every DFA state is a sorted set of the NFA states that consume bytes,
+// plus the match state, of the matches in progress. States are created the
+// first time a transition needs them and the whole cache is dropped when it
+// reaches SEARCH_DFA_MAX_STATES
+typedef struct SearchDfa SearchDfa;
+struct SearchDfa {
+	SearchNfaState *nfa;
+	u32 nfa_count;
+	u32 nfa_capacity;
+	u32 nfa_start;
+	u8 (*sets)[32];
+	// NOTE: the closure of nfa_start, added to the states with restarts
+	u32 *start_ids;
+	u32 start_count;
+
+	u32 *transitions;
+	u32 *state_first;
+	u32 *state_count;
+	u8 *state_flags;
+	u32 state_total;
+	u32 state_capacity;
+
+	u32 *ids;
+	u64 id_count;
+	u64 id_capacity;
+
+	u32 *table;
+	u32 table_capacity;
+
+	// NOTE: scratch for building states
+	u32 *stack;
+	u32 *marks;
+	u32 mark;
+	u32 *next;
+
+	u32 start;
+	u32 start_anchored;
+};
+
+typedef struct SearchSpan SearchSpan;
+struct SearchSpan {
+	const u8 *data;
+	u64 size;
+	// NOTE: unit index in the buffer and byte position since the step began
+	u64 index;
+	u64 position;
+};
+
+typedef struct Search Search;
+struct Search {
+	SearchMode mode;
+	u8 *pattern;
+	u64 size;
+	u64 units;
+
+	// NOTE: the last size - 1 bytes seen, for literals that cross chunks
+	u8 *carry;
+	u8 *scratch;
+
+	SearchDfa forward;
+	SearchDfa reverse;
+	// NOTE: the bytes that take the forward DFA out of its start state, when
+	// there are at most 3 they are skipped to with the scan kernels
+	u8 first_bytes[3];
+	u32 first_count;
+
+	SearchSpan *spans;
+	u32 span_count;
+	u32 span_capacity;
+
+	u64 index;
+};
+
+// NOTE: returns false if the regex does not parse or the pattern is empty
+bool search_init(Search *search, const u8 *pattern, u64 size, SearchMode mode);
+void search_destroy(Search *search);
+void search_begin(Search *search, u64 index);
+SearchStatus search_step(Search *search, TextBuffer buffer, u64 budget, SearchMatch *match);
+
+#endif // _SEARCH_H_
@@ -2,18 +2,144 @@
 #define _TEXT_BUFFER_H_
 
 #include "core/types.h"
+#include "core/line_tree.h"
 
+#define TEXT_BUFFER_TAB_WIDTH 4
+
+// NOTE: indices, sizes and counts are bytes, except in the utf-8 backend
+// where they are codepoints. The line tree uses the same unit.
 typedef struct TextBuffer * TextBuffer;
 
+// NOTE: iterates a byte range of the buffer as contiguous spans that point
+// straight into the backend storage. The spans are only valid until the next
+// edit, node and offset are owned by the backend.
+typedef struct TextBufferChunks TextBufferChunks;
+struct TextBufferChunks {
+	TextBuffer buffer;
+	u64 index;
+	u64 end;
+	void *node;
+	u64 offset;
+
+	const u8 *data;
+	u64 size;
+};
+
+// NOTE: an immutable view of the buffer at the moment it was taken. Snapshots
+// are taken and released on the thread that edits the buffer and can be read
+// from any thread in between without locks, later edits never change them.
+// The piece table (and the utf-8 backend built on it) shares its pieces and
+// added text with its snapshots so taking one is O(1), the gap and ascii
+// backends copy the text. Indices and sizes of a snapshot are in the units of
+// the buffer it was taken from, codepoints in the utf-8 backend, and the
+// chunks are bytes like the ones of the buffer
+typedef struct TextBufferSnapshot * TextBufferSnapshot;
+
+typedef struct TextBufferSnapshotChunks TextBufferSnapshotChunks;
+struct TextBufferSnapshotChunks {
+	TextBufferSnapshot snapshot;
+	u64 index;
+	u64 end;
+
+	const u8 *data;
+	u64 size;
+};
+
+// NOTE: one edit of a batch: delete count units at index, then insert size
+// bytes there. Every index refers to the text before the batch
+typedef struct TextBufferEdit TextBufferEdit;
+struct TextBufferEdit {
+	u64 index;
+	u64 count;
+	const u8 *bytes;
+	u64 size;
+};
+
+// NOTE: an edit that inserts the text of a snapshot of the same buffer
+// instead of bytes, a text of 0 inserts nothing. The piece table links the
+// pieces of the snapshot back in and copies nothing
+typedef struct TextBufferSnapshotEdit TextBufferSnapshotEdit;
+struct TextBufferSnapshotEdit {
+	u64 index;
+	u64 count;
+	TextBufferSnapshot text;
+};
+
 TextBuffer text_buffer_create(void);
+// NOTE: the piece table references bytes without copying them, so they must
+// stay alive and unchanged until the buffer and its snapshots are released (a
+// file mapping is the intended use), the other backends copy them. Returns 0
+// if the bytes are not valid for the backend
+TextBuffer text_buffer_create_from_bytes(const u8 *bytes, u64 size);
 void text_buffer_destroy(TextBuffer buffer);
 
 u64 text_buffer_size(TextBuffer buffer);
+LineTree *text_buffer_line_tree(TextBuffer buffer);
 
 bool text_buffer_line(TextBuffer buffer, u32 line, u64 *index, u32 *size);
 
 bool text_buffer_insert(TextBuffer buffer, u64 index, u32 code);
 bool text_buffer_delete(TextBuffer buffer, u64 index);
+bool text_buffer_insert_bytes(TextBuffer buffer, u64 index, const u8 *bytes, u64 size);
+bool text_buffer_delete_range(TextBuffer buffer, u64 index, u64 count);
 u32 text_buffer_get(TextBuffer buffer, u64 index);
+// NOTE: applies every edit in one pass over the buffer, from the last one to
+// the first so no index has to be adjusted. The edits are sorted in place and
+// must not overlap, if any of them is invalid nothing is applied
+bool text_buffer_apply_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count);
+// NOTE: the same for edits that are already sorted
+bool text_buffer_apply_snapshot_edits(TextBuffer buffer, TextBufferSnapshotEdit *edits, u32 count);
+// NOTE: the number of units the bytes take in the buffer
+u64 text_buffer_units(const u8 *bytes, u64 size);
+// NOTE: used by the backends to implement text_buffer_apply_edits
+bool text_buffer_sort_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count);
+void text_buffer_apply_line_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count);
+void text_buffer_apply_snapshot_line_edits(TextBuffer buffer, TextBufferSnapshotEdit *edits, u32 count);
+void text_buffer_measure_edits(TextBuffer buffer, const LineTreeEdit *edits, u32 count);
+
+// NOTE: columns are display columns with tabs expanded, offsets are relative
+// to the start of the line. With LINE_TREE_METRICS lines without tabs or
+// multi byte codepoints are mapped from the line tree alone, without text,
+// once the metrics are enabled by text_buffer_max_line_width
+u32 text_buffer_column_from_offset(TextBuffer buffer, u32 line, u64 offset);
+u64 text_buffer_offset_from_column(TextBuffer buffer, u32 line, u32 column);
+u32 text_buffer_max_line_width(TextBuffer buffer);
+// NOTE: called by the backends after an edit to update the metrics of the
+// lines that touch [index, index + count]
+void text_buffer_measure_lines(TextBuffer buffer, u64 index, u64 count);
+
+// NOTE: soft wrap in visual rows of wrap_columns display columns, 0 turns it
+// off. Changing the width measures and re-wraps nothing, text_buffer_wrap_lines
+// re-wraps the lines about to be shown and the rest keep their old row count,
+// one for a line never shown. Without LINE_TREE_METRICS wrapping is not
+// available and every line is one row
+void text_buffer_set_wrap_columns(TextBuffer buffer, u32 columns);
+u32 text_buffer_wrap_columns(TextBuffer buffer);
+void text_buffer_wrap_lines(TextBuffer buffer, u32 first_line, u32 count);
+u64 text_buffer_line_row(TextBuffer buffer, u32 line);
+bool text_buffer_find_row(TextBuffer buffer, u64 row, u32 *line, u32 *line_row);
+// NOTE: the visual row of an offset in a line and its column in that row
+u64 text_buffer_row_from_offset(TextBuffer buffer, u32 line, u64 offset, u32 *column);
+
+void text_buffer_chunks_begin(TextBufferChunks *chunks, TextBuffer buffer, u64 index, u64 count);
+bool text_buffer_chunks_next(TextBufferChunks *chunks);
+
+TextBufferSnapshot text_buffer_snapshot(TextBuffer buffer);
+// NOTE: a snapshot of count units at index, it starts at 0. The piece table
+// cuts it out of the tree in O(log pieces), the other backends copy the range
+TextBufferSnapshot text_buffer_snapshot_range(TextBuffer buffer, u64 index, u64 count);
+void text_buffer_snapshot_release(TextBufferSnapshot snapshot);
+// NOTE: the memory the snapshot keeps alive that the buffer would free
+// without it: the copy, or the pieces of a range that is no longer in the
+// buffer. Text in the piece table is never freed before the buffer
+u64 text_buffer_snapshot_memory(TextBufferSnapshot snapshot);
+// NOTE: what text_buffer_snapshot_memory would return for a snapshot of the
+// range, without taking it
+u64 text_buffer_snapshot_range_memory(TextBuffer buffer, u64 index, u64 count);
+u64 text_buffer_snapshot_size(TextBufferSnapshot snapshot);
+u32 text_buffer_snapshot_line_count(TextBufferSnapshot snapshot);
+bool text_buffer_snapshot_line(TextBufferSnapshot snapshot, u32 line, u64 *index, u32 *size);
+void text_buffer_snapshot_chunks_begin(TextBufferSnapshotChunks *chunks, TextBufferSnapshot snapshot, u64 index, u64 count);
+bool text_buffer_snapshot_chunks_next(TextBufferSnapshotChunks *chunks);
 
 #endif // _TEXT_BUFFER_H_
@@ -9,6 +9,8 @@ struct TextBuffer {
 	char *data;
 	u64 size;
 	u64 capacity;
+
+	LineTree lines;
 };
 
 TextBuffer text_buffer_create(void) {
@@ -16,18 +18,29 @@ TextBuffer text_buffer_create(void) {
 	buffer->size = 0;
 	buffer->capacity = TEXT_BUFFER_CAPACITY;
 	buffer->data = (char *)malloc(buffer->capacity);
+	line_tree_init(&buffer->lines);
+	return buffer;
+}
+
+TextBuffer text_buffer_create_from_bytes(const u8 *bytes, u64 size) {
+	TextBuffer buffer = text_buffer_create();
+	text_buffer_insert_bytes(buffer, 0, bytes, size);
 	return buffer;
 }
 
 void text_buffer_destroy(TextBuffer buffer) {
 	assert(buffer);
 	assert(buffer->data);
+	line_tree_destroy(&buffer->lines);
 	free(buffer->data);
 	free(buffer);
 }
 
-void text_buffer_grow(TextBuffer buffer) {
+void text_buffer_grow(TextBuffer buffer, u64 size) {
 	u64 new_capacity = buffer->capacity*2;
+	while(new_capacity < size) {
+		new_capacity *= 2;
+	}
 	char *data = (char *)realloc(buffer->data, new_capacity);
 	assert(data);
 	buffer->data = data;
@@ -38,83 +51,132 @@ u64 text_buffer_size(TextBuffer buffer) {
 	return buffer->size;
 }
 
-bool text_buffer_insert(TextBuffer buffer, u64 index, u32 code) {
+LineTree *text_buffer_line_tree(TextBuffer buffer) {
+	return &buffer->lines;
+}
+
+bool text_buffer_insert_bytes(TextBuffer buffer, u64 index, const u8 *bytes, u64 size) {
 	if(index > buffer->size) {
 		return false;
 	}
 	
-	u64 new_buffer_size = buffer->size + 1;
+	u64 new_buffer_size = buffer->size + size;
 	if(new_buffer_size > buffer->capacity) {
-		text_buffer_grow(buffer);
+		text_buffer_grow(buffer, new_buffer_size);
 	}
 	assert(new_buffer_size <= buffer->capacity);
 	
 	char *src = buffer->data + index;
-	char *dst = src + 1;
-	u64 bytes = buffer->size-index;
-	memmove(dst, src, bytes);
-	*src = (char)code;
+	char *dst = src + size;
+	memmove(dst, src, buffer->size-index);
+	memcpy(src, bytes, size);
 	buffer->size = new_buffer_size;
+	line_tree_insert_range(&buffer->lines, index, bytes, size);
+	text_buffer_measure_lines(buffer, index, size);
 	
 	return true;
 }
 
-bool text_buffer_delete(TextBuffer buffer, u64 index) {
-	if(buffer->size == 0 || index >= buffer->size) {
+bool text_buffer_delete_range(TextBuffer buffer, u64 index, u64 count) {
+	if(index + count > buffer->size) {
 		return false;
 	}
 
 	char *dst = buffer->data + index;
-	char *src = dst + 1;
-	u64 bytes = buffer->size-(index+1);
+	char *src = dst + count;
+	u64 bytes = buffer->size-(index+count);
 	memmove(dst, src, bytes);
-	buffer->size--;
+	buffer->size -= count;
+	line_tree_delete_range(&buffer->lines, index, count);
+	text_buffer_measure_lines(buffer, index, 0);
 
 	return true;
 }
 
+bool text_buffer_apply_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count) {
+	if(!text_buffer_sort_edits(buffer, edits, count)) {
+		return false;
+	}
+	u64 new_buffer_size = buffer->size;
+	for(u32 i = 0; i < count; i++) {
+		new_buffer_size += edits[i].size;
+		new_buffer_size -= edits[i].count;
+	}
+
+	// NOTE: moving the tail once per edit is O(size) each, the text is copied
+	// once into a new allocation instead
+	u64 new_capacity = buffer->capacity;
+	while(new_capacity < new_buffer_size) {
+		new_capacity *= 2;
+	}
+	char *data = (char *)malloc(new_capacity);
+	assert(data);
+	u64 src = 0;
+	u64 dst = 0;
+	for(u32 i = 0; i < count; i++) {
+		TextBufferEdit *edit = &edits[i];
+		memcpy(data + dst, buffer->data + src, edit->index - src);
+		dst += edit->index - src;
+		if(edit->size > 0) {
+			memcpy(data + dst, edit->bytes, edit->size);
+			dst += edit->size;
+		}
+		src = edit->index + edit->count;
+	}
+	memcpy(data + dst, buffer->data + src, buffer->size - src);
+	free(buffer->data);
+	buffer->data = data;
+	buffer->size = new_buffer_size;
+	buffer->capacity = new_capacity;
+
+	text_buffer_apply_line_edits(buffer, edits, count);
+	return true;
+}
+
+bool text_buffer_insert(TextBuffer buffer, u64 index, u32 code) {
+	u8 byte = (u8)code;
+	return text_buffer_insert_bytes(buffer, index, &byte, 1);
+}
+
+bool text_buffer_delete(TextBuffer buffer, u64 index) {
+	if(buffer->size == 0 || index >= buffer->size) {
+		return false;
+	}
+	return text_buffer_delete_range(buffer, index, 1);
+}
+
 u32 text_buffer_get(TextBuffer buffer, u64 index) {
 	assert(index < buffer->size);
 	return (u32)buffer->data[index];
 }
 
+void text_buffer_chunks_begin(TextBufferChunks *chunks, TextBuffer buffer, u64 index, u64 count) {
+	assert(index <= buffer->size);
+	chunks->buffer = buffer;
+	chunks->index = index;
+	chunks->end = index + min(count, buffer->size - index);
+	chunks->node = 0;
+	chunks->offset = 0;
+	chunks->data = 0;
+	chunks->size = 0;
+}
 
-bool text_buffer_line_index(TextBuffer buffer, u32 line, u64 *index) {
-	u32 curr_line = 0;
-	for(u64 i = 0; i < buffer->size; i++) {
-		if(line == curr_line) {
-			*index = i;
-			return true;
-		}
-		u32 code = (u32)buffer->data[i];
-		if(code == '\n') {
-			curr_line++;
-			if(curr_line > line) {
-				return false;
-			}
-		}
-	}
-
-	if(line == curr_line) {
-		*index = buffer->size;
-		return true;
+bool text_buffer_chunks_next(TextBufferChunks *chunks) {
+	if(chunks->index >= chunks->end) {
+		return false;
 	}
 
-	return false;
+	chunks->data = (const u8 *)chunks->buffer->data + chunks->index;
+	chunks->size = chunks->end - chunks->index;
+	chunks->index = chunks->end;
+	return true;
 }
 
 bool text_buffer_line(TextBuffer buffer, u32 line, u64 *index, u32 *size) {
-	if(!text_buffer_line_index(buffer, line, index)) {
+	u64 line_len;
+	if(!line_tree_find_line(&buffer->lines, line, index, &line_len)) {
 		return false;
 	}
-	u32 s = 0;
-	for(u64 i = *index; i < buffer->size; i++) {
-		u32 code = (u32)buffer->data[i];
-		if(code == '\n') {
-			break;
-		}
-		s++;
-	}
-	*size = s;
+	*size = (u32)line_len;
 	return true;
 }
@@ -0,0 +1,345 @@
+#include "text_buffer.h"
+#include "core/utf8.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: line measuring and column mapping for every backend, only the public
+// text buffer api is used. One index step is one codepoint in the utf-8
+// backend and one byte in the others, where text is still decoded as utf-8
+// for display.
+
+static u32 text_buffer_column_advance(u32 code, u32 column) {
+	if(code == (u32)'\t') {
+		return (column / TEXT_BUFFER_TAB_WIDTH + 1) * TEXT_BUFFER_TAB_WIDTH;
+	}
+	return column + 1;
+}
+
+static u64 text_buffer_index_step(u32 length) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	return 1;
+#else
+	return length;
+#endif
+}
+
+#if defined(LINE_TREE_METRICS)
+static void text_buffer_measure_line(TextBuffer buffer, u32 line, u32 *codepoints, u32 *width) {
+	u64 index;
+	u32 size;
+	bool found = text_buffer_line(buffer, line, &index, &size);
+	assert(found);
+
+	*codepoints = 0;
+	*width = 0;
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, index, size);
+	while(text_buffer_chunks_next(&chunks)) {
+		u64 i = 0;
+		while(i < chunks.size) {
+			u32 code;
+			i += utf8_decode(chunks.data + i, chunks.size - i, &code);
+			*codepoints += 1;
+			*width = text_buffer_column_advance(code, *width);
+		}
+	}
+}
+
+typedef struct TextBufferLineMetrics TextBufferLineMetrics;
+struct TextBufferLineMetrics {
+	u32 *codepoints;
+	u32 *widths;
+	u64 count;
+	u64 capacity;
+};
+
+static void text_buffer_line_metrics_push(TextBufferLineMetrics *metrics, u32 codepoints, u32 width) {
+	if(metrics->count == metrics->capacity) {
+		metrics->capacity = metrics->capacity ? metrics->capacity * 2 : 1024;
+		metrics->codepoints = (u32 *)realloc(metrics->codepoints, metrics->capacity * sizeof(u32));
+		metrics->widths = (u32 *)realloc(metrics->widths, metrics->capacity * sizeof(u32));
+		assert(metrics->codepoints && metrics->widths);
+	}
+	metrics->codepoints[metrics->count] = codepoints;
+	metrics->widths[metrics->count] = width;
+	metrics->count++;
+}
+
+// NOTE: one pass over the whole text, used when every line changed
+static void text_buffer_measure_all_lines(TextBuffer buffer) {
+	TextBufferLineMetrics metrics = {0};
+	u32 codepoints = 0;
+	u32 width = 0;
+
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, 0, text_buffer_size(buffer));
+	while(text_buffer_chunks_next(&chunks)) {
+		u64 i = 0;
+		while(i < chunks.size) {
+			u32 code;
+			i += utf8_decode(chunks.data + i, chunks.size - i, &code);
+			if(code == (u32)'\n') {
+				text_buffer_line_metrics_push(&metrics, codepoints, width);
+				codepoints = 0;
+				width = 0;
+			} else {
+				codepoints += 1;
+				width = text_buffer_column_advance(code, width);
+			}
+		}
+	}
+	text_buffer_line_metrics_push(&metrics, codepoints, width);
+
+	line_tree_set_all_line_metrics(text_buffer_line_tree(buffer), metrics.codepoints, metrics.widths, metrics.count);
+	free(metrics.codepoints);
+	free(metrics.widths);
+}
+
+// NOTE: the line tree metrics are enabled the first time the widest line is
+// asked for, the whole text is measured then
+static void text_buffer_enable_metrics(TextBuffer buffer) {
+	LineTree *lines = text_buffer_line_tree(buffer);
+	if(!line_tree_has_metrics(lines)) {
+		line_tree_enable_metrics(lines);
+		text_buffer_measure_all_lines(buffer);
+	}
+}
+
+// NOTE: edited lines are measured once the metrics are enabled or wrapping is
+// on, until then edits measure nothing
+static bool text_buffer_measures_lines(LineTree *lines) {
+	return line_tree_has_metrics(lines) || lines->wrap_columns > 0;
+}
+#endif
+
+void text_buffer_measure_lines(TextBuffer buffer, u64 index, u64 count) {
+#if defined(LINE_TREE_METRICS)
+	LineTree *lines = text_buffer_line_tree(buffer);
+	if(!text_buffer_measures_lines(lines)) {
+		return;
+	}
+	u32 first;
+	u32 last;
+	u64 col;
+	if(!line_tree_find_byte(lines, index, &first, &col) ||
+	   !line_tree_find_byte(lines, index + count, &last, &col)) {
+		return;
+	}
+
+	u64 line_index;
+	u32 line_size;
+	if(first == 0 && !text_buffer_line(buffer, last + 1, &line_index, &line_size)) {
+		// NOTE: without the metrics every line is just wrapped again when it is
+		// shown
+		if(line_tree_has_metrics(lines)) {
+			text_buffer_measure_all_lines(buffer);
+		} else {
+			line_tree_rewrap(lines);
+		}
+		return;
+	}
+
+	for(u32 line = first; line <= last; line++) {
+		u32 codepoints;
+		u32 width;
+		text_buffer_measure_line(buffer, line, &codepoints, &width);
+		line_tree_set_line_metrics(lines, line, codepoints, width);
+	}
+#endif
+}
+
+void text_buffer_measure_edits(TextBuffer buffer, const LineTreeEdit *edits, u32 count) {
+#if defined(LINE_TREE_METRICS)
+	// NOTE: the line tree gives the line every edit ended up in, lines touched
+	// by more than one edit are measured once
+	LineTree *lines = text_buffer_line_tree(buffer);
+	if(!text_buffer_measures_lines(lines)) {
+		return;
+	}
+	u32 next_line = 0;
+	for(u32 i = 0; i < count; i++) {
+		u32 first = edits[i].line;
+		u32 last = first + (u32)edits[i].newline_count;
+		for(u32 line = max(first, next_line); line <= last; line++) {
+			u32 codepoints;
+			u32 width;
+			text_buffer_measure_line(buffer, line, &codepoints, &width);
+			line_tree_set_line_metrics(lines, line, codepoints, width);
+		}
+		next_line = max(next_line, last + 1);
+	}
+#endif
+}
+
+u32 text_buffer_column_from_offset(TextBuffer buffer, u32 line, u64 offset) {
+	u64 index;
+	u32 size;
+	if(!text_buffer_line(buffer, line, &index, &size)) {
+		return 0;
+	}
+	offset = min(offset, (u64)size);
+
+#if defined(LINE_TREE_METRICS)
+	// NOTE: a line without tabs where every index step is one codepoint maps
+	// columns to offsets one to one
+	u64 codepoint_offset;
+	u32 codepoints;
+	u32 width;
+	if(line_tree_line_metrics(text_buffer_line_tree(buffer), line, &codepoint_offset, &codepoints, &width) &&
+	   width == codepoints && codepoints == size) {
+		return (u32)offset;
+	}
+#endif
+
+	u32 column = 0;
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, index, offset);
+	while(text_buffer_chunks_next(&chunks)) {
+		u64 i = 0;
+		while(i < chunks.size) {
+			u32 code;
+			i += utf8_decode(chunks.data + i, chunks.size - i, &code);
+			column = text_buffer_column_advance(code, column);
+		}
+	}
+	return column;
+}
+
+u64 text_buffer_offset_from_column(TextBuffer buffer, u32 line, u32 column) {
+	u64 index;
+	u32 size;
+	if(!text_buffer_line(buffer, line, &index, &size)) {
+		return 0;
+	}
+
+#if defined(LINE_TREE_METRICS)
+	u64 codepoint_offset;
+	u32 codepoints;
+	u32 width;
+	if(line_tree_line_metrics(text_buffer_line_tree(buffer), line, &codepoint_offset, &codepoints, &width) &&
+	   width == codepoints && codepoints == size) {
+		return min((u64)column, (u64)size);
+	}
+#endif
+
+	// NOTE: a column inside of a tab maps to the tab
+	u64 offset = 0;
+	u32 current = 0;
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, index, size);
+	while(text_buffer_chunks_next(&chunks)) {
+		u64 i = 0;
+		while(i < chunks.size) {
+			u32 code;
+			u32 length = utf8_decode(chunks.data + i, chunks.size - i, &code);
+			u32 next = text_buffer_column_advance(code, current);
+			if(next > column) {
+				return offset;
+			}
+			current = next;
+			offset += text_buffer_index_step(length);
+			i += length;
+		}
+	}
+	return offset;
+}
+
+u32 text_buffer_max_line_width(TextBuffer buffer) {
+#if defined(LINE_TREE_METRICS)
+	text_buffer_enable_metrics(buffer);
+	return line_tree_max_width(text_buffer_line_tree(buffer));
+#else
+	u32 result = 0;
+	u64 index;
+	u32 size;
+	for(u32 line = 0; text_buffer_line(buffer, line, &index, &size); line++) {
+		result = max(result, text_buffer_column_from_offset(buffer, line, size));
+	}
+	return result;
+#endif
+}
+
+void text_buffer_set_wrap_columns(TextBuffer buffer, u32 columns) {
+#if defined(LINE_TREE_METRICS)
+	line_tree_set_wrap_columns(text_buffer_line_tree(buffer), columns);
+#endif
+}
+
+u32 text_buffer_wrap_columns(TextBuffer buffer) {
+#if defined(LINE_TREE_METRICS)
+	return text_buffer_line_tree(buffer)->wrap_columns;
+#else
+	return 0;
+#endif
+}
+
+// NOTE: with the metrics the tree re-wraps from the widths it has, without
+// them only the stale lines among the ones about to be shown are measured
+void text_buffer_wrap_lines(TextBuffer buffer, u32 first_line, u32 count) {
+#if defined(LINE_TREE_METRICS)
+	LineTree *lines = text_buffer_line_tree(buffer);
+	if(lines->wrap_columns == 0) {
+		return;
+	}
+	if(line_tree_has_metrics(lines)) {
+		line_tree_wrap_lines(lines, first_line, count);
+		return;
+	}
+	u64 index;
+	u32 size;
+	for(u32 line = first_line; line - first_line < count && text_buffer_line(buffer, line, &index, &size); line++) {
+		if(!line_tree_line_wrapped(lines, line)) {
+			u32 codepoints;
+			u32 width;
+			text_buffer_measure_line(buffer, line, &codepoints, &width);
+			line_tree_set_line_metrics(lines, line, codepoints, width);
+		}
+	}
+#endif
+}
+
+u64 text_buffer_line_row(TextBuffer buffer, u32 line) {
+#if defined(LINE_TREE_METRICS)
+	u64 first_row;
+	u32 rows;
+	if(line_tree_line_rows(text_buffer_line_tree(buffer), line, &first_row, &rows)) {
+		return first_row;
+	}
+	return line_tree_row_count(text_buffer_line_tree(buffer));
+#else
+	return line;
+#endif
+}
+
+bool text_buffer_find_row(TextBuffer buffer, u64 row, u32 *line, u32 *line_row) {
+#if defined(LINE_TREE_METRICS)
+	return line_tree_find_row(text_buffer_line_tree(buffer), row, line, line_row);
+#else
+	u64 index;
+	u32 size;
+	*line = (u32)row;
+	*line_row = 0;
+	return text_buffer_line(buffer, *line, &index, &size);
+#endif
+}
+
+u64 text_buffer_row_from_offset(TextBuffer buffer, u32 line, u64 offset, u32 *column) {
+	u32 line_column = text_buffer_column_from_offset(buffer, line, offset);
+	*column = line_column;
+#if defined(LINE_TREE_METRICS)
+	LineTree *lines = text_buffer_line_tree(buffer);
+	text_buffer_wrap_lines(buffer, line, 1);
+	u64 first_row;
+	u32 rows;
+	if(lines->wrap_columns == 0 || !line_tree_line_rows(lines, line, &first_row, &rows)) {
+		return text_buffer_line_row(buffer, line);
+	}
+	// NOTE: the end of a line that fills its last row stays in that row
+	u32 row = min(line_column / lines->wrap_columns, rows - 1);
+	*column = line_column - row * lines->wrap_columns;
+	return first_row + row;
+#else
+	return line;
+#endif
+}
@@ -0,0 +1,185 @@
+#include "text_buffer.h"
+#include "core/scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: validation and the line tree side of batched edits for every
+// backend, they are measured by text_buffer_measure_edits in
+// text_buffer_columns.c
+
+u64 text_buffer_units(const u8 *bytes, u64 size) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	return scan_utf8_length(bytes, size);
+#else
+	return size;
+#endif
+}
+
+static int text_buffer_edit_compare(const void *a, const void *b) {
+	const TextBufferEdit *ea = (const TextBufferEdit *)a;
+	const TextBufferEdit *eb = (const TextBufferEdit *)b;
+	if(ea->index != eb->index) {
+		return ea->index < eb->index ? -1 : 1;
+	}
+	// NOTE: at the same index the inserts go before the deletes
+	if(ea->count != eb->count) {
+		return ea->count < eb->count ? -1 : 1;
+	}
+	return 0;
+}
+
+// NOTE: inserts at the same index go in the order they were given, so the
+// sort has to be stable. A bottom up merge sort, cursors come in order most
+// of the time and then it is only the first check
+static void text_buffer_edits_stable_sort(TextBufferEdit *edits, u32 count) {
+	u32 sorted = 1;
+	while(sorted < count && text_buffer_edit_compare(&edits[sorted-1], &edits[sorted]) <= 0) {
+		sorted++;
+	}
+	if(sorted >= count) {
+		return;
+	}
+
+	TextBufferEdit *scratch = (TextBufferEdit *)malloc(count * sizeof(*scratch));
+	assert(scratch);
+	TextBufferEdit *from = edits;
+	TextBufferEdit *to = scratch;
+	for(u64 width = 1; width < count; width *= 2) {
+		for(u64 lo = 0; lo < count; lo += 2 * width) {
+			u64 mid = min(lo + width, (u64)count);
+			u64 hi = min(lo + 2 * width, (u64)count);
+			u64 a = lo;
+			u64 b = mid;
+			u64 out = lo;
+			while(a < mid && b < hi) {
+				// NOTE: ties take the left run first, it came first
+				if(text_buffer_edit_compare(&from[b], &from[a]) < 0) {
+					to[out++] = from[b++];
+				} else {
+					to[out++] = from[a++];
+				}
+			}
+			while(a < mid) {
+				to[out++] = from[a++];
+			}
+			while(b < hi) {
+				to[out++] = from[b++];
+			}
+		}
+		TextBufferEdit *swap = from;
+		from = to;
+		to = swap;
+	}
+	if(from != edits) {
+		memcpy(edits, from, count * sizeof(*edits));
+	}
+	free(scratch);
+}
+
+bool text_buffer_sort_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count) {
+	text_buffer_edits_stable_sort(edits, count);
+
+	u64 end = 0;
+	u64 size = text_buffer_size(buffer);
+	for(u32 i = 0; i < count; i++) {
+		TextBufferEdit *edit = &edits[i];
+		if(edit->index < end || edit->index + edit->count > size) {
+			return false;
+		}
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+		if(!scan_utf8_valid(edit->bytes, edit->size)) {
+			return false;
+		}
+#endif
+		end = edit->index + edit->count;
+	}
+	return true;
+}
+
+// NOTE: writes the new lines of the bytes as offsets from base in the units
+// of the line tree, returns the count
+static u64 text_buffer_collect_newlines(const u8 *bytes, u64 size, u64 base, u64 *offsets) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	u64 count = scan_collect_byte(bytes, size, '\n', 0, offsets);
+	u64 byte_offset = 0;
+	u64 unit_offset = base;
+	for(u64 i = 0; i < count; i++) {
+		unit_offset += scan_utf8_length(bytes + byte_offset, offsets[i] - byte_offset);
+		byte_offset = offsets[i];
+		offsets[i] = unit_offset;
+	}
+	return count;
+#else
+	return scan_collect_byte(bytes, size, '\n', base, offsets);
+#endif
+}
+
+// NOTE: the new lines of every edit go in one array in the units of the
+// line tree and the tree is changed in one pass, the text must already be
+// changed so the touched lines can be measured
+void text_buffer_apply_line_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count) {
+	u64 newlines = 0;
+	for(u32 i = 0; i < count; i++) {
+		newlines += scan_count_byte(edits[i].bytes, edits[i].size, '\n');
+	}
+	u64 *newline_offsets = (u64 *)malloc(max(newlines, (u64)1) * sizeof(*newline_offsets));
+	LineTreeEdit *line_edits = (LineTreeEdit *)malloc(max(count, 1u) * sizeof(*line_edits));
+	assert(newline_offsets && line_edits);
+
+	u64 *offsets = newline_offsets;
+	for(u32 i = 0; i < count; i++) {
+		TextBufferEdit *edit = &edits[i];
+		LineTreeEdit *line_edit = &line_edits[i];
+		line_edit->byte_offset = edit->index;
+		line_edit->count = edit->count;
+		line_edit->size = text_buffer_units(edit->bytes, edit->size);
+		line_edit->newline_offsets = offsets;
+		line_edit->newline_count = text_buffer_collect_newlines(edit->bytes, edit->size, 0, offsets);
+		offsets += line_edit->newline_count;
+	}
+
+	line_tree_apply_edits(text_buffer_line_tree(buffer), line_edits, count);
+	text_buffer_measure_edits(buffer, line_edits, count);
+	free(line_edits);
+	free(newline_offsets);
+}
+
+// NOTE: the same with the new lines read from the chunks of the snapshots
+void text_buffer_apply_snapshot_line_edits(TextBuffer buffer, TextBufferSnapshotEdit *edits, u32 count) {
+	u64 newlines = 0;
+	for(u32 i = 0; i < count; i++) {
+		if(edits[i].text) {
+			newlines += text_buffer_snapshot_line_count(edits[i].text) - 1;
+		}
+	}
+	u64 *newline_offsets = (u64 *)malloc(max(newlines, (u64)1) * sizeof(*newline_offsets));
+	LineTreeEdit *line_edits = (LineTreeEdit *)malloc(max(count, 1u) * sizeof(*line_edits));
+	assert(newline_offsets && line_edits);
+
+	u64 *offsets = newline_offsets;
+	for(u32 i = 0; i < count; i++) {
+		TextBufferSnapshotEdit *edit = &edits[i];
+		LineTreeEdit *line_edit = &line_edits[i];
+		line_edit->byte_offset = edit->index;
+		line_edit->count = edit->count;
+		line_edit->size = 0;
+		line_edit->newline_offsets = offsets;
+		line_edit->newline_count = 0;
+		if(edit->text) {
+			TextBufferSnapshotChunks chunks;
+			text_buffer_snapshot_chunks_begin(&chunks, edit->text, 0, text_buffer_snapshot_size(edit->text));
+			while(text_buffer_snapshot_chunks_next(&chunks)) {
+				line_edit->newline_count += text_buffer_collect_newlines(chunks.data, chunks.size, line_edit->size,
+				                                                         offsets + line_edit->newline_count);
+				line_edit->size = chunks.index;
+			}
+		}
+		offsets += line_edit->newline_count;
+	}
+
+	line_tree_apply_edits(text_buffer_line_tree(buffer), line_edits, count);
+	text_buffer_measure_edits(buffer, line_edits, count);
+	free(line_edits);
+	free(newline_offsets);
+}
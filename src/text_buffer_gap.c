@@ -0,0 +1,213 @@
+#include "text_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: gap buffer text buffer. The text lives in one allocation split in two
+// by a gap: [0, gap_start) is the text before the gap and [gap_end, capacity)
+// is the text after it. The gap only moves when an edit happens somewhere
+// else, so runs of typing or deleting at the same spot cost O(1) per byte.
+
+#define TEXT_BUFFER_CAPACITY 4096
+
+struct TextBuffer {
+	u8 *data;
+	u64 gap_start;
+	u64 gap_end;
+	u64 capacity;
+
+	LineTree lines;
+};
+
+TextBuffer text_buffer_create(void) {
+	TextBuffer buffer = (TextBuffer)malloc(sizeof(*buffer));
+	assert(buffer);
+	buffer->capacity = TEXT_BUFFER_CAPACITY;
+	buffer->data = (u8 *)malloc(buffer->capacity);
+	assert(buffer->data);
+	buffer->gap_start = 0;
+	buffer->gap_end = buffer->capacity;
+	line_tree_init(&buffer->lines);
+	return buffer;
+}
+
+TextBuffer text_buffer_create_from_bytes(const u8 *bytes, u64 size) {
+	TextBuffer buffer = text_buffer_create();
+	text_buffer_insert_bytes(buffer, 0, bytes, size);
+	return buffer;
+}
+
+void text_buffer_destroy(TextBuffer buffer) {
+	assert(buffer);
+	assert(buffer->data);
+	line_tree_destroy(&buffer->lines);
+	free(buffer->data);
+	free(buffer);
+}
+
+u64 text_buffer_size(TextBuffer buffer) {
+	return buffer->capacity - (buffer->gap_end - buffer->gap_start);
+}
+
+LineTree *text_buffer_line_tree(TextBuffer buffer) {
+	return &buffer->lines;
+}
+
+static u64 text_buffer_gap_size(TextBuffer buffer) {
+	return buffer->gap_end - buffer->gap_start;
+}
+
+static void text_buffer_gap_move(TextBuffer buffer, u64 index) {
+	if(index < buffer->gap_start) {
+		u64 bytes = buffer->gap_start - index;
+		memmove(buffer->data + buffer->gap_end - bytes, buffer->data + index, bytes);
+		buffer->gap_start -= bytes;
+		buffer->gap_end -= bytes;
+	} else if(index > buffer->gap_start) {
+		u64 bytes = index - buffer->gap_start;
+		memmove(buffer->data + buffer->gap_start, buffer->data + buffer->gap_end, bytes);
+		buffer->gap_start += bytes;
+		buffer->gap_end += bytes;
+	}
+}
+
+static void text_buffer_gap_reserve(TextBuffer buffer, u64 size) {
+	if(text_buffer_gap_size(buffer) >= size) {
+		return;
+	}
+
+	u64 text_size = text_buffer_size(buffer);
+	u64 new_capacity = buffer->capacity*2;
+	while(new_capacity - text_size < size) {
+		new_capacity *= 2;
+	}
+
+	u8 *data = (u8 *)realloc(buffer->data, new_capacity);
+	assert(data);
+
+	u64 tail = buffer->capacity - buffer->gap_end;
+	memmove(data + new_capacity - tail, data + buffer->gap_end, tail);
+	buffer->data = data;
+	buffer->gap_end = new_capacity - tail;
+	buffer->capacity = new_capacity;
+}
+
+bool text_buffer_insert_bytes(TextBuffer buffer, u64 index, const u8 *bytes, u64 size) {
+	if(index > text_buffer_size(buffer)) {
+		return false;
+	}
+
+	text_buffer_gap_reserve(buffer, size);
+	text_buffer_gap_move(buffer, index);
+	memcpy(buffer->data + buffer->gap_start, bytes, size);
+	buffer->gap_start += size;
+	line_tree_insert_range(&buffer->lines, index, bytes, size);
+	text_buffer_measure_lines(buffer, index, size);
+
+	return true;
+}
+
+bool text_buffer_delete_range(TextBuffer buffer, u64 index, u64 count) {
+	if(index + count > text_buffer_size(buffer)) {
+		return false;
+	}
+
+	// NOTE: a range that ends right at the gap is removed by growing the gap
+	// backwards, everything else moves the gap to the start of the range
+	if(index + count == buffer->gap_start) {
+		buffer->gap_start -= count;
+	} else {
+		text_buffer_gap_move(buffer, index);
+		buffer->gap_end += count;
+	}
+	line_tree_delete_range(&buffer->lines, index, count);
+	text_buffer_measure_lines(buffer, index, 0);
+
+	return true;
+}
+
+bool text_buffer_apply_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count) {
+	if(!text_buffer_sort_edits(buffer, edits, count)) {
+		return false;
+	}
+	u64 grow = 0;
+	for(u32 i = 0; i < count; i++) {
+		grow += edits[i].size;
+	}
+	text_buffer_gap_reserve(buffer, grow);
+
+	// NOTE: the gap only moves down while the edits are applied from the last
+	// one, so it crosses the text between the edits once
+	for(u32 i = count; i-- > 0;) {
+		TextBufferEdit *edit = &edits[i];
+		text_buffer_gap_move(buffer, edit->index + edit->count);
+		buffer->gap_start -= edit->count;
+		if(edit->size > 0) {
+			memcpy(buffer->data + buffer->gap_start, edit->bytes, edit->size);
+			buffer->gap_start += edit->size;
+		}
+	}
+	text_buffer_apply_line_edits(buffer, edits, count);
+	return true;
+}
+
+bool text_buffer_insert(TextBuffer buffer, u64 index, u32 code) {
+	u8 byte = (u8)code;
+	return text_buffer_insert_bytes(buffer, index, &byte, 1);
+}
+
+bool text_buffer_delete(TextBuffer buffer, u64 index) {
+	u64 size = text_buffer_size(buffer);
+	if(size == 0 || index >= size) {
+		return false;
+	}
+
+	return text_buffer_delete_range(buffer, index, 1);
+}
+
+u32 text_buffer_get(TextBuffer buffer, u64 index) {
+	assert(index < text_buffer_size(buffer));
+	if(index >= buffer->gap_start) {
+		index += text_buffer_gap_size(buffer);
+	}
+	return (u32)buffer->data[index];
+}
+
+// NOTE: at most two chunks, the text before the gap and the text after it
+void text_buffer_chunks_begin(TextBufferChunks *chunks, TextBuffer buffer, u64 index, u64 count) {
+	u64 size = text_buffer_size(buffer);
+	assert(index <= size);
+	chunks->buffer = buffer;
+	chunks->index = index;
+	chunks->end = index + min(count, size - index);
+	chunks->node = 0;
+	chunks->offset = 0;
+	chunks->data = 0;
+	chunks->size = 0;
+}
+
+bool text_buffer_chunks_next(TextBufferChunks *chunks) {
+	if(chunks->index >= chunks->end) {
+		return false;
+	}
+
+	TextBuffer buffer = chunks->buffer;
+	if(chunks->index < buffer->gap_start) {
+		chunks->data = buffer->data + chunks->index;
+		chunks->size = min(buffer->gap_start, chunks->end) - chunks->index;
+	} else {
+		chunks->data = buffer->data + chunks->index + text_buffer_gap_size(buffer);
+		chunks->size = chunks->end - chunks->index;
+	}
+	chunks->index += chunks->size;
+	return true;
+}
+
+bool text_buffer_line(TextBuffer buffer, u32 line, u64 *index, u32 *size) {
+	u64 line_len;
+	if(!line_tree_find_line(&buffer->lines, line, index, &line_len)) {
+		return false;
+	}
+	*size = (u32)line_len;
+	return true;
+}
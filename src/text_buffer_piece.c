@@ -0,0 +1,929 @@
+#include "text_buffer.h"
+#include "line_index.h"
+#include "core/scan.h"
+#include "core/utf8.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: piece table text buffer. The text is described by a sequence of pieces
+// that point either into the original (read only) buffer or into the added
+// text, which is append only. Pieces are kept in a treap ordered by position,
+// every node stores the bytes and new lines of its subtree so finding the
+// piece that contains a byte index or a line is O(log pieces) and edits never
+// move text.
+//
+// The tree is persistent: pieces are reference counted and an edit copies the
+// shared pieces on its path before changing them (path copying), so a
+// snapshot is the root plus a reference and the buffer and its snapshots share
+// every piece the edits since did not touch. A piece with one reference
+// belongs to one tree and is edited in place, without snapshots nothing is
+// ever copied. The added text lives in fixed blocks that never move and are
+// shared the same way. Pieces are at most TEXT_BUFFER_PIECE_MAX_SIZE bytes so
+// the new lines of a piece that is cut are counted with a short scan. Loading
+// and the added text cut pieces at the start of a codepoint, so the chunks the
+// decoders read never end in the middle of one.
+//
+// With TEXT_BUFFER_BACKEND_UTF8 this is the utf-8 backend: every index, size
+// and count of the api is in codepoints. Pieces also keep their codepoints and
+// the tree their sum, so the piece of a codepoint is found the same way and
+// the byte inside of it with a short scan.
+
+#define TEXT_BUFFER_PIECE_MAX_SIZE (16 << 10)
+
+typedef struct Piece Piece;
+struct Piece {
+	Piece *l;
+	Piece *r;
+
+	const u8 *data;
+	u64 length;
+	u64 newlines;
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	u64 codepoints;
+#endif
+
+	// NOTE: sums of the subtree
+	u64 size;
+	u64 lines;
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	u64 codepoint_size;
+#endif
+
+	u32 priority;
+	u32 refs;
+};
+
+typedef struct TextBufferBlock TextBufferBlock;
+struct TextBufferBlock {
+	TextBufferBlock *next;
+	u64 used;
+	u8 data[TEXT_BUFFER_PIECE_MAX_SIZE];
+};
+
+// NOTE: the added text, owned by the buffer and every snapshot of it and freed
+// with the last one
+typedef struct TextBufferStore TextBufferStore;
+struct TextBufferStore {
+	u32 refs;
+	// NOTE: newest first, new text is only appended to the first block
+	TextBufferBlock *blocks;
+};
+
+struct TextBuffer {
+	const u8 *original;
+	u64 original_size;
+
+	TextBufferStore *store;
+	Piece *root;
+	u32 seed;
+
+	LineTree lines;
+};
+
+struct TextBufferSnapshot {
+	Piece *root;
+	TextBufferStore *store;
+};
+
+// NOTE: units is the length in the units of the api, only the utf-8 build
+// keeps it apart from the bytes
+static Piece *piece_create(TextBuffer buffer, const u8 *data, u64 length, u64 units, u64 newlines) {
+	Piece *piece = (Piece *)malloc(sizeof(*piece));
+	assert(piece);
+	piece->l = 0;
+	piece->r = 0;
+	piece->data = data;
+	piece->length = length;
+	piece->newlines = newlines;
+	piece->size = length;
+	piece->lines = newlines;
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	piece->codepoints = units;
+	piece->codepoint_size = units;
+#else
+	assert(units == length);
+#endif
+
+	// NOTE: xorshift, the priorities only have to look random to keep the
+	// treap balanced
+	u32 x = buffer->seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	buffer->seed = x;
+	piece->priority = x;
+	piece->refs = 1;
+	return piece;
+}
+
+static void piece_retain(Piece *piece) {
+	if(piece) {
+		piece->refs++;
+	}
+}
+
+static void piece_release(Piece *piece) {
+	if(!piece) {
+		return;
+	}
+	assert(piece->refs > 0);
+	if(--piece->refs == 0) {
+		piece_release(piece->l);
+		piece_release(piece->r);
+		free(piece);
+	}
+}
+
+// NOTE: returns a piece that can be changed in place, a copy when the piece is
+// shared. Takes the caller reference
+static Piece *piece_unique(Piece *piece) {
+	if(piece->refs == 1) {
+		return piece;
+	}
+	Piece *copy = (Piece *)malloc(sizeof(*copy));
+	assert(copy);
+	*copy = *piece;
+	copy->refs = 1;
+	piece_retain(copy->l);
+	piece_retain(copy->r);
+	piece->refs--;
+	return copy;
+}
+
+static u64 piece_size(Piece *piece) {
+	return piece ? piece->size : 0;
+}
+
+static u64 piece_lines(Piece *piece) {
+	return piece ? piece->lines : 0;
+}
+
+// NOTE: the length of the subtree and of the piece itself in the units of
+// the api
+static u64 piece_units(Piece *piece) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	return piece ? piece->codepoint_size : 0;
+#else
+	return piece_size(piece);
+#endif
+}
+
+static u64 piece_length(Piece *piece) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	return piece->codepoints;
+#else
+	return piece->length;
+#endif
+}
+
+// NOTE: the byte of the unit offset inside of the piece, pieces that are all
+// ascii need no scan
+static u64 piece_byte_offset(Piece *piece, u64 offset) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	if(piece->codepoints != piece->length) {
+		return scan_utf8_offset(piece->data, piece->length, offset);
+	}
+#endif
+	return offset;
+}
+
+static void piece_update(Piece *piece) {
+	piece->size = piece_size(piece->l) + piece->length + piece_size(piece->r);
+	piece->lines = piece_lines(piece->l) + piece->newlines + piece_lines(piece->r);
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	piece->codepoint_size = piece_units(piece->l) + piece->codepoints + piece_units(piece->r);
+#endif
+}
+
+// NOTE: joins two trees, every piece of a goes before every piece of b. Takes
+// both references
+static Piece *piece_merge(Piece *a, Piece *b) {
+	if(!a) {
+		return b;
+	}
+	if(!b) {
+		return a;
+	}
+	if(a->priority > b->priority) {
+		a = piece_unique(a);
+		a->r = piece_merge(a->r, b);
+		piece_update(a);
+		return a;
+	}
+	b = piece_unique(b);
+	b->l = piece_merge(a, b->l);
+	piece_update(b);
+	return b;
+}
+
+// NOTE: splits the tree in the first index units and the rest, the piece that
+// contains index is cut in two. Takes the reference of the tree
+static void piece_split(TextBuffer buffer, Piece *tree, u64 index, Piece **l, Piece **r) {
+	if(!tree) {
+		*l = 0;
+		*r = 0;
+		return;
+	}
+
+	tree = piece_unique(tree);
+	u64 left = piece_units(tree->l);
+	u64 length = piece_length(tree);
+	if(index <= left) {
+		piece_split(buffer, tree->l, index, l, &tree->l);
+		piece_update(tree);
+		*r = tree;
+	} else if(index >= left + length) {
+		piece_split(buffer, tree->r, index - left - length, &tree->r, r);
+		piece_update(tree);
+		*l = tree;
+	} else {
+		// NOTE: the new lines of the shorter side are counted
+		u64 offset = index - left;
+		u64 byte_offset = piece_byte_offset(tree, offset);
+		u64 head_newlines;
+		if(byte_offset < tree->length / 2) {
+			head_newlines = scan_count_byte(tree->data, byte_offset, '\n');
+		} else {
+			head_newlines = tree->newlines - scan_count_byte(tree->data + byte_offset, tree->length - byte_offset, '\n');
+		}
+		Piece *tail = piece_create(buffer, tree->data + byte_offset, tree->length - byte_offset, length - offset,
+		                           tree->newlines - head_newlines);
+		tree->length = byte_offset;
+		tree->newlines = head_newlines;
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+		tree->codepoints = offset;
+#endif
+		*r = piece_merge(tail, tree->r);
+		tree->r = 0;
+		piece_update(tree);
+		*l = tree;
+	}
+}
+
+// NOTE: inserts a single piece at index, the tree is only split below the
+// place the priority of the piece puts it. Takes the reference of the tree
+static Piece *piece_insert_node(TextBuffer buffer, Piece *tree, u64 index, Piece *piece) {
+	if(!tree) {
+		return piece;
+	}
+	if(piece->priority > tree->priority) {
+		piece_split(buffer, tree, index, &piece->l, &piece->r);
+		piece_update(piece);
+		return piece;
+	}
+
+	tree = piece_unique(tree);
+	u64 left = piece_units(tree->l);
+	u64 length = piece_length(tree);
+	if(index <= left) {
+		tree->l = piece_insert_node(buffer, tree->l, index, piece);
+	} else if(index >= left + length) {
+		tree->r = piece_insert_node(buffer, tree->r, index - left - length, piece);
+	} else {
+		Piece *l;
+		Piece *r;
+		piece_split(buffer, tree, index, &l, &r);
+		return piece_merge(piece_merge(l, piece), r);
+	}
+	piece_update(tree);
+	return tree;
+}
+
+// NOTE: returns the piece that contains `index` and the offset inside of it,
+// both in units, index must be smaller than the size of the tree
+static Piece *piece_find(Piece *node, u64 index, u64 *offset) {
+	assert(index < piece_units(node));
+	while(node) {
+		u64 left = piece_units(node->l);
+		if(index < left) {
+			node = node->l;
+		} else {
+			index -= left;
+			u64 length = piece_length(node);
+			if(index < length) {
+				*offset = index;
+				return node;
+			}
+			index -= length;
+			node = node->r;
+		}
+	}
+	assert(!"unreachable");
+	return 0;
+}
+
+// NOTE: index of the new line n, zero based, n must be smaller than the new
+// lines of the tree
+static u64 piece_find_newline(Piece *node, u64 n) {
+	assert(n < piece_lines(node));
+	u64 base = 0;
+	while(node) {
+		u64 left = piece_lines(node->l);
+		if(n < left) {
+			node = node->l;
+		} else {
+			base += piece_units(node->l);
+			n -= left;
+			if(n < node->newlines) {
+				const u8 *newline = scan_find_nth_byte(node->data, node->length, '\n', n);
+				assert(newline);
+				return base + text_buffer_units(node->data, (u64)(newline - node->data));
+			}
+			n -= node->newlines;
+			base += piece_length(node);
+			node = node->r;
+		}
+	}
+	assert(!"unreachable");
+	return 0;
+}
+
+// NOTE: the start of the line comes from the tree and its end from a scan,
+// lines are short next to the pieces
+static bool piece_find_line(Piece *root, u32 line, u64 *index, u64 *size) {
+	u64 lines = piece_lines(root);
+	if(line > lines) {
+		return false;
+	}
+	u64 start = line > 0 ? piece_find_newline(root, line - 1) + 1 : 0;
+	u64 end = piece_units(root);
+	if(line < lines) {
+		u64 offset;
+		Piece *piece = piece_find(root, start, &offset);
+		const u8 *data = piece->data + piece_byte_offset(piece, offset);
+		const u8 *newline = (const u8 *)memchr(data, '\n', (u64)(piece->data + piece->length - data));
+		if(newline) {
+			end = start + text_buffer_units(data, (u64)(newline - data));
+		} else {
+			end = piece_find_newline(root, line);
+		}
+	}
+	*index = start;
+	*size = end - start;
+	return true;
+}
+
+// NOTE: grows the piece that ends at index by size bytes that are already
+// right after it in its block
+static Piece *piece_grow(Piece *node, u64 index, u64 size, u64 units, u64 newlines) {
+	node = piece_unique(node);
+	u64 left = piece_units(node->l);
+	u64 length = piece_length(node);
+	if(index <= left) {
+		node->l = piece_grow(node->l, index, size, units, newlines);
+	} else if(index == left + length) {
+		node->length += size;
+		node->newlines += newlines;
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+		node->codepoints += units;
+#endif
+	} else {
+		node->r = piece_grow(node->r, index - left - length, size, units, newlines);
+	}
+	node->size += size;
+	node->lines += newlines;
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	node->codepoint_size += units;
+#endif
+	return node;
+}
+
+// NOTE: how many of the bytes fit in a piece of at most available bytes, the
+// cut moves back to the start of a codepoint. A codepoint is at most 4 bytes,
+// bytes that are not utf-8 (the byte build takes any) are cut where they are
+static u64 piece_fit(const u8 *bytes, u64 size, u64 available) {
+	if(size <= available) {
+		return size;
+	}
+	u64 fit = available;
+	while(fit > 0 && available - fit < 3 && (bytes[fit] & 0xc0) == 0x80) {
+		fit--;
+	}
+	return (bytes[fit] & 0xc0) == 0x80 ? available : fit;
+}
+
+static void text_buffer_store_release(TextBufferStore *store) {
+	assert(store->refs > 0);
+	if(--store->refs == 0) {
+		TextBufferBlock *block = store->blocks;
+		while(block) {
+			TextBufferBlock *next = block->next;
+			free(block);
+			block = next;
+		}
+		free(store);
+	}
+}
+
+// NOTE: copies as many of the bytes as fit in the current block, a full block
+// is never written again
+static const u8 *text_buffer_store_add(TextBufferStore *store, const u8 *bytes, u64 size, u64 *added) {
+	TextBufferBlock *block = store->blocks;
+	if(!block || piece_fit(bytes, size, TEXT_BUFFER_PIECE_MAX_SIZE - block->used) == 0) {
+		block = (TextBufferBlock *)malloc(sizeof(*block));
+		assert(block);
+		block->next = store->blocks;
+		block->used = 0;
+		store->blocks = block;
+	}
+	*added = piece_fit(bytes, size, TEXT_BUFFER_PIECE_MAX_SIZE - block->used);
+	u8 *data = block->data + block->used;
+	memcpy(data, bytes, *added);
+	block->used += *added;
+	return data;
+}
+
+TextBuffer text_buffer_create(void) {
+	TextBuffer buffer = (TextBuffer)malloc(sizeof(*buffer));
+	assert(buffer);
+	buffer->original = 0;
+	buffer->original_size = 0;
+
+	buffer->store = (TextBufferStore *)malloc(sizeof(*buffer->store));
+	assert(buffer->store);
+	buffer->store->refs = 1;
+	buffer->store->blocks = 0;
+
+	buffer->root = 0;
+	buffer->seed = 0x9e3779b9;
+
+	line_tree_init(&buffer->lines);
+	return buffer;
+}
+
+// NOTE: the line tree of the utf-8 build counts codepoints, the new lines of
+// the inserted bytes are found by byte and their offsets converted before
+// going into the tree
+static void text_buffer_lines_insert(TextBuffer buffer, u64 index, const u8 *bytes, u64 size) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	LineTree *lines = &buffer->lines;
+	u64 codepoints = scan_utf8_length(bytes, size);
+	u64 newlines = scan_count_byte(bytes, size, '\n');
+	if(newlines == 0) {
+		line_tree_insert_offsets(lines, index, codepoints, 0, 0);
+	} else {
+		u64 *newline_offsets = (u64 *)malloc(newlines * sizeof(*newline_offsets));
+		assert(newline_offsets);
+		scan_collect_byte(bytes, size, '\n', 0, newline_offsets);
+		u64 byte_offset = 0;
+		u64 codepoint_offset = index;
+		for(u64 i = 0; i < newlines; i++) {
+			codepoint_offset += scan_utf8_length(bytes + byte_offset, newline_offsets[i] - byte_offset);
+			byte_offset = newline_offsets[i];
+			newline_offsets[i] = codepoint_offset;
+		}
+		line_tree_insert_offsets(lines, index, codepoints, newline_offsets, newlines);
+		free(newline_offsets);
+	}
+	text_buffer_measure_lines(buffer, index, codepoints);
+#else
+	line_tree_insert_range(&buffer->lines, index, bytes, size);
+	text_buffer_measure_lines(buffer, index, size);
+#endif
+}
+
+// NOTE: the utf-8 build validates the bytes and rejects them if they are not
+// utf-8
+TextBuffer text_buffer_create_from_bytes(const u8 *bytes, u64 size) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	TextBuffer buffer = text_buffer_create();
+	buffer->original = bytes;
+	buffer->original_size = size;
+	if(size > 0) {
+		// NOTE: the pieces are cut first, a piece is at most 3 bytes short. The
+		// line index validates the bytes and turns the ends of the pieces into
+		// codepoints on its workers, then the new lines before an end are its
+		// line in the line tree like in the byte build
+		u64 *cuts = (u64 *)malloc((size / (TEXT_BUFFER_PIECE_MAX_SIZE - 3) + 1) * sizeof(*cuts));
+		assert(cuts);
+		u64 piece_count = 0;
+		for(u64 start = 0; start < size; start = cuts[piece_count++]) {
+			cuts[piece_count] = start + piece_fit(bytes + start, size - start, TEXT_BUFFER_PIECE_MAX_SIZE);
+		}
+		u64 *ends = (u64 *)malloc(piece_count * sizeof(*ends));
+		assert(ends);
+		memcpy(ends, cuts, piece_count * sizeof(*ends));
+		if(!line_index_build_utf8(&buffer->lines, bytes, size, cuts, piece_count)) {
+			free(ends);
+			free(cuts);
+			text_buffer_destroy(buffer);
+			return 0;
+		}
+
+		u64 start = 0;
+		u64 codepoint_start = 0;
+		u32 line_start = 0;
+		for(u64 i = 0; i < piece_count; i++) {
+			u32 line_end;
+			u64 column;
+			line_tree_find_byte(&buffer->lines, cuts[i], &line_end, &column);
+			Piece *piece = piece_create(buffer, bytes + start, ends[i] - start, cuts[i] - codepoint_start,
+			                            line_end - line_start);
+			buffer->root = piece_merge(buffer->root, piece);
+			start = ends[i];
+			codepoint_start = cuts[i];
+			line_start = line_end;
+		}
+		free(ends);
+		free(cuts);
+		text_buffer_measure_lines(buffer, 0, codepoint_start);
+	}
+	return buffer;
+#else
+	TextBuffer buffer = text_buffer_create();
+	buffer->original = bytes;
+	buffer->original_size = size;
+	if(size > 0) {
+		line_index_build(&buffer->lines, bytes, size);
+
+		// NOTE: the new lines before a byte are its line in the line tree, so
+		// the pieces are counted without reading the text again
+		u32 line_start = 0;
+		for(u64 start = 0; start < size;) {
+			u64 length = piece_fit(bytes + start, size - start, TEXT_BUFFER_PIECE_MAX_SIZE);
+			u32 line_end;
+			u64 column;
+			line_tree_find_byte(&buffer->lines, start + length, &line_end, &column);
+			Piece *piece = piece_create(buffer, bytes + start, length, length, line_end - line_start);
+			buffer->root = piece_merge(buffer->root, piece);
+			line_start = line_end;
+			start += length;
+		}
+		text_buffer_measure_lines(buffer, 0, size);
+	}
+	return buffer;
+#endif
+}
+
+void text_buffer_destroy(TextBuffer buffer) {
+	assert(buffer);
+	assert(buffer->store);
+	piece_release(buffer->root);
+	text_buffer_store_release(buffer->store);
+	line_tree_destroy(&buffer->lines);
+	free(buffer);
+}
+
+u64 text_buffer_size(TextBuffer buffer) {
+	return piece_units(buffer->root);
+}
+
+LineTree *text_buffer_line_tree(TextBuffer buffer) {
+	return &buffer->lines;
+}
+
+static void piece_insert(TextBuffer buffer, u64 index, const u8 *bytes, u64 size) {
+	if(size == 0) {
+		return;
+	}
+
+	// NOTE: typing at the end of the last added piece just extends it
+	TextBufferBlock *block = buffer->store->blocks;
+	if(index > 0 && block && block->used + size <= TEXT_BUFFER_PIECE_MAX_SIZE) {
+		u64 offset;
+		Piece *piece = piece_find(buffer->root, index-1, &offset);
+		if(offset + 1 == piece_length(piece) && piece->data + piece->length == block->data + block->used &&
+		   piece->length + size <= TEXT_BUFFER_PIECE_MAX_SIZE) {
+			u64 added;
+			text_buffer_store_add(buffer->store, bytes, size, &added);
+			assert(added == size);
+			buffer->root = piece_grow(buffer->root, index, size, text_buffer_units(bytes, size),
+			                          scan_count_byte(bytes, size, '\n'));
+			return;
+		}
+	}
+
+	while(size > 0) {
+		u64 added;
+		const u8 *data = text_buffer_store_add(buffer->store, bytes, size, &added);
+		u64 units = text_buffer_units(data, added);
+		Piece *piece = piece_create(buffer, data, added, units, scan_count_byte(data, added, '\n'));
+		buffer->root = piece_insert_node(buffer, buffer->root, index, piece);
+		index += units;
+		bytes += added;
+		size -= added;
+	}
+}
+
+static void piece_delete(TextBuffer buffer, u64 index, u64 count) {
+	if(count == 0) {
+		return;
+	}
+	Piece *l;
+	Piece *m;
+	Piece *r;
+	piece_split(buffer, buffer->root, index, &l, &r);
+	piece_split(buffer, r, count, &m, &r);
+	piece_release(m);
+	buffer->root = piece_merge(l, r);
+}
+
+bool text_buffer_insert_bytes(TextBuffer buffer, u64 index, const u8 *bytes, u64 size) {
+	if(index > text_buffer_size(buffer)) {
+		return false;
+	}
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	if(!scan_utf8_valid(bytes, size)) {
+		return false;
+	}
+#endif
+	piece_insert(buffer, index, bytes, size);
+	text_buffer_lines_insert(buffer, index, bytes, size);
+	return true;
+}
+
+bool text_buffer_delete_range(TextBuffer buffer, u64 index, u64 count) {
+	if(index + count > text_buffer_size(buffer)) {
+		return false;
+	}
+	line_tree_delete_range(&buffer->lines, index, count);
+	piece_delete(buffer, index, count);
+	text_buffer_measure_lines(buffer, index, 0);
+	return true;
+}
+
+// NOTE: the added text of an edit as a tree of its own
+static Piece *piece_create_run(TextBuffer buffer, const u8 *bytes, u64 size) {
+	Piece *run = 0;
+	while(size > 0) {
+		u64 added;
+		const u8 *data = text_buffer_store_add(buffer->store, bytes, size, &added);
+		run = piece_merge(run, piece_create(buffer, data, added, text_buffer_units(data, added),
+		                                    scan_count_byte(data, added, '\n')));
+		bytes += added;
+		size -= added;
+	}
+	return run;
+}
+
+// NOTE: an edit of a batch with its inserted text already a tree
+typedef struct PieceEdit PieceEdit;
+struct PieceEdit {
+	u64 index;
+	u64 count;
+	Piece *run;
+};
+
+// NOTE: applies a group of edits to the tree that holds the text between
+// them, base is the index of the tree in the text before the batch. The tree
+// is cut around the middle edit and both halves recurse, so the sequence is
+// rebuilt in one pass where every split works on a smaller tree. Takes the
+// reference of the tree and of the runs
+static Piece *piece_apply_edits(TextBuffer buffer, Piece *tree, u64 base, PieceEdit *edits, u32 count) {
+	if(count == 0) {
+		return tree;
+	}
+	u32 mid = count / 2;
+	PieceEdit *edit = &edits[mid];
+
+	Piece *l;
+	Piece *m;
+	Piece *r;
+	piece_split(buffer, tree, edit->index - base, &l, &r);
+	piece_split(buffer, r, edit->count, &m, &r);
+	piece_release(m);
+
+	l = piece_apply_edits(buffer, l, base, edits, mid);
+	r = piece_apply_edits(buffer, r, edit->index + edit->count, edits + mid + 1, count - mid - 1);
+	return piece_merge(piece_merge(l, edit->run), r);
+}
+
+bool text_buffer_apply_edits(TextBuffer buffer, TextBufferEdit *edits, u32 count) {
+	if(!text_buffer_sort_edits(buffer, edits, count)) {
+		return false;
+	}
+	PieceEdit *piece_edits = (PieceEdit *)malloc(max(count, 1u) * sizeof(*piece_edits));
+	assert(piece_edits);
+	for(u32 i = 0; i < count; i++) {
+		piece_edits[i].index = edits[i].index;
+		piece_edits[i].count = edits[i].count;
+		piece_edits[i].run = piece_create_run(buffer, edits[i].bytes, edits[i].size);
+	}
+	buffer->root = piece_apply_edits(buffer, buffer->root, 0, piece_edits, count);
+	free(piece_edits);
+	text_buffer_apply_line_edits(buffer, edits, count);
+	return true;
+}
+
+// NOTE: the pieces of every snapshot go in as they are, the text is never
+// copied or scanned again for the tree
+bool text_buffer_apply_snapshot_edits(TextBuffer buffer, TextBufferSnapshotEdit *edits, u32 count) {
+	u64 end = 0;
+	u64 size = text_buffer_size(buffer);
+	for(u32 i = 0; i < count; i++) {
+		TextBufferSnapshotEdit *edit = &edits[i];
+		if(edit->index < end || edit->index + edit->count > size) {
+			return false;
+		}
+		assert(!edit->text || edit->text->store == buffer->store);
+		end = edit->index + edit->count;
+	}
+
+	PieceEdit *piece_edits = (PieceEdit *)malloc(max(count, 1u) * sizeof(*piece_edits));
+	assert(piece_edits);
+	for(u32 i = 0; i < count; i++) {
+		piece_edits[i].index = edits[i].index;
+		piece_edits[i].count = edits[i].count;
+		piece_edits[i].run = edits[i].text ? edits[i].text->root : 0;
+		piece_retain(piece_edits[i].run);
+	}
+	buffer->root = piece_apply_edits(buffer, buffer->root, 0, piece_edits, count);
+	free(piece_edits);
+	text_buffer_apply_snapshot_line_edits(buffer, edits, count);
+	return true;
+}
+
+bool text_buffer_insert(TextBuffer buffer, u64 index, u32 code) {
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	u8 bytes[4];
+	u32 size = utf8_encode(code, bytes);
+	if(size == 0) {
+		return false;
+	}
+	return text_buffer_insert_bytes(buffer, index, bytes, size);
+#else
+	u8 byte = (u8)code;
+	return text_buffer_insert_bytes(buffer, index, &byte, 1);
+#endif
+}
+
+bool text_buffer_delete(TextBuffer buffer, u64 index) {
+	if(index >= text_buffer_size(buffer)) {
+		return false;
+	}
+	return text_buffer_delete_range(buffer, index, 1);
+}
+
+u32 text_buffer_get(TextBuffer buffer, u64 index) {
+	assert(index < text_buffer_size(buffer));
+	u64 offset;
+	Piece *piece = piece_find(buffer->root, index, &offset);
+#if defined(TEXT_BUFFER_BACKEND_UTF8)
+	u64 byte_offset = piece_byte_offset(piece, offset);
+	u32 code;
+	utf8_decode(piece->data + byte_offset, piece->length - byte_offset, &code);
+	return code;
+#else
+	return (u32)piece->data[offset];
+#endif
+}
+
+// NOTE: the span of the piece that contains index, up to end. Index and end
+// are units, the span is bytes
+static Piece *piece_span(Piece *root, u64 *index, u64 end, u64 *offset, const u8 **data, u64 *size) {
+	Piece *piece = piece_find(root, *index, offset);
+	u64 available = piece_length(piece) - *offset;
+	u64 take = min(available, end - *index);
+	u64 start = piece_byte_offset(piece, *offset);
+	*data = piece->data + start;
+	if(take == available) {
+		*size = piece->length - start;
+	} else {
+		*size = piece_byte_offset(piece, *offset + take) - start;
+	}
+	*index += take;
+	return piece;
+}
+
+// NOTE: the tree has no parent links, every chunk finds its piece from the
+// root again
+void text_buffer_chunks_begin(TextBufferChunks *chunks, TextBuffer buffer, u64 index, u64 count) {
+	u64 size = text_buffer_size(buffer);
+	assert(index <= size);
+	chunks->buffer = buffer;
+	chunks->index = index;
+	chunks->end = index + min(count, size - index);
+	chunks->node = 0;
+	chunks->offset = 0;
+	chunks->data = 0;
+	chunks->size = 0;
+}
+
+bool text_buffer_chunks_next(TextBufferChunks *chunks) {
+	if(chunks->index >= chunks->end) {
+		return false;
+	}
+
+	chunks->node = piece_span(chunks->buffer->root, &chunks->index, chunks->end, &chunks->offset,
+	                          &chunks->data, &chunks->size);
+	return true;
+}
+
+bool text_buffer_line(TextBuffer buffer, u32 line, u64 *index, u32 *size) {
+	u64 line_len;
+	if(!line_tree_find_line(&buffer->lines, line, index, &line_len)) {
+		return false;
+	}
+	*size = (u32)line_len;
+	return true;
+}
+
+TextBufferSnapshot text_buffer_snapshot(TextBuffer buffer) {
+	TextBufferSnapshot snapshot = (TextBufferSnapshot)malloc(sizeof(*snapshot));
+	assert(snapshot);
+	snapshot->root = buffer->root;
+	piece_retain(snapshot->root);
+	snapshot->store = buffer->store;
+	snapshot->store->refs++;
+	return snapshot;
+}
+
+TextBufferSnapshot text_buffer_snapshot_range(TextBuffer buffer, u64 index, u64 count) {
+	assert(index + count <= text_buffer_size(buffer));
+	TextBufferSnapshot snapshot = (TextBufferSnapshot)malloc(sizeof(*snapshot));
+	assert(snapshot);
+
+	// NOTE: the splits copy the pieces on the path instead of changing the
+	// ones the buffer uses
+	Piece *l;
+	Piece *r;
+	piece_retain(buffer->root);
+	piece_split(buffer, buffer->root, index, &l, &r);
+	piece_split(buffer, r, count, &snapshot->root, &r);
+	piece_release(l);
+	piece_release(r);
+
+	snapshot->store = buffer->store;
+	snapshot->store->refs++;
+	return snapshot;
+}
+
+static u64 piece_count(Piece *piece) {
+	return piece ? piece_count(piece->l) + 1 + piece_count(piece->r) : 0;
+}
+
+// NOTE: every piece is counted, the ones the buffer still shares too
+u64 text_buffer_snapshot_memory(TextBufferSnapshot snapshot) {
+	return sizeof(*snapshot) + piece_count(snapshot->root) * sizeof(Piece);
+}
+
+// NOTE: the pieces the range touches, a snapshot of it has one per piece
+static u64 piece_count_range(Piece *piece, u64 index, u64 count) {
+	if(!piece || count == 0) {
+		return 0;
+	}
+	u64 start = piece_units(piece->l);
+	u64 end = start + piece_length(piece);
+	u64 pieces = 0;
+	if(index < start) {
+		pieces += piece_count_range(piece->l, index, min(count, start - index));
+	}
+	if(index < end && index + count > start) {
+		pieces++;
+	}
+	if(index + count > end) {
+		u64 first = max(index, end);
+		pieces += piece_count_range(piece->r, first - end, index + count - first);
+	}
+	return pieces;
+}
+
+u64 text_buffer_snapshot_range_memory(TextBuffer buffer, u64 index, u64 count) {
+	assert(index + count <= text_buffer_size(buffer));
+	return sizeof(struct TextBufferSnapshot) + piece_count_range(buffer->root, index, count) * sizeof(Piece);
+}
+
+void text_buffer_snapshot_release(TextBufferSnapshot snapshot) {
+	assert(snapshot);
+	piece_release(snapshot->root);
+	text_buffer_store_release(snapshot->store);
+	free(snapshot);
+}
+
+u64 text_buffer_snapshot_size(TextBufferSnapshot snapshot) {
+	return piece_units(snapshot->root);
+}
+
+u32 text_buffer_snapshot_line_count(TextBufferSnapshot snapshot) {
+	return (u32)piece_lines(snapshot->root) + 1;
+}
+
+bool text_buffer_snapshot_line(TextBufferSnapshot snapshot, u32 line, u64 *index, u32 *size) {
+	u64 line_len;
+	if(!piece_find_line(snapshot->root, line, index, &line_len)) {
+		return false;
+	}
+	*size = (u32)line_len;
+	return true;
+}
+
+void text_buffer_snapshot_chunks_begin(TextBufferSnapshotChunks *chunks, TextBufferSnapshot snapshot, u64 index, u64 count) {
+	u64 size = text_buffer_snapshot_size(snapshot);
+	assert(index <= size);
+	chunks->snapshot = snapshot;
+	chunks->index = index;
+	chunks->end = index + min(count, size - index);
+	chunks->data = 0;
+	chunks->size = 0;
+}
+
+bool text_buffer_snapshot_chunks_next(TextBufferSnapshotChunks *chunks) {
+	if(chunks->index >= chunks->end) {
+		return false;
+	}
+
+	u64 offset;
+	piece_span(chunks->snapshot->root, &chunks->index, chunks->end, &offset, &chunks->data, &chunks->size);
+	return true;
+}
@@ -0,0 +1,128 @@
+#include "text_buffer.h"
+#include "core/scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE: snapshots for the gap and ascii backends, they edit their text in
+// place and can not share it: the text is copied out with the chunk iterator
+// and its new lines are collected once, so taking a snapshot is O(n) and
+// reading it is the same as reading a flat array. Both count bytes, so the
+// indices of the copy are the indices of the buffer. The piece table and the
+// utf-8 backend have their own O(1) snapshots.
+
+struct TextBufferSnapshot {
+	u8 *data;
+	u64 size;
+
+	u64 *newlines;
+	u64 newline_count;
+};
+
+TextBufferSnapshot text_buffer_snapshot_range(TextBuffer buffer, u64 index, u64 count) {
+	assert(index + count <= text_buffer_size(buffer));
+	TextBufferSnapshot snapshot = (TextBufferSnapshot)malloc(sizeof(*snapshot));
+	assert(snapshot);
+
+	snapshot->data = (u8 *)malloc(max(count, 1));
+	assert(snapshot->data);
+	snapshot->size = 0;
+	TextBufferChunks chunks;
+	text_buffer_chunks_begin(&chunks, buffer, index, count);
+	while(text_buffer_chunks_next(&chunks)) {
+		memcpy(snapshot->data + snapshot->size, chunks.data, chunks.size);
+		snapshot->size += chunks.size;
+	}
+	assert(snapshot->size == count);
+
+	snapshot->newline_count = scan_count_byte(snapshot->data, snapshot->size, '\n');
+	snapshot->newlines = (u64 *)malloc(max(snapshot->newline_count, 1) * sizeof(*snapshot->newlines));
+	assert(snapshot->newlines);
+	u64 newlines = scan_collect_byte(snapshot->data, snapshot->size, '\n', 0, snapshot->newlines);
+	assert(newlines == snapshot->newline_count);
+	return snapshot;
+}
+
+TextBufferSnapshot text_buffer_snapshot(TextBuffer buffer) {
+	return text_buffer_snapshot_range(buffer, 0, text_buffer_size(buffer));
+}
+
+void text_buffer_snapshot_release(TextBufferSnapshot snapshot) {
+	assert(snapshot);
+	free(snapshot->newlines);
+	free(snapshot->data);
+	free(snapshot);
+}
+
+u64 text_buffer_snapshot_memory(TextBufferSnapshot snapshot) {
+	return sizeof(*snapshot) + snapshot->size + snapshot->newline_count * sizeof(*snapshot->newlines);
+}
+
+// NOTE: the new lines of the range come from the line tree, so the size of a
+// copy is known before it is made
+u64 text_buffer_snapshot_range_memory(TextBuffer buffer, u64 index, u64 count) {
+	assert(index + count <= text_buffer_size(buffer));
+	LineTree *tree = text_buffer_line_tree(buffer);
+	u32 first_line;
+	u32 last_line;
+	u64 col;
+	bool found = line_tree_find_byte(tree, index, &first_line, &col);
+	found = found && line_tree_find_byte(tree, index + count, &last_line, &col);
+	assert(found);
+	return sizeof(struct TextBufferSnapshot) + count + (u64)(last_line - first_line) * sizeof(u64);
+}
+
+// NOTE: the copies are flat, so they go in as the bytes of plain edits
+bool text_buffer_apply_snapshot_edits(TextBuffer buffer, TextBufferSnapshotEdit *edits, u32 count) {
+	TextBufferEdit *byte_edits = (TextBufferEdit *)malloc(max(count, 1u) * sizeof(*byte_edits));
+	assert(byte_edits);
+	for(u32 i = 0; i < count; i++) {
+		TextBufferSnapshotEdit *edit = &edits[i];
+		byte_edits[i].index = edit->index;
+		byte_edits[i].count = edit->count;
+		byte_edits[i].bytes = edit->text ? edit->text->data : 0;
+		byte_edits[i].size = edit->text ? edit->text->size : 0;
+	}
+	bool applied = text_buffer_apply_edits(buffer, byte_edits, count);
+	free(byte_edits);
+	return applied;
+}
+
+u64 text_buffer_snapshot_size(TextBufferSnapshot snapshot) {
+	return snapshot->size;
+}
+
+u32 text_buffer_snapshot_line_count(TextBufferSnapshot snapshot) {
+	return (u32)snapshot->newline_count + 1;
+}
+
+bool text_buffer_snapshot_line(TextBufferSnapshot snapshot, u32 line, u64 *index, u32 *size) {
+	if(line > snapshot->newline_count) {
+		return false;
+	}
+	u64 start = line > 0 ? snapshot->newlines[line - 1] + 1 : 0;
+	u64 end = line < snapshot->newline_count ? snapshot->newlines[line] : snapshot->size;
+	*index = start;
+	*size = (u32)(end - start);
+	return true;
+}
+
+void text_buffer_snapshot_chunks_begin(TextBufferSnapshotChunks *chunks, TextBufferSnapshot snapshot, u64 index, u64 count) {
+	assert(index <= snapshot->size);
+	chunks->snapshot = snapshot;
+	chunks->index = index;
+	chunks->end = index + min(count, snapshot->size - index);
+	chunks->data = 0;
+	chunks->size = 0;
+}
+
+bool text_buffer_snapshot_chunks_next(TextBufferSnapshotChunks *chunks) {
+	if(chunks->index >= chunks->end) {
+		return false;
+	}
+
+	chunks->data = chunks->snapshot->data + chunks->index;
+	chunks->size = chunks->end - chunks->index;
+	chunks->index = chunks->end;
+	return true;
+}
@@ -0,0 +1,375 @@
+#include "undo.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void undo_init(Undo *undo, u64 memory_limit) {
+	memset(undo, 0, sizeof(*undo));
+	undo->memory_limit = memory_limit;
+}
+
+static void undo_delta_release(Undo *undo, UndoDelta *delta) {
+	if(delta->removed) {
+		undo->memory -= text_buffer_snapshot_memory(delta->removed);
+		text_buffer_snapshot_release(delta->removed);
+	}
+	if(delta->inserted) {
+		undo->memory -= text_buffer_snapshot_memory(delta->inserted);
+		text_buffer_snapshot_release(delta->inserted);
+	}
+	undo->memory -= sizeof(*delta);
+}
+
+void undo_destroy(Undo *undo) {
+	for(u64 i = 0; i < undo->delta_count; i++) {
+		undo_delta_release(undo, &undo->deltas[undo->first_delta + i]);
+	}
+	free(undo->groups);
+	free(undo->deltas);
+	memset(undo, 0, sizeof(*undo));
+}
+
+static UndoGroup *undo_group(Undo *undo, u64 group) {
+	assert(group < undo->group_count);
+	return &undo->groups[undo->first_group + group];
+}
+
+static UndoDelta *undo_group_delta(Undo *undo, UndoGroup *group, u64 delta) {
+	assert(delta < group->delta_count);
+	return &undo->deltas[group->first_delta + delta];
+}
+
+static void undo_release_group(Undo *undo, UndoGroup *group) {
+	for(u64 i = 0; i < group->delta_count; i++) {
+		undo_delta_release(undo, undo_group_delta(undo, group, i));
+	}
+	undo->memory -= sizeof(*group);
+}
+
+// NOTE: drops every group that could be redone, they are the newest ones so
+// their deltas are at the end
+static void undo_truncate(Undo *undo) {
+	while(undo->group_count > undo->position) {
+		UndoGroup *group = undo_group(undo, undo->group_count-1);
+		undo_release_group(undo, group);
+		undo->delta_count -= group->delta_count;
+		undo->group_count--;
+	}
+}
+
+static void undo_drop_oldest(Undo *undo) {
+	assert(undo->position > 0);
+	UndoGroup *group = undo_group(undo, 0);
+	undo_release_group(undo, group);
+	undo->first_delta += group->delta_count;
+	undo->delta_count -= group->delta_count;
+	undo->first_group++;
+	undo->group_count--;
+	undo->position--;
+}
+
+// NOTE: makes room for a change of size bytes before it is recorded, the
+// oldest groups go first. A change over the limit on its own clears the
+// history and returns false, it is applied without being recorded and the
+// groups before it could not be undone past it
+static bool undo_reserve(Undo *undo, u64 size) {
+	if(size > undo->memory_limit) {
+		while(undo->group_count > 0) {
+			undo_drop_oldest(undo);
+		}
+		return false;
+	}
+	while(undo->memory + size > undo->memory_limit && undo->group_count > 0) {
+		undo_drop_oldest(undo);
+	}
+	return true;
+}
+
+static UndoGroup *undo_push_group(Undo *undo, bool batch) {
+	if(undo->group_count > 0) {
+		undo_group(undo, undo->group_count-1)->sealed = true;
+	}
+
+	if(undo->first_group + undo->group_count == undo->group_capacity) {
+		// NOTE: slots freed at the front are reused before growing
+		if(undo->first_group > undo->group_count) {
+			memmove(undo->groups, undo->groups + undo->first_group, undo->group_count * sizeof(*undo->groups));
+			undo->first_group = 0;
+		} else {
+			undo->group_capacity = undo->group_capacity ? undo->group_capacity * 2 : 256;
+			undo->groups = (UndoGroup *)realloc(undo->groups, undo->group_capacity * sizeof(*undo->groups));
+			assert(undo->groups);
+		}
+	}
+
+	UndoGroup *group = &undo->groups[undo->first_group + undo->group_count++];
+	group->first_delta = undo->first_delta + undo->delta_count;
+	group->delta_count = 0;
+	group->memory = sizeof(*group);
+	group->batch = batch;
+	group->sealed = false;
+	undo->position = undo->group_count;
+	undo->memory += sizeof(*group);
+	return group;
+}
+
+// NOTE: takes the snapshot of the removed text, the inserted text is cut out
+// when the delta is undone
+static UndoDelta *undo_push_delta(Undo *undo, UndoGroup *group, u64 index, u64 removed_units,
+                                  TextBufferSnapshot removed, u64 inserted_units) {
+	assert(group == undo_group(undo, undo->group_count-1));
+
+	if(undo->first_delta + undo->delta_count == undo->delta_capacity) {
+		if(undo->first_delta > undo->delta_count) {
+			u64 shift = undo->first_delta;
+			memmove(undo->deltas, undo->deltas + shift, undo->delta_count * sizeof(*undo->deltas));
+			undo->first_delta = 0;
+			for(u64 i = 0; i < undo->group_count; i++) {
+				undo_group(undo, i)->first_delta -= shift;
+			}
+		} else {
+			undo->delta_capacity = undo->delta_capacity ? undo->delta_capacity * 2 : 1024;
+			undo->deltas = (UndoDelta *)realloc(undo->deltas, undo->delta_capacity * sizeof(*undo->deltas));
+			assert(undo->deltas);
+		}
+	}
+
+	UndoDelta *delta = &undo->deltas[undo->first_delta + undo->delta_count++];
+	group->delta_count++;
+	delta->index = index;
+	delta->removed_units = removed_units;
+	delta->inserted_units = inserted_units;
+	delta->removed = removed;
+	delta->inserted = 0;
+	u64 memory = sizeof(*delta) + (removed ? text_buffer_snapshot_memory(removed) : 0);
+	group->memory += memory;
+	undo->memory += memory;
+	return delta;
+}
+
+// NOTE: the open group edits can still be joined to, only when nothing can
+// be redone
+static UndoGroup *undo_open_group(Undo *undo) {
+	if(undo->group_count == 0 || undo->position != undo->group_count) {
+		return 0;
+	}
+	UndoGroup *group = undo_group(undo, undo->group_count-1);
+	if(group->sealed || group->batch || group->delta_count == 0) {
+		return 0;
+	}
+	return group;
+}
+
+// NOTE: the inserted text of a delta, at index in the buffer as it is right
+// after the delta. It is counted before it is cut like any change, the groups
+// older than the one being undone make room for it. Returns false and drops
+// and cuts nothing when it does not fit, the group can not be redone then
+static bool undo_cut_inserted(Undo *undo, UndoGroup *group, UndoDelta *delta, TextBuffer text, u64 index) {
+	if(delta->inserted || delta->inserted_units == 0) {
+		return true;
+	}
+	u64 size = text_buffer_snapshot_range_memory(text, index, delta->inserted_units);
+	u64 memory = undo->memory;
+	u64 drop = 0;
+	while(memory + size > undo->memory_limit && drop + 1 < undo->position) {
+		memory -= undo_group(undo, drop)->memory;
+		drop++;
+	}
+	if(memory + size > undo->memory_limit) {
+		return false;
+	}
+	while(drop--) {
+		undo_drop_oldest(undo);
+	}
+
+	delta->inserted = text_buffer_snapshot_range(text, index, delta->inserted_units);
+	size = text_buffer_snapshot_memory(delta->inserted);
+	group->memory += size;
+	undo->memory += size;
+	return true;
+}
+
+void undo_seal(Undo *undo) {
+	if(undo->group_count > 0) {
+		undo_group(undo, undo->group_count-1)->sealed = true;
+	}
+}
+
+bool undo_insert(Undo *undo, TextBuffer text, u64 index, const u8 *bytes, u64 size) {
+	u64 old_size = text_buffer_size(text);
+	if(!text_buffer_insert_bytes(text, index, bytes, size)) {
+		return false;
+	}
+	u64 units = text_buffer_size(text) - old_size;
+	if(size == 0) {
+		return true;
+	}
+	undo_truncate(undo);
+
+	UndoGroup *group = undo_open_group(undo);
+	UndoDelta *delta = group ? undo_group_delta(undo, group, group->delta_count-1) : 0;
+	if(delta && delta->removed_units == 0 && delta->index + delta->inserted_units == index) {
+		delta->inserted_units += units;
+	} else if(undo_reserve(undo, sizeof(UndoGroup) + sizeof(UndoDelta))) {
+		group = undo_push_group(undo, false);
+		undo_push_delta(undo, group, index, 0, 0, units);
+	}
+
+	// NOTE: a new line ends the run of typing
+	if(memchr(bytes, '\n', size)) {
+		undo_seal(undo);
+	}
+	return true;
+}
+
+bool undo_delete(Undo *undo, TextBuffer text, u64 index, u64 count) {
+	if(index + count > text_buffer_size(text)) {
+		return false;
+	}
+	if(count == 0) {
+		return true;
+	}
+	undo_truncate(undo);
+
+	TextBufferSnapshot removed = text_buffer_snapshot_range(text, index, count);
+	if(undo_reserve(undo, sizeof(UndoGroup) + sizeof(UndoDelta) + text_buffer_snapshot_memory(removed))) {
+		// NOTE: backspacing right before the last delete joins its group
+		UndoGroup *group = undo_open_group(undo);
+		UndoDelta *last = group ? undo_group_delta(undo, group, group->delta_count-1) : 0;
+		if(!last || last->inserted_units != 0 || index + count != last->index) {
+			group = undo_push_group(undo, false);
+		}
+		undo_push_delta(undo, group, index, count, removed, 0);
+	} else {
+		text_buffer_snapshot_release(removed);
+	}
+
+	bool deleted = text_buffer_delete_range(text, index, count);
+	assert(deleted);
+	return true;
+}
+
+bool undo_apply_edits(Undo *undo, TextBuffer text, TextBufferEdit *edits, u32 count) {
+	if(!text_buffer_sort_edits(text, edits, count)) {
+		return false;
+	}
+	if(count == 0) {
+		return true;
+	}
+	undo_truncate(undo);
+
+	// NOTE: the removed text is only cut out when the deltas alone fit
+	TextBufferSnapshot *removed = (TextBufferSnapshot *)calloc(count, sizeof(*removed));
+	assert(removed);
+	u64 memory = sizeof(UndoGroup) + count * sizeof(UndoDelta);
+	for(u32 i = 0; i < count && memory <= undo->memory_limit; i++) {
+		TextBufferEdit *edit = &edits[i];
+		if(edit->count) {
+			removed[i] = text_buffer_snapshot_range(text, edit->index, edit->count);
+			memory += text_buffer_snapshot_memory(removed[i]);
+		}
+	}
+	if(undo_reserve(undo, memory)) {
+		UndoGroup *group = undo_push_group(undo, true);
+		for(u32 i = 0; i < count; i++) {
+			TextBufferEdit *edit = &edits[i];
+			undo_push_delta(undo, group, edit->index, edit->count, removed[i], text_buffer_units(edit->bytes, edit->size));
+		}
+		undo_seal(undo);
+	} else {
+		for(u32 i = 0; i < count; i++) {
+			if(removed[i]) {
+				text_buffer_snapshot_release(removed[i]);
+			}
+		}
+	}
+	free(removed);
+
+	bool applied = text_buffer_apply_edits(text, edits, count);
+	assert(applied);
+	return true;
+}
+
+// NOTE: a batch group goes back in one text_buffer_apply_snapshot_edits
+// call, every delta is one range edit. A sequential group is applied a delta
+// at a time, newest first when undoing. Undo cuts the inserted text out of
+// the buffer before it goes, redoable is cleared if some of it did not fit
+static u64 undo_group_apply(Undo *undo, UndoGroup *group, TextBuffer text, bool redo, bool *redoable) {
+	u64 index = 0;
+	if(group->batch) {
+		TextBufferSnapshotEdit *edits = (TextBufferSnapshotEdit *)malloc(group->delta_count * sizeof(*edits));
+		assert(edits);
+		s64 shift = 0;
+		for(u64 i = 0; i < group->delta_count; i++) {
+			UndoDelta *delta = undo_group_delta(undo, group, i);
+			TextBufferSnapshotEdit *edit = &edits[i];
+			u64 shifted = (u64)((s64)delta->index + shift);
+			if(redo) {
+				assert(delta->inserted || delta->inserted_units == 0);
+				edit->index = delta->index;
+				edit->count = delta->removed_units;
+				edit->text = delta->inserted;
+				index = shifted + delta->inserted_units;
+			} else {
+				*redoable = *redoable && undo_cut_inserted(undo, group, delta, text, shifted);
+				edit->index = shifted;
+				edit->count = delta->inserted_units;
+				edit->text = delta->removed;
+				index = delta->index + delta->removed_units;
+			}
+			shift += (s64)delta->inserted_units - (s64)delta->removed_units;
+		}
+		bool applied = text_buffer_apply_snapshot_edits(text, edits, (u32)group->delta_count);
+		assert(applied);
+		free(edits);
+		return index;
+	}
+
+	for(u64 i = 0; i < group->delta_count; i++) {
+		UndoDelta *delta = undo_group_delta(undo, group, redo ? i : group->delta_count-1-i);
+		TextBufferSnapshotEdit edit;
+		edit.index = delta->index;
+		if(redo) {
+			assert(delta->inserted || delta->inserted_units == 0);
+			edit.count = delta->removed_units;
+			edit.text = delta->inserted;
+			index = delta->index + delta->inserted_units;
+		} else {
+			*redoable = *redoable && undo_cut_inserted(undo, group, delta, text, delta->index);
+			edit.count = delta->inserted_units;
+			edit.text = delta->removed;
+			index = delta->index + delta->removed_units;
+		}
+		bool applied = text_buffer_apply_snapshot_edits(text, &edit, 1);
+		assert(applied);
+	}
+	return index;
+}
+
+bool undo_undo(Undo *undo, TextBuffer text, u64 *index) {
+	if(undo->position == 0) {
+		return false;
+	}
+	UndoGroup *group = undo_group(undo, undo->position-1);
+	group->sealed = true;
+	bool redoable = true;
+	*index = undo_group_apply(undo, group, text, false, &redoable);
+	undo->position--;
+	// NOTE: the group is undone without the text it inserted, so it and the
+	// ones after it are dropped instead of going over the limit
+	if(!redoable) {
+		undo_truncate(undo);
+	}
+	return true;
+}
+
+bool undo_redo(Undo *undo, TextBuffer text, u64 *index) {
+	if(undo->position == undo->group_count) {
+		return false;
+	}
+	UndoGroup *group = undo_group(undo, undo->position);
+	bool redoable = true;
+	*index = undo_group_apply(undo, group, text, true, &redoable);
+	undo->position++;
+	return true;
+}
@@ -0,0 +1,80 @@
+#ifndef _UNDO_H_
+#define _UNDO_H_
+
+#include "core/types.h"
+#include "text_buffer.h"
+
+// NOTE: undo history as an append only log of deltas. A delta is an index,
+// the text it removed and the text it inserted. The text is kept as snapshots
+// of ranges of the buffer, so with the piece table a delta holds the pieces
+// of its text and no bytes are copied. The removed text is cut out before the
+// edit, the inserted text only when the delta is first undone because until
+// then the buffer has it.
+//
+// Deltas are grouped, undo and redo work one group at a time: a batch group
+// was applied in one text_buffer_apply_edits call and is undone the same way,
+// the deltas of a sequential group are undone one range edit each, newest
+// first. Typing at the end of the last insert grows its delta and
+// backspacing right before the last delete joins its group, until the group
+// is sealed. A change is counted against the memory limit before it is
+// recorded and the oldest groups are dropped to make room for it. A change
+// that is over the limit on its own is not recorded and clears the history.
+// The inserted text is counted the same way when it is cut, a group whose
+// text does not fit is undone without it and can not be redone.
+
+#define UNDO_MEMORY_LIMIT (64 << 20)
+
+typedef struct UndoDelta UndoDelta;
+struct UndoDelta {
+	u64 index;
+	u64 removed_units;
+	u64 inserted_units;
+
+	TextBufferSnapshot removed;
+	TextBufferSnapshot inserted;
+};
+
+typedef struct UndoGroup UndoGroup;
+struct UndoGroup {
+	u64 first_delta;
+	u64 delta_count;
+	// NOTE: the memory of the group and its deltas, counted in memory too
+	u64 memory;
+	bool batch;
+	bool sealed;
+};
+
+typedef struct Undo Undo;
+struct Undo {
+	UndoGroup *groups;
+	u64 first_group;
+	u64 group_count;
+	u64 group_capacity;
+	// NOTE: groups before position are undone by undo, the rest are redone
+	u64 position;
+
+	UndoDelta *deltas;
+	u64 first_delta;
+	u64 delta_count;
+	u64 delta_capacity;
+
+	u64 memory;
+	u64 memory_limit;
+};
+
+void undo_init(Undo *undo, u64 memory_limit);
+void undo_destroy(Undo *undo);
+
+// NOTE: apply the edit to the text and record it, they drop every group that
+// could still be redone
+bool undo_insert(Undo *undo, TextBuffer text, u64 index, const u8 *bytes, u64 size);
+bool undo_delete(Undo *undo, TextBuffer text, u64 index, u64 count);
+bool undo_apply_edits(Undo *undo, TextBuffer text, TextBufferEdit *edits, u32 count);
+// NOTE: the next edit starts a new group
+void undo_seal(Undo *undo);
+
+// NOTE: index is where the cursor goes, the end of the last change
+bool undo_undo(Undo *undo, TextBuffer text, u64 *index);
+bool undo_redo(Undo *undo, TextBuffer text, u64 *index);
+
+#endif // _UNDO_H_